@@ -34,7 +34,7 @@ mkdir -p /usr/include/rwedb2
 
 cd /tmp/RDB2/src
 
-g++ -m64 -std=c++11 -shared -Wl,-soname,librwedb2.so.1 -o librwedb2.so.1.0   rwedb2*.o
+g++ -m64 -std=c++11 -pthread -shared -Wl,-soname,librwedb2.so.1 -o librwedb2.so.1.0   rwedb2*.o -lz
 
 mv librwedb2.so.1.0 /usr/lib64/
 
@@ -0,0 +1,357 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2016, 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+#include "dc.h"
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <exception>
+
+// largest number of digits after the decimal point that we will suggest a DECIMAL type for
+#define PROFILE_MAX_DECIMAL_SCALE 6
+// DB2 limit on the precision of a DECIMAL column
+#define PROFILE_MAX_DECIMAL_PRECISION 31
+// largest integer that is still exactly representable in a double
+#define PROFILE_MAX_EXACT_DOUBLE 9007199254740992.0
+// DB2 limit on the length in bytes of a VARCHAR column. Longer strings need a CLOB
+#define PROFILE_MAX_VARCHAR_LENGTH 32672
+
+namespace rdb2 {
+
+struct column_profile {
+  // input - raw pointers into the R column so that worker threads never touch R objects
+  SEXPTYPE type;
+  const SEXP* strings;
+  const int* integers;
+  const double* doubles;
+
+  // results
+  long max_utf16;
+  long max_utf8;
+  long na_count;
+  double min;
+  double max;
+  bool integral;   // every non-NA value is a whole number
+  int scale;       // number of digits after the decimal point needed to represent every value exactly
+  std::string sql_type;
+  std::string narrow_type;
+
+  column_profile() :
+      type(NILSXP), strings(NULL), integers(NULL), doubles(NULL), max_utf16(0), max_utf8(0), na_count(0),
+      min(NA_REAL), max(NA_REAL), integral(false), scale(0) {
+  }
+};
+
+static inline long __utf16_length(const char* str, const long bytes) {
+  // number of UTF-16 code units needed for a UTF-8 string. Every character that does not start with
+  // a continuation byte is one code unit, except 4 byte sequences which need a surrogate pair
+  long units = 0;
+  const unsigned char* s = (const unsigned char*) str;
+
+  for (long k = 0; k < bytes; k++) {
+    units += ((s[k] & 0xC0) != 0x80) + (s[k] >= 0xF0);
+  }
+
+  return units;
+}
+
+static int __decimal_digits(double value) {
+  // number of digits before the decimal point
+  int digits = 1;
+  value = std::fabs(value);
+
+  while (value >= 10.0 && digits <= PROFILE_MAX_DECIMAL_PRECISION) {
+    value /= 10.0;
+    digits++;
+  }
+
+  return digits;
+}
+
+static int __decimal_scale(double value, int current_scale) {
+  // smallest scale >= current_scale at which value has no fractional part,
+  // or PROFILE_MAX_DECIMAL_SCALE + 1 if there is none
+  double scaled = value * std::pow(10.0, current_scale);
+
+  for (int s = current_scale; s <= PROFILE_MAX_DECIMAL_SCALE; s++) {
+    if (std::fabs(scaled - std::round(scaled)) <= 1e-9 * std::fmax(1.0, std::fabs(scaled))) {
+      return s;
+    }
+    scaled *= 10.0;
+  }
+
+  return PROFILE_MAX_DECIMAL_SCALE + 1;
+}
+
+static std::string __narrowest_integer_type(double min, double max) {
+  if (min >= -32768 && max <= 32767) {
+    return "SMALLINT";
+  } else if (min >= -2147483648.0 && max <= 2147483647.0) {
+    return "INTEGER";
+  }
+  return "BIGINT";
+}
+
+static void __profile_strings(column_profile& p, const R_xlen_t nrows) {
+  for (R_xlen_t j = 0; j < nrows; j++) {
+    SEXP str = p.strings[j];
+    if (str == NA_STRING) {
+      p.na_count++;
+      continue;
+    }
+
+    long bytes = LENGTH(str);
+    if (bytes > p.max_utf8) {
+      p.max_utf8 = bytes;
+    }
+
+    // UTF-16 length can never exceed the UTF-8 length so skip strings that cannot be a new maximum
+    if (bytes > p.max_utf16) {
+      long units = __utf16_length(CHAR(str), bytes);
+      if (units > p.max_utf16) {
+        p.max_utf16 = units;
+      }
+    }
+  }
+
+  std::string varchar = "VARCHAR(" + std::to_string(std::max(p.max_utf8, 1L)) + ")";
+  if (p.max_utf8 > PROFILE_MAX_VARCHAR_LENGTH) {
+    varchar = "CLOB(" + std::to_string(p.max_utf8) + ")";
+  }
+  p.sql_type = varchar;
+  p.narrow_type = varchar;
+}
+
+static void __profile_raw_list(column_profile& p, const SEXP col) {
+  // a list of raw vectors (NULL for NA) is a binary LOB column. This needs the R API so it runs on the
+  // main thread, but only looks at the lengths
+  R_xlen_t nrows = XLENGTH(col);
+
+  for (R_xlen_t j = 0; j < nrows; j++) {
+    SEXP bytes = VECTOR_ELT(col, j);
+    if (bytes == R_NilValue) {
+      p.na_count++;
+    } else if (TYPEOF(bytes) != RAWSXP) {
+      throw std::runtime_error("List columns must only hold raw vectors or NULL");
+    } else if (XLENGTH(bytes) > p.max_utf8) {
+      p.max_utf8 = XLENGTH(bytes);
+    }
+  }
+
+  std::string blob = "BLOB(" + std::to_string(std::max(p.max_utf8, 1L)) + ")";
+  p.sql_type = blob;
+  p.narrow_type = blob;
+}
+
+static void __profile_integers(column_profile& p, const R_xlen_t nrows) {
+  int min = 0;
+  int max = 0;
+  bool found = false;
+
+  for (R_xlen_t j = 0; j < nrows; j++) {
+    int val = p.integers[j];
+    if (val == NA_INTEGER) {
+      p.na_count++;
+    } else if (!found) {
+      min = max = val;
+      found = true;
+    } else if (val < min) {
+      min = val;
+    } else if (val > max) {
+      max = val;
+    }
+  }
+
+  if (found) {
+    p.min = min;
+    p.max = max;
+  }
+
+  p.integral = true;
+  p.sql_type = "BIGINT";
+  p.narrow_type = found ? __narrowest_integer_type(min, max) : "INTEGER";
+}
+
+static void __profile_doubles(column_profile& p, const R_xlen_t nrows) {
+  double min = 0;
+  double max = 0;
+  bool found = false;
+  bool finite = true;
+
+  for (R_xlen_t j = 0; j < nrows; j++) {
+    double val = p.doubles[j];
+    if (ISNAN(val)) {
+      p.na_count++;
+      continue;
+    }
+
+    if (!std::isfinite(val)) {
+      finite = false;
+    } else if (p.scale <= PROFILE_MAX_DECIMAL_SCALE) {
+      p.scale = __decimal_scale(val, p.scale);
+    }
+
+    if (!found) {
+      min = max = val;
+      found = true;
+    } else if (val < min) {
+      min = val;
+    } else if (val > max) {
+      max = val;
+    }
+  }
+
+  if (found) {
+    p.min = min;
+    p.max = max;
+  }
+
+  p.integral = finite && (p.scale == 0);
+  p.sql_type = "DOUBLE";
+  p.narrow_type = "DOUBLE";
+
+  if (!found || !finite || p.scale > PROFILE_MAX_DECIMAL_SCALE) {
+    return;
+  }
+
+  double max_abs = std::fmax(std::fabs(min), std::fabs(max));
+  if (p.integral && max_abs <= PROFILE_MAX_EXACT_DOUBLE) {
+    p.narrow_type = __narrowest_integer_type(min, max);
+    return;
+  }
+
+  int precision = __decimal_digits(max_abs) + p.scale;
+  if (precision <= PROFILE_MAX_DECIMAL_PRECISION) {
+    p.narrow_type = "DECIMAL(" + std::to_string(precision) + "," + std::to_string(p.scale) + ")";
+  }
+}
+
+static void __profile_column(column_profile& p, const R_xlen_t nrows) {
+  switch (p.type) {
+  case STRSXP:
+    __profile_strings(p, nrows);
+    break;
+  case INTSXP:
+    __profile_integers(p, nrows);
+    break;
+  case REALSXP:
+    __profile_doubles(p, nrows);
+    break;
+  }
+}
+
+static void profile_columns(std::vector<column_profile>& profiles, const R_xlen_t nrows, unsigned int nthreads) {
+  // profile the columns in parallel. Each worker picks up the next column that has not been profiled.
+  // The R API is not thread safe, so the column data pointers are taken on the main thread. The only R
+  // calls inside the workers are CHAR() and LENGTH() on the elements of character columns, which read the
+  // CHARSXP without allocating, raising errors or touching any other R state
+  std::atomic<size_t> next(0);
+  std::exception_ptr error = nullptr;
+  std::mutex error_mutex;
+  std::vector<std::thread> workers;
+
+  auto worker = [&]() {
+    size_t i;
+    while ((i = next++) < profiles.size()) {
+      try {
+        __profile_column(profiles[i], nrows);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+  };
+
+  nthreads = std::min<size_t>(std::max(nthreads, 1u), profiles.size());
+  for (unsigned int t = 1; t < nthreads; t++) {
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace
+
+using namespace rdb2;
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbProfileColumnsInternal")]]
+
+Rcpp::List dbProfileColumnsInternal(const Rcpp::DataFrame& df, int threads) {
+
+  size_t ncols = df.size();
+  R_xlen_t nrows = df.nrows();
+  size_t i;
+
+  std::vector<column_profile> profiles(ncols);
+
+  // collect raw pointers to the column data on the main thread
+  for (i = 0; i < ncols; i++) {
+    SEXP col = df[i];
+    profiles[i].type = TYPEOF(col);
+    switch (TYPEOF(col)) {
+    case STRSXP:
+      profiles[i].strings = STRING_PTR_RO(col);
+      break;
+    case INTSXP:
+      profiles[i].integers = INTEGER(col);
+      break;
+    case REALSXP:
+      profiles[i].doubles = REAL(col);
+      break;
+    case VECSXP:
+      __profile_raw_list(profiles[i], col);
+      break;
+    default:
+      throw std::runtime_error("Unable to profile column " + std::to_string(i + 1) + " of type "
+          + Rcpp::as<std::string>(Rcpp::RObject(col).attr("class")));
+    }
+  }
+
+  if (threads <= 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+
+  profile_columns(profiles, nrows, threads);
+
+  std::vector<double> max_utf16(ncols), max_utf8(ncols), na_count(ncols), min(ncols), max(ncols);
+  std::vector<bool> integral(ncols);
+  std::vector<std::string> sql_type(ncols), narrow_type(ncols);
+
+  for (i = 0; i < ncols; i++) {
+    max_utf16[i] = profiles[i].max_utf16;
+    max_utf8[i] = profiles[i].max_utf8;
+    na_count[i] = profiles[i].na_count;
+    min[i] = profiles[i].min;
+    max[i] = profiles[i].max;
+    integral[i] = profiles[i].integral;
+    sql_type[i] = profiles[i].sql_type;
+    narrow_type[i] = profiles[i].narrow_type;
+  }
+
+  return Rcpp::List::create(Rcpp::Named("max_utf16") = max_utf16, Rcpp::Named("max_utf8") = max_utf8,
+      Rcpp::Named("na_count") = na_count, Rcpp::Named("min") = min, Rcpp::Named("max") = max,
+      Rcpp::Named("integral") = integral, Rcpp::Named("sql_type") = sql_type,
+      Rcpp::Named("narrow_type") = narrow_type);
+}
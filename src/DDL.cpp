@@ -33,3 +33,34 @@ void dbExecuteUpdate(const SEXP& handle, const std::string& executeSQL) {
 
   execute_update(dbc, executeSQL);
 }
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbExecuteBatchInternal")]]
+
+Rcpp::DataFrame dbExecuteBatchInternal(const SEXP& handle, const std::vector<std::string>& statements,
+    const bool& transaction, const bool& compound) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+  size_t i;
+
+  batch_results results = execute_batch(dbc, statements, transaction, compound);
+
+  size_t nstatements = statements.size();
+  Rcpp::IntegerVector index(nstatements);
+  Rcpp::NumericVector rows_affected(nstatements);
+  Rcpp::NumericVector seconds(nstatements);
+
+  for (i = 0; i < nstatements; i++) {
+    index[i] = i + 1;
+    rows_affected[i] = (results.rows_affected[i] < 0) ? NA_REAL : (double) results.rows_affected[i];
+    seconds[i] = (results.seconds[i] < 0) ? NA_REAL : results.seconds[i];
+  }
+
+  Rcpp::DataFrame df = Rcpp::DataFrame::create(Rcpp::Named("statement") = index,
+      Rcpp::Named("rows_affected") = rows_affected, Rcpp::Named("seconds") = seconds);
+  df.attr("compound") = results.compound;
+  df.attr("total_seconds") = results.total_seconds;
+
+  return df;
+}
@@ -0,0 +1,210 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+#include "dc.h"
+#include <Rversion.h>
+#include <cstring>
+
+// the ALTREP header of R 3.5 cannot be compiled as C++
+#if defined(R_VERSION) && R_VERSION >= R_Version(3, 6, 0)
+#define RDB2_HAVE_ALTREP
+extern "C" {
+#include <R_ext/Altrep.h>
+}
+#endif
+
+namespace rdb2 {
+
+static SEXP __make_element(const string_column_view& strings, R_xlen_t i) {
+  if (!((strings.valid[i / 8] >> (i % 8)) & 1)) {
+    return NA_STRING;
+  }
+  // same encoding as the strings of dataframes that are converted up front
+  const char* value = (strings.data != NULL) ? strings.data + strings.offsets[i] : "";
+  return Rf_mkCharLenCE(value, (int) (strings.offsets[i + 1] - strings.offsets[i]), CE_NATIVE);
+}
+
+static string_column_view __get_view(const std::shared_ptr<compact_strings>& strings) {
+  string_column_view view;
+  view.data = strings->data.data();
+  view.offsets = strings->offsets.data();
+  view.valid = strings->valid.data();
+  view.size = strings->size();
+  view.owner = strings;
+  return view;
+}
+
+#ifdef RDB2_HAVE_ALTREP
+
+/* A lazy string vector keeps the strings in an external pointer to a string_column_view (data1) until the
+ * whole vector is needed, eg. for DATAPTR or a modification. It is then converted into a plain character
+ * vector (data2) and the native copy is released. Single elements are converted as they are read.
+ * Serialization writes a plain character vector, so saved results do not depend on this package.
+ */
+
+static R_altrep_class_t lazy_strings_class;
+static bool lazy_strings_initialized = false;
+
+static void __free_view(SEXP ptr) {
+  string_column_view* strings = (string_column_view*) R_ExternalPtrAddr(ptr);
+  if (strings != NULL) {
+    delete strings;
+    R_ClearExternalPtr(ptr);
+  }
+}
+
+static const string_column_view* __get_view(SEXP x) {
+  return (const string_column_view*) R_ExternalPtrAddr(R_altrep_data1(x));
+}
+
+static SEXP __materialize(SEXP x) {
+  SEXP materialized = R_altrep_data2(x);
+  if (materialized != R_NilValue) {
+    return materialized;
+  }
+
+  const string_column_view* strings = __get_view(x);
+  R_xlen_t n = strings->size;
+  materialized = PROTECT(Rf_allocVector(STRSXP, n));
+  for (R_xlen_t i = 0; i < n; i++) {
+    SET_STRING_ELT(materialized, i, __make_element(*strings, i));
+  }
+  R_set_altrep_data2(x, materialized);
+  UNPROTECT(1);
+
+  __free_view(R_altrep_data1(x));
+  return materialized;
+}
+
+static R_xlen_t __lazy_length(SEXP x) {
+  SEXP materialized = R_altrep_data2(x);
+  return materialized != R_NilValue ? XLENGTH(materialized) : (R_xlen_t) __get_view(x)->size;
+}
+
+static Rboolean __lazy_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+  if (R_altrep_data2(x) != R_NilValue) {
+    Rprintf("rdb2 lazy strings (materialized)\n");
+  } else {
+    const string_column_view* strings = __get_view(x);
+    Rprintf("rdb2 lazy strings (%lu bytes of UTF-8)\n", (unsigned long) strings->offsets[strings->size]);
+  }
+  return TRUE;
+}
+
+static void* __lazy_dataptr(SEXP x, Rboolean writeable) {
+  return (void*) STRING_PTR_RO(__materialize(x));
+}
+
+static const void* __lazy_dataptr_or_null(SEXP x) {
+  SEXP materialized = R_altrep_data2(x);
+  return materialized != R_NilValue ? (const void*) STRING_PTR_RO(materialized) : NULL;
+}
+
+static SEXP __lazy_elt(SEXP x, R_xlen_t i) {
+  SEXP materialized = R_altrep_data2(x);
+  if (materialized != R_NilValue) {
+    return STRING_ELT(materialized, i);
+  }
+  return __make_element(*__get_view(x), i);
+}
+
+static void __lazy_set_elt(SEXP x, R_xlen_t i, SEXP value) {
+  SET_STRING_ELT(__materialize(x), i, value);
+}
+
+static int __lazy_no_na(SEXP x) {
+  SEXP materialized = R_altrep_data2(x);
+  if (materialized != R_NilValue) {
+    return 0;   // unknown once it can be modified
+  }
+  const string_column_view* strings = __get_view(x);
+  for (size_t i = 0; i < strings->size; i++) {
+    if (!((strings->valid[i / 8] >> (i % 8)) & 1)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void __init_lazy_strings() {
+  lazy_strings_class = R_make_altstring_class("rdb2_lazy_strings", "RDB2", NULL);
+
+  R_set_altrep_Length_method(lazy_strings_class, __lazy_length);
+  R_set_altrep_Inspect_method(lazy_strings_class, __lazy_inspect);
+  R_set_altvec_Dataptr_method(lazy_strings_class, __lazy_dataptr);
+  R_set_altvec_Dataptr_or_null_method(lazy_strings_class, __lazy_dataptr_or_null);
+  R_set_altstring_Elt_method(lazy_strings_class, __lazy_elt);
+  R_set_altstring_Set_elt_method(lazy_strings_class, __lazy_set_elt);
+  R_set_altstring_No_NA_method(lazy_strings_class, __lazy_no_na);
+
+  lazy_strings_initialized = true;
+}
+
+SEXP make_lazy_strings(const string_column_view& strings) {
+  if (!lazy_strings_initialized) {
+    __init_lazy_strings();
+  }
+
+  SEXP ptr = PROTECT(R_MakeExternalPtr(new string_column_view(strings), R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(ptr, __free_view, TRUE);
+  SEXP x = R_new_altrep(lazy_strings_class, ptr, R_NilValue);
+  UNPROTECT(1);
+
+  return x;
+}
+
+#else
+
+SEXP make_lazy_strings(const string_column_view& strings) {
+  R_xlen_t n = strings.size;
+  SEXP x = PROTECT(Rf_allocVector(STRSXP, n));
+  for (R_xlen_t i = 0; i < n; i++) {
+    SET_STRING_ELT(x, i, __make_element(strings, i));
+  }
+  UNPROTECT(1);
+
+  return x;
+}
+
+#endif
+
+SEXP make_lazy_strings(const std::shared_ptr<compact_strings>& strings) {
+  return make_lazy_strings(__get_view(strings));
+}
+
+SEXP make_raw_list(const string_column_view& values) {
+  // the bytes are copied into one raw vector per element, NULL for NA
+  R_xlen_t n = values.size;
+  SEXP x = PROTECT(Rf_allocVector(VECSXP, n));
+  for (R_xlen_t i = 0; i < n; i++) {
+    if (!((values.valid[i / 8] >> (i % 8)) & 1)) {
+      continue;
+    }
+    size_t length = values.offsets[i + 1] - values.offsets[i];
+    SEXP bytes = Rf_allocVector(RAWSXP, length);
+    if (length > 0) {
+      std::memcpy(RAW(bytes), values.data + values.offsets[i], length);
+    }
+    SET_VECTOR_ELT(x, i, bytes);
+  }
+  // so that the list stays a single column of the dataframe
+  Rf_setAttrib(x, R_ClassSymbol, Rf_mkString("AsIs"));
+  UNPROTECT(1);
+
+  return x;
+}
+
+SEXP make_raw_list(const std::shared_ptr<compact_strings>& values) {
+  return make_raw_list(__get_view(values));
+}
+
+} // namespace
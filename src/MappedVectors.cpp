@@ -0,0 +1,159 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+#include "dc.h"
+#include <Rversion.h>
+#include <cstring>
+
+// the ALTREP header of R 3.5 cannot be compiled as C++
+#if defined(R_VERSION) && R_VERSION >= R_Version(3, 6, 0)
+#define RDB2_HAVE_ALTREP
+extern "C" {
+#include <R_ext/Altrep.h>
+}
+#endif
+
+namespace rdb2 {
+
+static string_column_view __get_strings(const spilled_column& column) {
+  string_column_view view;
+  view.data = column.data;
+  view.offsets = column.offsets;
+  view.valid = column.valid;
+  view.size = column.rows;
+  view.owner = column.owner;
+  return view;
+}
+
+#ifdef RDB2_HAVE_ALTREP
+
+/* A mapped vector points into the copy on write mapping of the values file of a spilled column, kept in an
+ * external pointer (data1). R reads and even modifies the values in place; the file itself never changes.
+ * The null rows already hold NA_INTEGER or NA_REAL. Serialization writes a plain vector.
+ */
+
+static R_altrep_class_t mapped_integer_class;
+static R_altrep_class_t mapped_real_class;
+static bool mapped_vectors_initialized = false;
+
+static void __free_column(SEXP ptr) {
+  spilled_column* column = (spilled_column*) R_ExternalPtrAddr(ptr);
+  if (column != NULL) {
+    delete column;
+    R_ClearExternalPtr(ptr);
+  }
+}
+
+static spilled_column* __get_column(SEXP x) {
+  return (spilled_column*) R_ExternalPtrAddr(R_altrep_data1(x));
+}
+
+static R_xlen_t __mapped_length(SEXP x) {
+  return (R_xlen_t) __get_column(x)->rows;
+}
+
+static Rboolean __mapped_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+  Rprintf("rdb2 mapped vector (%lu rows)\n", __get_column(x)->rows);
+  return TRUE;
+}
+
+static void* __mapped_dataptr(SEXP x, Rboolean writeable) {
+  static double empty = 0;
+  // nothing is mapped for an empty file
+  void* values = (void*) __get_column(x)->values;
+  return values != NULL ? values : (void*) &empty;
+}
+
+static const void* __mapped_dataptr_or_null(SEXP x) {
+  return __mapped_dataptr(x, FALSE);
+}
+
+static int __mapped_integer_elt(SEXP x, R_xlen_t i) {
+  return ((const int*) __get_column(x)->values)[i];
+}
+
+static double __mapped_real_elt(SEXP x, R_xlen_t i) {
+  return ((const double*) __get_column(x)->values)[i];
+}
+
+static R_xlen_t __mapped_integer_region(SEXP x, R_xlen_t i, R_xlen_t n, int* buf) {
+  R_xlen_t rows = (R_xlen_t) __get_column(x)->rows;
+  R_xlen_t count = (i + n <= rows) ? n : rows - i;
+  std::memcpy(buf, (const int*) __get_column(x)->values + i, count * sizeof(int));
+  return count;
+}
+
+static R_xlen_t __mapped_real_region(SEXP x, R_xlen_t i, R_xlen_t n, double* buf) {
+  R_xlen_t rows = (R_xlen_t) __get_column(x)->rows;
+  R_xlen_t count = (i + n <= rows) ? n : rows - i;
+  std::memcpy(buf, (const double*) __get_column(x)->values + i, count * sizeof(double));
+  return count;
+}
+
+static void __init_mapped_vectors() {
+  mapped_integer_class = R_make_altinteger_class("rdb2_mapped_integer", "RDB2", NULL);
+  R_set_altrep_Length_method(mapped_integer_class, __mapped_length);
+  R_set_altrep_Inspect_method(mapped_integer_class, __mapped_inspect);
+  R_set_altvec_Dataptr_method(mapped_integer_class, __mapped_dataptr);
+  R_set_altvec_Dataptr_or_null_method(mapped_integer_class, __mapped_dataptr_or_null);
+  R_set_altinteger_Elt_method(mapped_integer_class, __mapped_integer_elt);
+  R_set_altinteger_Get_region_method(mapped_integer_class, __mapped_integer_region);
+
+  mapped_real_class = R_make_altreal_class("rdb2_mapped_real", "RDB2", NULL);
+  R_set_altrep_Length_method(mapped_real_class, __mapped_length);
+  R_set_altrep_Inspect_method(mapped_real_class, __mapped_inspect);
+  R_set_altvec_Dataptr_method(mapped_real_class, __mapped_dataptr);
+  R_set_altvec_Dataptr_or_null_method(mapped_real_class, __mapped_dataptr_or_null);
+  R_set_altreal_Elt_method(mapped_real_class, __mapped_real_elt);
+  R_set_altreal_Get_region_method(mapped_real_class, __mapped_real_region);
+
+  mapped_vectors_initialized = true;
+}
+
+SEXP make_mapped_vector(const spilled_column& column, bool binary) {
+  if (column.coltype == COLTYPE_STRING) {
+    return binary ? make_raw_list(__get_strings(column)) : make_lazy_strings(__get_strings(column));
+  }
+
+  if (!mapped_vectors_initialized) {
+    __init_mapped_vectors();
+  }
+
+  SEXP ptr = PROTECT(R_MakeExternalPtr(new spilled_column(column), R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(ptr, __free_column, TRUE);
+  SEXP x = R_new_altrep(column.coltype == COLTYPE_INTEGER ? mapped_integer_class : mapped_real_class, ptr, R_NilValue);
+  UNPROTECT(1);
+
+  return x;
+}
+
+#else
+
+SEXP make_mapped_vector(const spilled_column& column, bool binary) {
+  if (column.coltype == COLTYPE_STRING) {
+    return binary ? make_raw_list(__get_strings(column)) : make_lazy_strings(__get_strings(column));
+  }
+
+  bool integer = (column.coltype == COLTYPE_INTEGER);
+  SEXP x = PROTECT(Rf_allocVector(integer ? INTSXP : REALSXP, column.rows));
+  if (column.rows > 0) {
+    std::memcpy(integer ? (void*) INTEGER(x) : (void*) REAL(x), column.values,
+        column.rows * (integer ? sizeof(int) : sizeof(double)));
+  }
+  UNPROTECT(1);
+
+  return x;
+}
+
+#endif
+
+} // namespace
@@ -0,0 +1,85 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2016, 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+#include "dc.h"
+
+namespace rdb2 {
+
+typedef Rcpp::XPtr<std::shared_ptr<prepared_statement>> statement_xptr;
+
+static std::shared_ptr<prepared_statement> __get_statement(const SEXP& R_stmt) {
+  if (TYPEOF(R_stmt) != EXTPTRSXP || R_ExternalPtrAddr(R_stmt) == NULL) {
+    throw std::runtime_error("Statement was invalid");
+  }
+
+  statement_xptr ptr(R_stmt);
+  return *ptr;
+}
+
+} // namespace
+
+using namespace rdb2;
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbPrepareInternal")]]
+
+SEXP dbPrepareInternal(const SEXP& handle, const std::string& sql, unsigned int chunksize) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  // the statement comes from the connection's cache so preparing the same SQL again is cheap.
+  // The R object holds its own reference so an evicted statement stays usable
+  statement_xptr ptr(new std::shared_ptr<prepared_statement>(get_prepared_statement(dbc, sql, chunksize)), true);
+  ptr.attr("class") = "rdb2_statement";
+  ptr.attr("sql") = sql;
+
+  return ptr;
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbExecutePreparedInternal")]]
+
+SEXP dbExecutePreparedInternal(const SEXP& R_stmt, const Rcpp::DataFrame& params, const Rcpp::List& R_coltypes,
+    const std::vector<int>& varchar_col_lengths, bool stringsAsFactors, bool cache, const std::string& params_key) {
+
+  std::shared_ptr<prepared_statement> statement = __get_statement(R_stmt);
+
+  // only query results are cached, keyed by the parameter values as well as the SQL
+  cache = cache && statement->is_query();
+  cache_key key;
+  if (cache) {
+    key = get_cache_key(statement->get_dbc(), statement->get_sql(), params_key);
+    std::shared_ptr<cached_result> cached = load_cached_result(get_result_cache_options(), key);
+    if (cached) {
+      return __get_cached_DataFrame(*cached, stringsAsFactors, false);
+    }
+  }
+
+  std::vector<short> coltypes = init_col_vectors(params, R_coltypes);
+  std::vector<int> lengths = statement->fit_param_lengths(coltypes, varchar_col_lengths);
+  fill_function fill = get_dataframe_fill(params, coltypes, lengths);
+
+  SQLLEN rows_affected = 0;
+  read_results results = statement->execute(coltypes, lengths, params.nrows(), fill, rows_affected);
+
+  if (!statement->is_query()) {
+    return Rcpp::wrap((double) rows_affected);
+  }
+
+  if (cache) {
+    cache_results(key, results);
+  }
+
+  return __get_DataFrame(results, stringsAsFactors);
+}
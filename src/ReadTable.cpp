@@ -11,6 +11,8 @@
 
 */
 #include "dc.h"
+#include "rwedb2_arrow.h"
+#include <limits>
 
 namespace rdb2 {
 
@@ -34,6 +36,9 @@ static std::vector<vector_var_data> __convert_vectors(const struct read_results&
     vecs[i].type = results.stl_vecs[i].type;
     switch (results.stl_vecs[i].type) {
     case COLTYPE_STRING:
+      if (results.stl_vecs[i].compact_data) {
+        break;   // wrapped as it is by __get_DataFrame
+      }
       vecs[i].string_data = results.stl_vecs[i].string_data;
       for (unsigned int j = 0; j < nrows; j++) {
         if (results.null_indics[i][j])
@@ -96,19 +101,34 @@ static Rcpp::DataFrame __make_DataFrame(Rcpp::List& list, bool strings_as_factor
   return df;
 }
 
-static Rcpp::DataFrame __get_DataFrame(const read_results& results, bool strings_as_factors) {
+Rcpp::DataFrame __get_DataFrame(const read_results& results, bool strings_as_factors) {
   // retrieve data and convert into R dataframe
   size_t ncols = results.col_desc.size();
   size_t i;
   Rcpp::List list(ncols);
 
   std::vector < std::string > col_names = __get_col_names(results.col_desc);
-  std::vector<vector_var_data> vecs = __convert_vectors(results);
   list.attr("names") = col_names;
 
+  if (results.spilled) {
+    // the columns stay in their files and are mapped into R vectors
+    for (i = 0; i < ncols; i++) {
+      list[i] = make_mapped_vector(results.spilled->map_column(i), is_binary_lob(results.col_desc[i]));
+    }
+    return __make_DataFrame(list, strings_as_factors);
+  }
+
+  std::vector<vector_var_data> vecs = __convert_vectors(results);
+
   if (vecs.size() > 0) {
     for (i = 0; i < ncols; i++) {
-      if (vecs[i].type == COLTYPE_STRING) {
+      if (is_binary_lob(results.col_desc[i])) {
+        // always collected compact, see __fetch_bound. There is nothing to collect when there are no rows
+        std::shared_ptr<compact_strings> values = results.stl_vecs[i].compact_data;
+        list[i] = make_raw_list(values ? values : std::make_shared<compact_strings>());
+      } else if (vecs[i].type == COLTYPE_STRING && results.stl_vecs[i].compact_data) {
+        list[i] = make_lazy_strings(results.stl_vecs[i].compact_data);
+      } else if (vecs[i].type == COLTYPE_STRING) {
         list[i] = vecs[i].string_data;
       } else if (vecs[i].type == COLTYPE_NUMERIC) {
         list[i] = vecs[i].numeric_data;
@@ -120,6 +140,66 @@ static Rcpp::DataFrame __get_DataFrame(const read_results& results, bool strings
 
   return __make_DataFrame(list, strings_as_factors);
 }
+
+Rcpp::DataFrame __get_cached_DataFrame(const cached_result& cached, bool strings_as_factors, bool lazy_strings) {
+  // the columns are copied (or inflated) from the mapped file straight into the R vectors
+  size_t ncols = cached.get_col_desc().size();
+  R_xlen_t nrows = cached.rows();
+  size_t i;
+  R_xlen_t j;
+  Rcpp::List list(ncols);
+
+  list.attr("names") = __get_col_names(cached.get_col_desc());
+
+  for (i = 0; i < ncols; i++) {
+    if (cached.coltype(i) == COLTYPE_INTEGER) {
+      Rcpp::IntegerVector values(nrows);
+      cached.read_values(i, INTEGER(values));
+      list[i] = values;
+    } else if (cached.coltype(i) == COLTYPE_NUMERIC) {
+      Rcpp::NumericVector values(nrows);
+      cached.read_values(i, REAL(values));
+      list[i] = values;
+    } else if (cached.is_dictionary(i)) {
+      // one R string per distinct value
+      compact_strings dictionary;
+      std::vector<int32_t> codes;
+      cached.read_dictionary(i, dictionary, codes);
+
+      Rcpp::CharacterVector levels(dictionary.size());
+      for (j = 0; j < (R_xlen_t) dictionary.size(); j++) {
+        levels[j] = Rf_mkCharLenCE(dictionary.data.data() + dictionary.offsets[j],
+            (int) (dictionary.offsets[j + 1] - dictionary.offsets[j]), CE_NATIVE);
+      }
+      Rcpp::CharacterVector values(nrows);
+      for (j = 0; j < nrows; j++) {
+        SET_STRING_ELT(values, j, codes[j] < 0 ? NA_STRING : STRING_ELT(levels, codes[j]));
+      }
+      list[i] = values;
+    } else {
+      std::shared_ptr<compact_strings> strings = std::make_shared<compact_strings>();
+      cached.read_strings(i, *strings);
+      if (is_binary_lob(cached.get_col_desc()[i])) {
+        list[i] = make_raw_list(strings);
+      } else if (lazy_strings && !strings_as_factors) {
+        list[i] = make_lazy_strings(strings);
+      } else {
+        Rcpp::CharacterVector values(nrows);
+        for (j = 0; j < nrows; j++) {
+          if (!strings->is_na(j)) {
+            SET_STRING_ELT(values, j, Rf_mkCharLenCE(strings->data.data() + strings->offsets[j],
+                (int) (strings->offsets[j + 1] - strings->offsets[j]), CE_NATIVE));
+          } else {
+            SET_STRING_ELT(values, j, NA_STRING);
+          }
+        }
+        list[i] = values;
+      }
+    }
+  }
+
+  return __make_DataFrame(list, strings_as_factors);
+}
 }
 
 using namespace rdb2;
@@ -129,14 +209,126 @@ using namespace rdb2;
 // [[Rcpp::export(name=".dbExecuteQueryInternal")]]
 
 Rcpp::DataFrame dbExecuteQueryInternal(const SEXP& handle, const std::string& query, unsigned int chunksize,
-    bool stringsAsFactors) {
+    bool stringsAsFactors, bool lazy_strings, double spill_threshold, const std::string& spill_dir, bool cache) {
 
   SQLHDBC dbc = get_dbc_handle(handle);
 
+  cache_key key;
+  if (cache) {
+    key = get_cache_key(dbc, query, "");
+    std::shared_ptr<cached_result> cached = load_cached_result(get_result_cache_options(), key);
+    if (cached) {
+      return __get_cached_DataFrame(*cached, stringsAsFactors, lazy_strings);
+    }
+  }
+
   // push into STL vectors and then transfer into Rcpp vectors
   // as a two step process is OK because Rcpp explicitly recommends against
   // incremental push_back directly into Rcpp vectors (for performance reasons)
-  struct read_results results = execute_query(dbc, query, chunksize);
+  // factors need every string anyway
+  read_options options;
+  options.compact_strings = lazy_strings && !stringsAsFactors;
+  options.spill_dir = spill_dir;
+  options.null_integer = NA_INTEGER;
+  options.null_double = NA_REAL;
+  if (Rcpp::NumericVector::is_na(spill_threshold) || spill_threshold < 0) {
+    options.spill_threshold = default_spill_threshold();
+  } else if (spill_threshold < (double) std::numeric_limits<size_t>::max()) {
+    options.spill_threshold = (size_t) spill_threshold;
+  }
+
+  struct read_results results = execute_query(dbc, query, chunksize, options);
+
+  if (cache) {
+    cache_results(key, results);
+  }
+
+  return __get_DataFrame(results, stringsAsFactors);
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbReadTableByKeysInternal")]]
+
+Rcpp::DataFrame dbReadTableByKeysInternal(const SEXP& handle, const Rcpp::DataFrame& keys, const std::string& tbl_name,
+    const std::string& select_list, const std::string& key_col, const std::string& where_clause,
+    const Rcpp::List& R_coltypes, const std::vector<int>& varchar_col_lengths, unsigned int chunksize,
+    bool stringsAsFactors) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  std::vector<short> coltypes = init_col_vectors(keys, R_coltypes);
+  fill_function fill = get_dataframe_fill(keys, coltypes, varchar_col_lengths);
+
+  read_options options;
+  options.null_integer = NA_INTEGER;
+  options.null_double = NA_REAL;
+
+  struct read_results results = read_by_keys(dbc, tbl_name, select_list, key_col, where_clause, coltypes,
+      varchar_col_lengths, keys.nrows(), fill, chunksize, options);
 
   return __get_DataFrame(results, stringsAsFactors);
 }
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbExportQueryInternal")]]
+
+Rcpp::NumericVector dbExportQueryInternal(const SEXP& handle, const std::string& query, const std::string& path,
+    const std::string& sep, bool quote, const std::string& na, bool header, const std::string& compress,
+    unsigned int chunksize, bool verbose) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  export_options options;
+  options.chunksize = chunksize;
+  options.sep = sep;
+  options.quote = quote;
+  options.na = na;
+  options.header = header;
+  options.compress = (compress == "gzip") ? EXPORT_COMPRESS_GZIP : EXPORT_COMPRESS_NONE;
+
+  // rows go straight from the fetch buffers to the file so no R objects are created for them
+  export_stats stats = export_query(dbc, query, path, options);
+
+  if (verbose) {
+    Rcpp::Rcout << "Exported " << stats.rows << " rows (" << stats.bytes << " bytes before compression) to "
+        << path << " in " << stats.seconds << "s" << std::endl;
+  }
+
+  return Rcpp::NumericVector::create(Rcpp::Named("rows") = (double) stats.rows,
+      Rcpp::Named("bytes") = (double) stats.bytes, Rcpp::Named("seconds") = stats.seconds);
+}
+
+namespace rdb2 {
+
+static void __finalize_arrow_stream(struct ArrowArrayStream* stream) {
+  // consumers such as nanoarrow may have moved the stream out and left a released one behind
+  if (stream->release != NULL) {
+    stream->release(stream);
+  }
+  delete stream;
+}
+
+typedef Rcpp::XPtr<struct ArrowArrayStream, Rcpp::PreserveStorage, __finalize_arrow_stream, true> arrow_stream_xptr;
+
+} // namespace
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbExecuteQueryArrowInternal")]]
+
+SEXP dbExecuteQueryArrowInternal(const SEXP& handle, const std::string& query, unsigned int chunksize) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  std::unique_ptr<struct ArrowArrayStream> stream(new struct ArrowArrayStream());
+  stream->release = NULL;
+  execute_query_stream(dbc, query, chunksize, stream.get());
+
+  // an external pointer to an ArrowArrayStream with this class is what nanoarrow and arrow expect
+  arrow_stream_xptr ptr(stream.release(), true);
+  ptr.attr("class") = "nanoarrow_array_stream";
+
+  return ptr;
+}
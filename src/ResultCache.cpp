@@ -0,0 +1,103 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+#include "dc.h"
+
+namespace rdb2 {
+
+static cache_options result_cache;
+
+cache_options get_result_cache_options() {
+  if (result_cache.dir.empty()) {
+    Rcpp::Function tempdir("tempdir");
+    result_cache.dir = Rcpp::as<std::string>(tempdir()) + "/rdb2_cache";
+  }
+  return result_cache;
+}
+
+cache_key get_cache_key(const SQLHDBC& dbc, const std::string& sql, const std::string& params) {
+  std::shared_ptr<connection_state> state = get_connection_state(dbc);
+  std::lock_guard<std::mutex> lock(state->mutex);
+
+  cache_key key;
+  key.conn_string = state->conn_string;
+  key.sql = sql;
+  key.params = params;
+  return key;
+}
+
+void cache_results(const cache_key& key, const read_results& results) {
+  // a result that cannot be cached is still returned
+  if (results.spilled) {
+    return;
+  }
+
+  read_options nulls;
+  nulls.null_integer = NA_INTEGER;
+  nulls.null_double = NA_REAL;
+  try {
+    store_cached_result(get_result_cache_options(), key, results, nulls);
+  } catch (const std::runtime_error& e) {
+    Rcpp::warning("Result was not cached: %s", e.what());
+  }
+}
+
+} // namespace
+
+using namespace rdb2;
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbSetCacheOptionsInternal")]]
+
+void dbSetCacheOptionsInternal(const std::string& dir, double ttl, double max_size, bool dictionary, int compression) {
+
+  result_cache.dir = dir;
+  result_cache.ttl = ttl;
+  result_cache.max_bytes = (max_size > 0 && max_size < 1.8e19) ? (uint64_t) max_size : 0;
+  result_cache.dictionary = dictionary;
+  result_cache.compression = compression;
+}
+
+//' Get statistics of the query result cache
+//'
+//' Hits, misses, stores and evictions are counted since the package was loaded. The number and total size
+//' of the files are those currently in the cache directory
+//'
+//' @return named numeric vector with the hits, misses, stores, evictions, files and bytes of the cache
+//'
+//' @export
+// [[Rcpp::export]]
+Rcpp::NumericVector dbCacheStats() {
+
+  cache_stats stats = get_cache_stats(get_result_cache_options());
+
+  Rcpp::NumericVector R_stats = Rcpp::NumericVector::create(stats.hits, stats.misses, stats.stores, stats.evictions,
+      stats.files, (double) stats.bytes);
+  R_stats.attr("names") = Rcpp::CharacterVector::create("hits", "misses", "stores", "evictions", "files", "bytes");
+
+  return R_stats;
+}
+
+//' Remove results from the query result cache
+//'
+//' @param pattern regular expression (ECMAScript syntax) matched against the SQL text of the cached results.
+//' The default removes every cached result
+//'
+//' @return number of cached results removed
+//'
+//' @export
+// [[Rcpp::export]]
+double dbCacheInvalidate(const std::string& pattern = "") {
+
+  return invalidate_cached_results(get_result_cache_options(), pattern);
+}
@@ -11,6 +11,12 @@
 
 */
 #include "dc.h"
+#include "rwedb2_arrow.h"
+#include "rwedb2_sync.h"
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 namespace rdb2 {
 
@@ -34,7 +40,7 @@ static std::string get_insert_SQL(std::string const& tbl_name, std::vector<std::
   return oss.str();
 }
 
-static std::vector<short> init_col_vectors(const Rcpp::DataFrame& df, const Rcpp::List& R_coltypes) {
+std::vector<short> init_col_vectors(const Rcpp::DataFrame& df, const Rcpp::List& R_coltypes) {
   // returns coltypes array containing the column type for each column
 
   unsigned int i;
@@ -57,85 +63,149 @@ static std::vector<short> init_col_vectors(const Rcpp::DataFrame& df, const Rcpp
 }
 
 
-static indic_arrays alloc_indic_mem(const unsigned long nrows, const size_t& ncols) {
-  // allocate memory for null indicators
+struct column_source {
+  // raw pointers to the data in a dataframe column. These are collected on the main thread
+  // so that the column can be encoded on a worker thread without touching the R API
+  const SEXP* strings;
+  const int* integers;
+  const double* doubles;
+};
 
-  indic_arrays null_indicator(ncols);
+static std::vector<column_source> get_column_sources(const Rcpp::DataFrame& df, const std::vector<short>& coltypes) {
   size_t i;
+  size_t ncols = coltypes.size();
+  std::vector<column_source> columns(ncols);
 
   for (i = 0; i < ncols; i++) {
-    std::unique_ptr<INDIC_TYPE[]> ptr(new INDIC_TYPE[nrows]);
-    null_indicator[i] = std::move(ptr);
+    SEXP col = df[i];
+    columns[i].strings = (coltypes[i] == COLTYPE_STRING) ? STRING_PTR_RO(col) : NULL;
+    columns[i].integers = (coltypes[i] == COLTYPE_INTEGER) ? INTEGER(col) : NULL;
+    columns[i].doubles = (coltypes[i] == COLTYPE_NUMERIC) ? REAL(col) : NULL;
   }
 
-  return null_indicator;
+  return columns;
 }
 
-static data_arrays alloc_mem(std::vector<short> coltypes, const std::vector<int>& varchar_col_lengths,
-    indic_arrays& null_indicator, const unsigned long nrows, const size_t& ncols) {
+static int get_on_error_mode(const std::string& on_error) {
+  if (on_error == "abort") {
+    return WRITE_ON_ERROR_ABORT;
+  } else if (on_error == "skip") {
+    return WRITE_ON_ERROR_SKIP;
+  } else if (on_error == "collect") {
+    return WRITE_ON_ERROR_COLLECT;
+  }
+  throw std::runtime_error("Unknown on_error mode: " + on_error);
+}
 
-  // allocate memory for data - the ODBC driver requires that data be stored in contiguous memory
-  // and unfortunately, this means we have to copy it over from the Rcpp::DataFrame that we received
-  // specifically for strings, ODBC driver requires that all strings be stored as constant width
-  // so we need to allocate a contiguous 2-D array of strings where every string occupies as much memory
-  // as the longest string in that column!
+static SQLINTEGER get_load_mode(const std::string& load_mode) {
+  if (load_mode == "insert") {
+    return SQL_USE_LOAD_INSERT;
+  } else if (load_mode == "replace") {
+    return SQL_USE_LOAD_REPLACE;
+  }
+  throw std::runtime_error("Unknown load mode: " + load_mode);
+}
 
+static Rcpp::DataFrame get_rejected_rows(const std::vector<row_error>& rejected, const bool collected) {
+  // converts the rejected rows to a dataframe with 1-based row numbers. The diagnostics are NA
+  // unless they were collected
   size_t i;
-  data_arrays data(ncols);
+  size_t nrejected = rejected.size();
+  std::vector<double> rows(nrejected);
+  Rcpp::CharacterVector sqlstate(nrejected);
+  Rcpp::IntegerVector native_error(nrejected);
+  Rcpp::CharacterVector message(nrejected);
 
-  for (i = 0; i < ncols; i++) {
-    if (coltypes[i] == COLTYPE_STRING) {
-      SQLWCHAR* char_data = new SQLWCHAR[nrows * (varchar_col_lengths[i] + 1)];
-      std::shared_ptr<SQLWCHAR> ptr(char_data, std::default_delete<SQLWCHAR[]>());
-      colData cd(ptr);
-      data[i] = std::move(cd);
-    } else if (coltypes[i] == COLTYPE_INTEGER) {
-      std::shared_ptr < SQLBIGINT > ptr(new SQLBIGINT[nrows], std::default_delete<SQLBIGINT[]>());
-      colData cd(ptr);
-      data[i] = std::move(cd);
-    } else if (coltypes[i] == COLTYPE_NUMERIC) {
-      std::shared_ptr < SQLDOUBLE > ptr(new SQLDOUBLE[nrows], std::default_delete<SQLDOUBLE[]>());
-      colData cd(ptr);
-      data[i] = std::move(cd);
+  for (i = 0; i < nrejected; i++) {
+    rows[i] = rejected[i].row + 1;
+    if (!collected || rejected[i].sqlstate.empty()) {
+      sqlstate[i] = NA_STRING;
+      native_error[i] = NA_INTEGER;
+      message[i] = NA_STRING;
+    } else {
+      sqlstate[i] = rejected[i].sqlstate;
+      native_error[i] = rejected[i].native_error;
+      message[i] = rejected[i].message;
     }
   }
 
-  return data;
+  return Rcpp::DataFrame::create(Rcpp::Named("row") = rows, Rcpp::Named("sqlstate") = sqlstate,
+      Rcpp::Named("native_error") = native_error, Rcpp::Named("message") = message,
+      Rcpp::Named("stringsAsFactors") = false);
+}
+
+static void copy_string_col(const SEXP* strings, SQLWCHAR* const dest, INDIC_TYPE* const indic, const int max_length,
+    const unsigned long first_row, const unsigned long nrows, utf16_string_cache& cache) {
+  // encodes a character column as fixed width UTF-16 strings. We read CHAR() directly instead of
+  // going through std::string and since R interns its strings, repeated values share the same CHARSXP
+  // so we only transcode each distinct value once and memcpy the cached encoding after that.
+
+  const size_t field_width = max_length + 1;
+  std::vector<SQLWCHAR> scratch;
+
+  for (unsigned long j = 0; j < nrows; j++) {
+    SQLWCHAR* field = dest + j * field_width;
+    SEXP str = strings[first_row + j];
+
+    if (str == NA_STRING) {
+      indic[j] = SQL_NULL_DATA;
+      *field = 0;
+      continue;
+    }
+
+    indic[j] = SQL_NTS;
+
+    const std::vector<SQLWCHAR>* encoded = cache.find(str);
+    if (encoded == NULL) {
+      encoded = cache.insert(str, CHAR(str), LENGTH(str));
+    }
+
+    size_t len;
+    if (encoded != NULL) {
+      len = encoded->size();
+      if (len > (size_t) max_length) {
+        throw std::runtime_error("String in row " + std::to_string(first_row + j + 1) + " is longer than "
+            + std::to_string(max_length) + " UTF-16 code units");
+      }
+      std::memcpy(field, encoded->data(), len * sizeof(SQLWCHAR));
+      field[len] = 0;
+    } else if ((size_t) LENGTH(str) <= (size_t) max_length) {
+      // UTF-16 never needs more code units than UTF-8 needs bytes so this fits in the field
+      encodeUTF8StringAsUTF16(field, CHAR(str), LENGTH(str));
+    } else {
+      scratch.resize(LENGTH(str) + 1);
+      len = encodeUTF8StringAsUTF16(scratch.data(), CHAR(str), LENGTH(str));
+      if (len > (size_t) max_length) {
+        throw std::runtime_error("String in row " + std::to_string(first_row + j + 1) + " is longer than "
+            + std::to_string(max_length) + " UTF-16 code units");
+      }
+      std::memcpy(field, scratch.data(), (len + 1) * sizeof(SQLWCHAR));
+    }
+  }
 }
 
-static void copy_data(const Rcpp::DataFrame& df, data_arrays& data, indic_arrays& null_indicator,
-    const std::vector<int>& varchar_col_lengths, const std::vector<short>& coltypes, const unsigned long nrows,
-    const size_t ncols) {
-  // Now update the parameter values and write the rows
-  // note that assigning dataframe column to an Rcpp::CharacterVector, NumericVector etc.
-  // does not make a copy of the column per
-  // http://lists.r-forge.r-project.org/pipermail/rcpp-devel/2013-February/005332.html
-  // However, we do manually copy the data because ODBC SQLBindParameter needs the data to
+static void copy_data(const std::vector<column_source>& columns, data_arrays& data, indic_arrays& null_indicator,
+    const std::vector<int>& varchar_col_lengths, const std::vector<short>& coltypes,
+    std::vector<utf16_string_cache>& caches, const unsigned long first_row, const unsigned long nrows) {
+  // Copies rows [first_row, first_row + nrows) of the dataframe into the parameter buffers.
+  // We have to copy the data because ODBC SQLBindParameter needs the data to
   // be stored contiguously in memory. The conversion to UTF-16 executes a copy internally anyway so
   // this copy ends up being unavoidable for strings for more than one reason. We provide the contiguous memory
   // location to the UTF-16 conversion function so we only copy once, not twice.
+  // This may run on a worker thread so it only uses the raw pointers in columns
 
   size_t i;
+  unsigned long j;
+  size_t ncols = coltypes.size();
 
   for (i = 0; i < ncols; i++) {
-    Rcpp::checkUserInterrupt();   // allow user interrupts
-
     if (coltypes[i] == COLTYPE_STRING) {
-      Rcpp::CharacterVector cv = df[i];
-      for (unsigned int j = 0; j < nrows; j++) {
-        if (Rcpp::CharacterVector::is_na(cv[j])) {
-          null_indicator[i][j] = SQL_NULL_DATA;
-          encodeUTF8StringAsUTF16((SQLWCHAR*) (data[i].get()) + j * (varchar_col_lengths[i] + 1), "");
-        } else {
-          std::string char_data = Rcpp::as<std::string>(cv[j]);
-          encodeUTF8StringAsUTF16((SQLWCHAR*) (data[i].get()) + j * (varchar_col_lengths[i] + 1), char_data);
-          null_indicator[i][j] = SQL_NTS;
-        }
-      }
+      copy_string_col(columns[i].strings, (SQLWCHAR*) (data[i].get()), null_indicator[i].get(), varchar_col_lengths[i],
+          first_row, nrows, caches[i]);
     } else if (coltypes[i] == COLTYPE_INTEGER) {
-      Rcpp::IntegerVector iv = df[i];
-      for (unsigned int j = 0; j < nrows; j++) {
-        if (Rcpp::IntegerVector::is_na(iv[j])) {
+      const int* iv = columns[i].integers + first_row;
+      for (j = 0; j < nrows; j++) {
+        if (iv[j] == NA_INTEGER) {
           null_indicator[i][j] = SQL_NULL_DATA;
         } else {
           *((SQLBIGINT*) (data[i].get()) + j) = (SQLBIGINT)(iv[j]);
@@ -143,9 +213,9 @@ static void copy_data(const Rcpp::DataFrame& df, data_arrays& data, indic_arrays
         }
       }
     } else if (coltypes[i] == COLTYPE_NUMERIC) {
-      Rcpp::NumericVector nv = df[i];
-      for (unsigned int j = 0; j < nrows; j++) {
-        if (Rcpp::NumericVector::is_na(nv[j])) {
+      const double* nv = columns[i].doubles + first_row;
+      for (j = 0; j < nrows; j++) {
+        if (ISNAN(nv[j])) {
           null_indicator[i][j] = SQL_NULL_DATA;
         } else {
           *((SQLDOUBLE*) (data[i].get()) + j) = (SQLDOUBLE)(nv[j]);
@@ -156,6 +226,20 @@ static void copy_data(const Rcpp::DataFrame& df, data_arrays& data, indic_arrays
   }
 }
 
+fill_function get_dataframe_fill(const Rcpp::DataFrame& df, const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths) {
+  // returns a fill function that encodes rows of df with varchar_col_lengths. The caller must keep df
+  // alive for as long as the fill function is used
+  std::shared_ptr<std::vector<column_source>> columns =
+      std::make_shared<std::vector<column_source>>(get_column_sources(df, coltypes));
+  std::shared_ptr<std::vector<utf16_string_cache>> caches =
+      std::make_shared<std::vector<utf16_string_cache>>(coltypes.size());
+
+  return [=](data_arrays& data, indic_arrays& null_indicator, unsigned long first_row, unsigned long count) {
+    copy_data(*columns, data, null_indicator, varchar_col_lengths, coltypes, *caches, first_row, count);
+  };
+}
+
 } // namespace
 
 using namespace rdb2;
@@ -164,9 +248,11 @@ using namespace rdb2;
 //' @export
 // [[Rcpp::export(name=".dbWriteTableInternal")]]
 
-void dbWriteTableInternal(const SEXP& handle, const Rcpp::DataFrame& df, const std::string& tbl_name,
+Rcpp::DataFrame dbWriteTableInternal(const SEXP& handle, const Rcpp::DataFrame& df, const std::string& tbl_name,
     const std::vector<std::string>& col_names, const Rcpp::List& R_coltypes,
-    const std::vector<int>& varchar_col_lengths, const bool& verbose) {
+    const std::vector<int>& varchar_col_lengths, unsigned long chunk_size, const bool& pipelined,
+    const std::string& on_error, unsigned long commit_every, const bool& not_logged, const std::string& method,
+    const std::string& load_mode, unsigned long load_warning_limit, const bool& load_messages, const bool& verbose) {
 
   SQLHDBC dbc = get_dbc_handle(handle);
 
@@ -180,13 +266,811 @@ void dbWriteTableInternal(const SEXP& handle, const Rcpp::DataFrame& df, const s
   if (verbose)
     Rcpp::Rcout << insert_SQL << std::endl;
 
-  indic_arrays null_indicator = alloc_indic_mem(nrows, ncols);
+  // the dataframe is encoded chunk by chunk straight into the parameter buffers. Each column keeps its own
+  // string cache across chunks. Only one chunk is encoded at a time so the caches are never shared between threads
+  std::vector<column_source> columns = get_column_sources(df, coltypes);
+  std::vector<utf16_string_cache> caches(ncols);
+
+  fill_function fill = [&](data_arrays& data, indic_arrays& null_indicator, unsigned long first_row,
+      unsigned long count) {
+    copy_data(columns, data, null_indicator, varchar_col_lengths, coltypes, caches, first_row, count);
+  };
+
+  write_options options;
+  options.chunksize = chunk_size;
+  options.pipelined = pipelined;
+  options.on_error = get_on_error_mode(on_error);
+  options.commit_every = commit_every;
+  options.not_logged = not_logged;
+  options.method = (method == "load") ? WRITE_METHOD_LOAD : WRITE_METHOD_INSERT;
+  options.load_mode = get_load_mode(load_mode);
+  options.load_warning_limit = load_warning_limit;
+  options.load_messages = load_messages;
+
+#ifndef RDB2_HAVE_DB2API
+  // the warning limit can only be passed to the load utility through the DB2 API structures
+  if (options.method == WRITE_METHOD_LOAD && load_warning_limit > 0) {
+    Rcpp::warning("load_warning_limit is ignored since RDB2 was built without RDB2_HAVE_DB2API");
+  }
+#endif
+
+  write_stats stats = write_table_chunked(dbc, tbl_name, insert_SQL, coltypes, varchar_col_lengths, nrows, fill,
+      options);
+
+  // logging was only avoided if NOT LOGGED INITIALLY was active in every transaction
+  bool logging_avoided = not_logged && stats.transactions > 0
+      && stats.not_logged_transactions == stats.transactions;
+
+  if (verbose) {
+    if (options.method == WRITE_METHOD_LOAD) {
+      if (stats.load_used) {
+        Rcpp::Rcout << "LOAD read " << stats.load_rows_read << " rows, loaded " << stats.load_rows_loaded
+            << ", rejected " << stats.load_rows_rejected << ", skipped " << stats.load_rows_skipped << std::endl;
+      } else {
+        Rcpp::Rcout << "The driver does not support LOAD for this table. Used INSERT instead" << std::endl;
+      }
+    }
+    Rcpp::Rcout << "Wrote " << stats.rows << " rows in " << stats.chunks << " chunks and "
+        << stats.transactions << " transactions. " << (pipelined ? "Waited " : "Spent ")
+        << stats.fill_seconds << "s encoding and " << stats.execute_seconds << "s executing" << std::endl;
+    if (not_logged) {
+      Rcpp::Rcout << "NOT LOGGED INITIALLY was active in " << stats.not_logged_transactions << " of "
+          << stats.transactions << " transactions" << std::endl;
+    }
+    if (options.on_error != WRITE_ON_ERROR_ABORT) {
+      Rcpp::Rcout << stats.rejected.size() << " rows were rejected" << std::endl;
+    }
+  }
+
+  Rcpp::DataFrame rejected = get_rejected_rows(stats.rejected, options.on_error == WRITE_ON_ERROR_COLLECT);
+  rejected.attr("rows_written") = (double) stats.rows;
+  rejected.attr("commits") = (double) stats.commits;
+  rejected.attr("method") = std::string(stats.load_used ? "load" : "insert");
+  if (stats.load_used) {
+    rejected.attr("load_rows_rejected") = (double) stats.load_rows_rejected;
+  }
+  if (load_messages) {
+    rejected.attr("load_messages") = stats.load_messages;
+  }
+  if (not_logged) {
+    rejected.attr("logging_avoided") = logging_avoided;
+  } else {
+    rejected.attr("logging_avoided") = Rcpp::LogicalVector::create(NA_LOGICAL);
+  }
+  return rejected;
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbTraceLoadAttributesInternal")]]
+
+Rcpp::List dbTraceLoadAttributesInternal(const std::string& load_mode, const bool& load_messages,
+    int failing_attribute) {
+  // the statement attributes that method = "load" sets, recorded without a driver so that the sequence
+  // and the fallback to INSERT can be tested anywhere
+  write_options options;
+  options.method = WRITE_METHOD_LOAD;
+  options.load_mode = get_load_mode(load_mode);
+  options.load_messages = load_messages;
+
+  std::vector<std::pair<SQLINTEGER, SQLLEN>> calls;
+  bool load_used = trace_load_attributes(options, failing_attribute, calls);
+
+  Rcpp::IntegerVector attributes(calls.size());
+  Rcpp::NumericVector values(calls.size());
+  for (size_t i = 0; i < calls.size(); i++) {
+    attributes[i] = calls[i].first;
+    values[i] = (double) calls[i].second;
+  }
+
+  return Rcpp::List::create(Rcpp::Named("attributes") = attributes, Rcpp::Named("values") = values,
+      Rcpp::Named("load_used") = load_used);
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbWriteLobsInternal")]]
+
+Rcpp::DataFrame dbWriteLobsInternal(const SEXP& handle, const Rcpp::DataFrame& df, const std::string& tbl_name,
+    const std::vector<std::string>& col_names, unsigned long chunk_size, unsigned long commit_every,
+    const bool& verbose) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  size_t ncols = df.size();
+  unsigned long nrows = df.nrows();
+  size_t i;
+
+  // list columns hold the raw vectors of binary LOBs
+  std::vector<short> coltypes(ncols);
+  std::vector<SEXP> columns(ncols);
+  for (i = 0; i < ncols; i++) {
+    columns[i] = df[i];
+    switch (TYPEOF(columns[i])) {
+    case STRSXP:
+      coltypes[i] = COLTYPE_STRING;
+      break;
+    case INTSXP:
+      coltypes[i] = COLTYPE_INTEGER;
+      break;
+    case REALSXP:
+      coltypes[i] = COLTYPE_NUMERIC;
+      break;
+    case VECSXP:
+      coltypes[i] = COLTYPE_BINARY;
+      break;
+    default:
+      throw std::runtime_error("Unknown column type of column " + col_names[i]);
+    }
+  }
+
+  std::string insert_SQL = get_insert_SQL(tbl_name, col_names);
+
+  if (verbose)
+    Rcpp::Rcout << insert_SQL << std::endl;
+
+  // the values point straight into the R vectors, rows are written on this thread
+  lob_row_function get_row = [&](unsigned long row, std::vector<lob_param>& values) {
+    for (size_t k = 0; k < ncols; k++) {
+      lob_param& value = values[k];
+      value.is_null = false;
+      switch (coltypes[k]) {
+      case COLTYPE_STRING: {
+        SEXP str = STRING_ELT(columns[k], row);
+        value.is_null = (str == NA_STRING);
+        value.data = CHAR(str);
+        value.length = LENGTH(str);
+        break;
+      }
+      case COLTYPE_INTEGER:
+        value.is_null = (INTEGER(columns[k])[row] == NA_INTEGER);
+        value.integer = INTEGER(columns[k])[row];
+        break;
+      case COLTYPE_NUMERIC:
+        value.is_null = ISNAN(REAL(columns[k])[row]);
+        value.number = REAL(columns[k])[row];
+        break;
+      default: {
+        SEXP bytes = VECTOR_ELT(columns[k], row);
+        if (bytes == R_NilValue) {
+          value.is_null = true;
+        } else if (TYPEOF(bytes) != RAWSXP) {
+          throw std::runtime_error("Element " + std::to_string(row + 1) + " of column " + col_names[k]
+              + " is not a raw vector");
+        } else {
+          value.data = (const char*) RAW(bytes);
+          value.length = XLENGTH(bytes);
+        }
+        break;
+      }
+      }
+    }
+  };
+
+  write_options options;
+  options.chunksize = chunk_size;
+  options.commit_every = commit_every;
+
+  write_stats stats = write_lob_rows(dbc, tbl_name, insert_SQL, coltypes, nrows, get_row, options);
+
+  if (verbose) {
+    Rcpp::Rcout << "Wrote " << stats.rows << " rows with LOB values one at a time in " << stats.transactions
+        << " transactions. Spent " << stats.execute_seconds << "s executing" << std::endl;
+  }
+
+  Rcpp::DataFrame rejected = get_rejected_rows(stats.rejected, false);
+  rejected.attr("rows_written") = (double) stats.rows;
+  rejected.attr("commits") = (double) stats.commits;
+  rejected.attr("method") = std::string("insert");
+  rejected.attr("logging_avoided") = Rcpp::LogicalVector::create(NA_LOGICAL);
+  return rejected;
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbExecuteParamsInternal")]]
+
+Rcpp::NumericVector dbExecuteParamsInternal(const SEXP& handle, const std::string& sql, const Rcpp::DataFrame& df,
+    const Rcpp::List& R_coltypes, const std::vector<int>& varchar_col_lengths, unsigned long chunk_size,
+    const bool& verbose) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  size_t ncols = df.size();
+  unsigned long nrows = df.nrows();
+  unsigned long j;
+
+  if (verbose)
+    Rcpp::Rcout << sql << std::endl;
+
+  std::vector<short> coltypes = init_col_vectors(df, R_coltypes);
+  std::vector<column_source> columns = get_column_sources(df, coltypes);
+  std::vector<utf16_string_cache> caches(ncols);
+
+  fill_function fill = [&](data_arrays& data, indic_arrays& null_indicator, unsigned long first_row,
+      unsigned long count) {
+    copy_data(columns, data, null_indicator, varchar_col_lengths, coltypes, caches, first_row, count);
+  };
+
+  // every chunk runs in one transaction, so a failing chunk also undoes the chunks before it
+  write_options options;
+  options.chunksize = chunk_size;
+  options.commit_every = 0;
+
+  params_stats stats = execute_params(dbc, sql, coltypes, varchar_col_lengths, nrows, fill, options);
+
+  if (verbose) {
+    Rcpp::Rcout << "Executed " << stats.rows << " parameter rows in " << stats.chunks << " chunks. "
+        << stats.total << " rows affected" << std::endl;
+  }
+
+  // the per row counts are NA if the driver only reports a total for each array
+  Rcpp::NumericVector row_counts(nrows);
+  for (j = 0; j < nrows; j++) {
+    row_counts[j] = stats.per_row ? (double) stats.row_counts[j] : NA_REAL;
+  }
+  row_counts.attr("total") = (double) stats.total;
+
+  return row_counts;
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbUpsertTableInternal")]]
+
+Rcpp::NumericVector dbUpsertTableInternal(const SEXP& handle, const Rcpp::DataFrame& df, const std::string& tbl_name,
+    const std::vector<std::string>& col_names, const std::vector<std::string>& key_cols, const Rcpp::List& R_coltypes,
+    const std::vector<int>& varchar_col_lengths, unsigned long chunk_size, const bool& verbose) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  size_t ncols = df.size();
+  unsigned long nrows = df.nrows();
+
+  std::vector<short> coltypes = init_col_vectors(df, R_coltypes);
+  std::vector<column_source> columns = get_column_sources(df, coltypes);
+  std::vector<utf16_string_cache> caches(ncols);
+
+  fill_function fill = [&](data_arrays& data, indic_arrays& null_indicator, unsigned long first_row,
+      unsigned long count) {
+    copy_data(columns, data, null_indicator, varchar_col_lengths, coltypes, caches, first_row, count);
+  };
+
+  write_options options;
+  options.chunksize = chunk_size;
+
+  upsert_stats stats = upsert_table(dbc, tbl_name, col_names, key_cols, coltypes, varchar_col_lengths, nrows, fill,
+      options);
+
+  if (verbose) {
+    Rcpp::Rcout << "Staged " << stats.staged.rows << " rows in " << stats.staged.chunks << " chunks. Inserted "
+        << stats.inserted << " and updated " << stats.updated << " rows of " << tbl_name << std::endl;
+  }
+
+  return Rcpp::NumericVector::create(Rcpp::Named("inserted") = (double) stats.inserted,
+      Rcpp::Named("updated") = (double) stats.updated);
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbSyncPlanInternal")]]
+
+Rcpp::List dbSyncPlanInternal(const SEXP& handle, const Rcpp::DataFrame& df, const std::string& tbl_name,
+    const std::vector<std::string>& col_names, const std::vector<std::string>& key_cols, const Rcpp::List& R_coltypes,
+    unsigned int chunk_size) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  unsigned long nrows = df.nrows();
+  size_t i;
+  unsigned long j;
+
+  std::vector<short> coltypes = init_col_vectors(df, R_coltypes);
+  std::vector<size_t> key_index;
+  std::vector<size_t> value_index;
+  std::vector<std::string> value_names;
+  for (i = 0; i < key_cols.size(); i++) {
+    size_t found = std::find(col_names.begin(), col_names.end(), key_cols[i]) - col_names.begin();
+    if (found == col_names.size()) {
+      throw std::runtime_error("Key column " + key_cols[i] + " is not one of the columns");
+    }
+    key_index.push_back(found);
+  }
+  for (i = 0; i < col_names.size(); i++) {
+    if (std::find(key_cols.begin(), key_cols.end(), col_names[i]) == key_cols.end()) {
+      value_index.push_back(i);
+      value_names.push_back(col_names[i]);
+    }
+  }
+
+  std::vector<sync_column> key_columns = describe_sync_columns(dbc, tbl_name, key_cols);
+  std::vector<sync_column> value_columns;
+  if (!value_names.empty()) {
+    value_columns = describe_sync_columns(dbc, tbl_name, value_names);
+  }
+
+  // the key and hash of each row of df, in the same form as those read from the table
+  std::vector<std::string> keys(nrows);
+  std::vector<uint64_t> hashes(nrows);
+  row_hasher hasher(value_columns);
+
+  for (j = 0; j < nrows; j++) {
+    for (i = 0; i < key_index.size(); i++) {
+      SEXP column = df[key_index[i]];
+      if (i > 0) {
+        keys[j] += SYNC_KEY_SEPARATOR;
+      }
+      if (coltypes[key_index[i]] == COLTYPE_STRING && STRING_ELT(column, j) != NA_STRING) {
+        const char* value = Rf_translateCharUTF8(STRING_ELT(column, j));
+        keys[j] += sync_key_text(key_columns[i], value, strlen(value));
+      } else if (coltypes[key_index[i]] == COLTYPE_INTEGER && INTEGER(column)[j] != NA_INTEGER) {
+        keys[j] += sync_key_text(key_columns[i], (int64_t) INTEGER(column)[j]);
+      } else if (coltypes[key_index[i]] == COLTYPE_NUMERIC && !ISNAN(REAL(column)[j])) {
+        keys[j] += sync_key_text(key_columns[i], REAL(column)[j]);
+      } else {
+        throw std::runtime_error("Key column " + key_cols[i] + " is NA in row " + std::to_string(j + 1));
+      }
+    }
+
+    hasher.begin();
+    for (i = 0; i < value_index.size(); i++) {
+      SEXP column = df[value_index[i]];
+      if (coltypes[value_index[i]] == COLTYPE_STRING && STRING_ELT(column, j) != NA_STRING) {
+        const char* value = Rf_translateCharUTF8(STRING_ELT(column, j));
+        hasher.add_text(i, value, strlen(value));
+      } else if (coltypes[value_index[i]] == COLTYPE_INTEGER && INTEGER(column)[j] != NA_INTEGER) {
+        hasher.add_integer(i, INTEGER(column)[j]);
+      } else if (coltypes[value_index[i]] == COLTYPE_NUMERIC && !ISNAN(REAL(column)[j])) {
+        hasher.add_double(i, REAL(column)[j]);
+      } else {
+        hasher.add_null(i);
+      }
+    }
+    hashes[j] = hasher.finish();
+  }
+
+  std::unordered_map<std::string, uint64_t> table_hashes = read_row_hashes(dbc, tbl_name, key_columns, value_columns,
+      chunk_size);
+  unsigned long table_rows = table_hashes.size();
+  sync_plan plan = plan_sync(table_hashes, keys, hashes);
 
-  data_arrays data = alloc_mem(coltypes, varchar_col_lengths, null_indicator, nrows, ncols);
+  // the keys of the rows to delete go back as text, which DB2 converts when they are compared
+  Rcpp::List deletes(key_cols.size());
+  for (i = 0; i < key_cols.size(); i++) {
+    deletes[i] = Rcpp::CharacterVector(plan.deletes.size());
+  }
+  for (j = 0; j < plan.deletes.size(); j++) {
+    size_t start = 0;
+    for (i = 0; i < key_cols.size(); i++) {
+      size_t end = plan.deletes[j].find(SYNC_KEY_SEPARATOR, start);
+      if (end == std::string::npos) {
+        end = plan.deletes[j].size();
+      }
+      Rcpp::CharacterVector column = deletes[i];
+      column[j] = Rf_mkCharLenCE(plan.deletes[j].data() + start, (int) (end - start), CE_UTF8);
+      start = end + 1;
+    }
+  }
+  deletes.attr("names") = key_cols;
+  deletes.attr("class") = "data.frame";
+  deletes.attr("row.names") = Rcpp::IntegerVector::create(NA_INTEGER, -(int) plan.deletes.size());
+
+  Rcpp::IntegerVector inserts(plan.inserts.size());
+  for (j = 0; j < plan.inserts.size(); j++) {
+    inserts[j] = plan.inserts[j] + 1;
+  }
+  Rcpp::IntegerVector updates(plan.updates.size());
+  for (j = 0; j < plan.updates.size(); j++) {
+    updates[j] = plan.updates[j] + 1;
+  }
+
+  return Rcpp::List::create(Rcpp::Named("inserts") = inserts, Rcpp::Named("updates") = updates,
+      Rcpp::Named("deletes") = deletes, Rcpp::Named("unchanged") = (double) plan.unchanged,
+      Rcpp::Named("table_rows") = (double) table_rows);
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbImportFileInternal")]]
+
+Rcpp::DataFrame dbImportFileInternal(const SEXP& handle, const std::string& tbl_name, const std::string& path,
+    const std::vector<std::string>& col_names, const std::string& sep, const std::string& quote, const bool& header,
+    const std::string& na, unsigned long chunk_size, unsigned long commit_every, const bool& pipelined,
+    unsigned int threads, double max_rejected, const bool& verbose) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  if (sep.size() != 1 || quote.size() > 1) {
+    throw std::runtime_error("sep must be a single character and quote a single character or empty");
+  }
+
+  import_options options;
+  options.write.chunksize = chunk_size;
+  options.write.commit_every = commit_every;
+  options.write.pipelined = pipelined;
+  options.sep = sep[0];
+  options.quote = quote.empty() ? 0 : quote[0];
+  options.header = header;
+  options.na = na;
+  options.threads = threads;
+  if (max_rejected < (double) options.max_rejected) {
+    options.max_rejected = (unsigned long) max_rejected;
+  }
+
+  // the file is parsed straight into the parameter buffers, never into R objects
+  import_stats stats = import_file(dbc, tbl_name, path, col_names, options);
+
+  if (verbose) {
+    Rcpp::Rcout << "Read " << stats.records << " records from " << path << ". Wrote " << stats.written.rows
+        << " rows in " << stats.written.chunks << " chunks, rejected " << stats.rejected.size() << ". Spent "
+        << stats.written.fill_seconds << "s parsing and " << stats.written.execute_seconds << "s executing"
+        << std::endl;
+  }
+
+  std::vector<double> lines(stats.rejected.size());
+  std::vector<std::string> messages(stats.rejected.size());
+  for (size_t k = 0; k < stats.rejected.size(); k++) {
+    lines[k] = stats.rejected[k].line;
+    messages[k] = stats.rejected[k].message;
+  }
+
+  Rcpp::DataFrame rejected = Rcpp::DataFrame::create(Rcpp::Named("line") = lines,
+      Rcpp::Named("message") = messages, Rcpp::Named("stringsAsFactors") = false);
+  rejected.attr("records") = (double) stats.records;
+  rejected.attr("rows_written") = (double) stats.written.rows;
+  rejected.attr("commits") = (double) stats.written.commits;
+  return rejected;
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbCopyTableInternal")]]
+
+Rcpp::NumericVector dbCopyTableInternal(const SEXP& src_handle, const std::string& query, const SEXP& dst_handle,
+    const std::string& dst_table, unsigned long chunk_size, unsigned long commit_every, const bool& pipelined,
+    const bool& verbose) {
+
+  SQLHDBC src_dbc = get_dbc_handle(src_handle);
+  SQLHDBC dst_dbc = get_dbc_handle(dst_handle);
+
+  write_options options;
+  options.chunksize = chunk_size;
+  options.commit_every = commit_every;
+  options.pipelined = pipelined;
+
+  // the rows never leave the ODBC buffers
+  write_stats stats = copy_query(src_dbc, query, dst_dbc, dst_table, options);
+
+  if (verbose) {
+    Rcpp::Rcout << "Copied " << stats.rows << " rows to " << dst_table << " in " << stats.chunks << " chunks and "
+        << stats.commits << " commits. " << (pipelined ? "Waited " : "Spent ") << stats.fill_seconds
+        << "s fetching and " << stats.execute_seconds << "s inserting" << std::endl;
+  }
+
+  return Rcpp::NumericVector::create(Rcpp::Named("rows") = (double) stats.rows,
+      Rcpp::Named("chunks") = (double) stats.chunks, Rcpp::Named("commits") = (double) stats.commits,
+      Rcpp::Named("fetch_seconds") = stats.fill_seconds, Rcpp::Named("insert_seconds") = stats.execute_seconds);
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbWriteArrowInternal")]]
+
+Rcpp::NumericVector dbWriteArrowInternal(const SEXP& handle, const std::string& tbl_name, const SEXP& R_stream,
+    const std::vector<std::string>& col_names, unsigned long chunk_size, unsigned long commit_every,
+    const bool& pipelined, const bool& verbose) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  if (TYPEOF(R_stream) != EXTPTRSXP || R_ExternalPtrAddr(R_stream) == NULL) {
+    throw std::runtime_error("stream is not a valid nanoarrow_array_stream");
+  }
+
+  write_options options;
+  options.chunksize = chunk_size;
+  options.commit_every = commit_every;
+  options.pipelined = pipelined;
+
+  // the stream stays owned by R, which releases it when it is garbage collected
+  write_stats stats = write_arrow_stream(dbc, tbl_name, col_names, (struct ArrowArrayStream*) R_ExternalPtrAddr(R_stream),
+      options);
+
+  if (verbose) {
+    Rcpp::Rcout << "Wrote " << stats.rows << " rows to " << tbl_name << " in " << stats.chunks << " chunks and "
+        << stats.commits << " commits. " << (pipelined ? "Waited " : "Spent ") << stats.fill_seconds
+        << "s reading the stream and " << stats.execute_seconds << "s inserting" << std::endl;
+  }
+
+  return Rcpp::NumericVector::create(Rcpp::Named("rows") = (double) stats.rows,
+      Rcpp::Named("chunks") = (double) stats.chunks, Rcpp::Named("commits") = (double) stats.commits,
+      Rcpp::Named("read_seconds") = stats.fill_seconds, Rcpp::Named("insert_seconds") = stats.execute_seconds);
+}
+
+namespace rdb2 {
+
+typedef Rcpp::XPtr<std::shared_ptr<table_appender>> appender_xptr;
+
+static std::shared_ptr<table_appender> __get_appender(const SEXP& R_appender) {
+  if (TYPEOF(R_appender) != EXTPTRSXP || R_ExternalPtrAddr(R_appender) == NULL) {
+    throw std::runtime_error("Appender was invalid");
+  }
+
+  appender_xptr ptr(R_appender);
+  return *ptr;
+}
+
+static Rcpp::NumericVector __appender_stats(const std::shared_ptr<table_appender>& appender,
+    unsigned long flushed) {
+  return Rcpp::NumericVector::create(Rcpp::Named("flushed") = (double) flushed,
+      Rcpp::Named("buffered") = (double) appender->buffered_rows(),
+      Rcpp::Named("rows_written") = (double) appender->rows_written(),
+      Rcpp::Named("flushes") = (double) appender->flushes());
+}
+
+} // namespace
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbAppenderCreateInternal")]]
+
+SEXP dbAppenderCreateInternal(const SEXP& handle, const std::string& tbl_name, const std::vector<std::string>& col_names,
+    double max_rows, double max_bytes, double max_seconds) {
+
+  SQLHDBC dbc = get_dbc_handle(handle);
+
+  appender_options options;
+  options.max_rows = (unsigned long) max_rows;
+  options.max_bytes = (size_t) max_bytes;
+  options.max_seconds = max_seconds;
+
+  // the R object holds a reference and the connection a weak one so that closing the connection
+  // can flush the appender. The finalizer only frees the statement - flushing is left to R
+  appender_xptr ptr(new std::shared_ptr<table_appender>(
+      get_table_appender(dbc, tbl_name, get_insert_SQL(tbl_name, col_names), col_names.size(), options)), true);
+  ptr.attr("class") = "rdb2_appender";
+
+  return ptr;
+}
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbAppenderAppendInternal")]]
+
+Rcpp::NumericVector dbAppenderAppendInternal(const SEXP& R_appender, const Rcpp::DataFrame& df,
+    const Rcpp::List& R_coltypes, const std::vector<int>& varchar_col_lengths) {
+
+  std::shared_ptr<table_appender> appender = __get_appender(R_appender);
+
+  std::vector<short> coltypes = init_col_vectors(df, R_coltypes);
+  fill_function fill = get_dataframe_fill(df, coltypes, varchar_col_lengths);
 
-  // Now copy the data to contiguous memory for SQLBindParameter
-  copy_data(df, data, null_indicator, varchar_col_lengths, coltypes, nrows, ncols);
+  unsigned long flushed = appender->append(coltypes, varchar_col_lengths, df.nrows(), fill);
 
-  write_table(dbc, tbl_name, insert_SQL, data, null_indicator, coltypes, varchar_col_lengths, nrows);
+  return __appender_stats(appender, flushed);
 }
 
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbAppenderFlushInternal")]]
+
+Rcpp::NumericVector dbAppenderFlushInternal(const SEXP& R_appender, const bool& close) {
+
+  std::shared_ptr<table_appender> appender = __get_appender(R_appender);
+
+  unsigned long flushed = appender->buffered_rows();
+  if (close) {
+    appender->close();
+  } else {
+    appender->flush();
+  }
+
+  return __appender_stats(appender, flushed);
+}
+
+namespace rdb2 {
+
+struct parallel_write_worker {
+  // state for one connection of dbWriteTableParallel
+  SQLHDBC dbc;
+  unsigned long first_row;
+  unsigned long nrows;
+  std::atomic<unsigned long> rows_written;
+  std::atomic<bool> finished;
+  double seconds;
+  bool succeeded;
+  std::string status;
+  std::string message;
+
+  parallel_write_worker() :
+      dbc(NULL), first_row(0), nrows(0), rows_written(0), finished(false), seconds(0), succeeded(false) {
+  }
+};
+
+struct parallel_write_connections {
+  // closes the worker connections however we leave dbWriteTableParallelInternal
+  std::vector<parallel_write_worker>& workers;
+
+  parallel_write_connections(std::vector<parallel_write_worker>& w) :
+      workers(w) {
+  }
+
+  ~parallel_write_connections() {
+    for (size_t i = 0; i < workers.size(); i++) {
+      try {
+        if (workers[i].dbc != NULL) {
+          SQLEndTran(SQL_HANDLE_DBC, workers[i].dbc, SQL_ROLLBACK);  // no-op if already committed
+          closeConn(workers[i].dbc, true);
+        }
+      } catch (...) {
+      }
+    }
+  }
+};
+
+static void __end_transactions(std::vector<parallel_write_worker>& workers, bool commit) {
+  // ends the open transaction on every worker connection. Note that committing is not atomic
+  // across connections - if one commit fails, the workers that were committed before it stay committed
+  for (size_t i = 0; i < workers.size(); i++) {
+    if (commit && SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, workers[i].dbc, SQL_COMMIT))) {
+      workers[i].status = "committed";
+    } else if (commit) {
+      workers[i].status = "commit failed";
+      workers[i].message = extract_error("Error committing worker transaction", workers[i].dbc, SQL_HANDLE_DBC);
+      commit = false;
+      SQLEndTran(SQL_HANDLE_DBC, workers[i].dbc, SQL_ROLLBACK);
+    } else {
+      SQLEndTran(SQL_HANDLE_DBC, workers[i].dbc, SQL_ROLLBACK);
+      if (workers[i].succeeded) {
+        workers[i].status = "rolled back";
+      }
+    }
+  }
+}
+
+} // namespace
+
+//' @noRd
+//' @export
+// [[Rcpp::export(name=".dbWriteTableParallelInternal")]]
+
+Rcpp::DataFrame dbWriteTableParallelInternal(const std::string& conn_string, const Rcpp::DataFrame& df,
+    const std::string& tbl_name, const std::vector<std::string>& col_names, const Rcpp::List& R_coltypes,
+    const std::vector<int>& varchar_col_lengths, unsigned int nworkers, unsigned long chunk_size,
+    const bool& commit_all, const bool& verbose) {
+
+  size_t ncols = df.size(); /* number of columns in dataframe */
+  unsigned long nrows = df.nrows();
+  size_t i;
+
+  std::vector<short> coltypes = init_col_vectors(df, R_coltypes);
+  std::string insert_SQL = get_insert_SQL(tbl_name, col_names);
+  std::vector<column_source> columns = get_column_sources(df, coltypes);
+
+  nworkers = std::max(1u, (unsigned int) std::min<unsigned long>(nworkers, nrows));
+  std::vector<parallel_write_worker> workers(nworkers);
+  parallel_write_connections connections(workers);
+
+  // split the rows as evenly as possible and open one connection per worker.
+  // Connections are opened here rather than in the workers since the environment handle is shared
+  unsigned long first_row = 0;
+  for (i = 0; i < nworkers; i++) {
+    workers[i].first_row = first_row;
+    workers[i].nrows = nrows / nworkers + (i < nrows % nworkers ? 1 : 0);
+    first_row += workers[i].nrows;
+
+    workers[i].dbc = getConn(conn_string);
+    if (commit_all && !SQL_SUCCEEDED(SQLSetConnectAttr(workers[i].dbc, SQL_ATTR_AUTOCOMMIT,
+        (SQLPOINTER) SQL_AUTOCOMMIT_OFF, 0))) {
+      throw std::runtime_error(extract_error("Error turning autocommit off", workers[i].dbc, SQL_HANDLE_DBC));
+    }
+  }
+
+  if (verbose)
+    Rcpp::Rcout << insert_SQL << " using " << nworkers << " connections" << std::endl;
+
+  std::atomic<bool> cancelled(false);
+
+  auto run_worker = [&](parallel_write_worker& worker) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<utf16_string_cache> caches(ncols);
+
+    fill_function fill = [&](data_arrays& data, indic_arrays& null_indicator, unsigned long row,
+        unsigned long count) {
+      copy_data(columns, data, null_indicator, varchar_col_lengths, coltypes, caches, worker.first_row + row, count);
+    };
+
+    write_options options;
+    options.chunksize = chunk_size;
+    options.commit_every = commit_all ? 0 : 1;
+    options.progress = [&](unsigned long rows) {
+      worker.rows_written = rows;
+      if (cancelled) {
+        throw std::runtime_error("Cancelled because another worker failed or the write was interrupted");
+      }
+    };
+
+    try {
+      write_table_chunked(worker.dbc, tbl_name, insert_SQL, coltypes, varchar_col_lengths, worker.nrows, fill, options);
+      worker.succeeded = true;
+      worker.status = commit_all ? "pending" : "committed";
+    } catch (std::exception& e) {
+      worker.status = "failed";
+      worker.message = e.what();
+      if (commit_all) {
+        cancelled = true;  // no point in the other workers carrying on
+      }
+    }
+    worker.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    worker.finished = true;
+  };
+
+  std::vector<std::thread> threads;
+  for (i = 0; i < nworkers; i++) {
+    threads.push_back(std::thread(run_worker, std::ref(workers[i])));
+  }
+
+  // report progress and watch for user interrupts while the workers run
+  bool interrupted = false;
+  unsigned long last_reported = 0;
+  for (;;) {
+    bool done = true;
+    unsigned long written = 0;
+    for (i = 0; i < nworkers; i++) {
+      written += workers[i].rows_written;
+      done = done && workers[i].finished;
+    }
+
+    if (verbose && written != last_reported) {
+      Rcpp::Rcout << "Wrote " << written << " of " << nrows << " rows" << std::endl;
+      last_reported = written;
+    }
+
+    if (done) {
+      break;
+    }
+
+    try {
+      Rcpp::checkUserInterrupt();
+    } catch (...) {
+      interrupted = true;
+      cancelled = true;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  for (i = 0; i < nworkers; i++) {
+    threads[i].join();
+  }
+
+  if (commit_all) {
+    bool all_succeeded = !interrupted;
+    for (i = 0; i < nworkers; i++) {
+      all_succeeded = all_succeeded && workers[i].succeeded;
+    }
+    __end_transactions(workers, all_succeeded);
+  }
+
+  if (interrupted) {
+    throw std::runtime_error("dbWriteTableParallel was interrupted");
+  }
+
+  std::vector<int> worker_ids(nworkers);
+  std::vector<double> first_rows(nworkers), last_rows(nworkers), rows_written(nworkers), seconds(nworkers);
+  std::vector<std::string> status(nworkers), message(nworkers);
+
+  for (i = 0; i < nworkers; i++) {
+    worker_ids[i] = i + 1;
+    first_rows[i] = workers[i].first_row + 1;
+    last_rows[i] = workers[i].first_row + workers[i].nrows;
+    rows_written[i] = workers[i].rows_written;
+    seconds[i] = workers[i].seconds;
+    status[i] = workers[i].status;
+    message[i] = workers[i].message;
+  }
+
+  return Rcpp::DataFrame::create(Rcpp::Named("worker") = worker_ids, Rcpp::Named("first_row") = first_rows,
+      Rcpp::Named("last_row") = last_rows, Rcpp::Named("rows_written") = rows_written,
+      Rcpp::Named("seconds") = seconds, Rcpp::Named("status") = status, Rcpp::Named("message") = message,
+      Rcpp::Named("stringsAsFactors") = false);
+}
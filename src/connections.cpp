@@ -118,6 +118,9 @@ SEXP dbGetConn(const std::string& conn_string) {
   SQLHDBC dbc = NULL;
   dbc = rdb2::getConn(conn_string);
 
+  // let long running library calls be interrupted from R
+  rdb2::setInterruptHandler(Rcpp::checkUserInterrupt);
+
   return get_R_handle_from_SQL_handle(dbc);
 }
 
@@ -20,6 +20,9 @@
 
 #include "rwedb2.h"
 
+#include <thread>
+#include <algorithm>
+#include <chrono>
 
 namespace rdb2 {
 
@@ -30,10 +33,15 @@ struct odbc_env_handle env_struct;
 // that catches C++ exceptions and handles it or passes it through in the appropriate
 // way to the language in which the calling code is written
 
+// the handler is only called from the thread that installed it since the library may run
+// parts of its work (eg. encoding pipelined writes) on worker threads
+
 static void (*interrupt_fn) (void);
+static std::thread::id interrupt_thread;
 
 void setInterruptHandler(void (*fn) (void)) {
   interrupt_fn = fn;
+  interrupt_thread = std::this_thread::get_id();
 }
 
 void clearInterruptHandler() {
@@ -41,18 +49,123 @@ void clearInterruptHandler() {
 }
 
 void checkInterrupt() {
-  if (interrupt_fn != NULL) {
+  if (interrupt_fn != NULL && std::this_thread::get_id() == interrupt_thread) {
     interrupt_fn();
   }
 }
 
+// per connection state, created on first use
+static std::map<SQLHDBC, std::shared_ptr<connection_state>> connection_states;
+static std::mutex connection_states_mutex;
+
+std::shared_ptr<connection_state> get_connection_state(const SQLHDBC& dbc) {
+  std::lock_guard<std::mutex> lock(connection_states_mutex);
+  std::shared_ptr<connection_state>& state = connection_states[dbc];
+  if (!state) {
+    state = std::make_shared<connection_state>();
+  }
+  return state;
+}
+
+std::shared_ptr<prepared_statement> get_prepared_statement(const SQLHDBC& dbc, const std::string& sql,
+    unsigned int chunksize) {
+  std::shared_ptr<connection_state> state = get_connection_state(dbc);
+  std::lock_guard<std::mutex> lock(state->mutex);
+  std::list<std::shared_ptr<prepared_statement>>& cache = state->statement_cache;
+
+  for (std::list<std::shared_ptr<prepared_statement>>::iterator it = cache.begin(); it != cache.end(); ++it) {
+    if ((*it)->get_sql() == sql && (*it)->get_chunksize() == chunksize && (*it)->valid()) {
+      cache.splice(cache.begin(), cache, it);
+      return cache.front();
+    }
+  }
+
+  std::shared_ptr<prepared_statement> statement = std::make_shared<prepared_statement>(dbc, sql, chunksize);
+
+  cache.push_front(statement);
+  if (cache.size() > STATEMENT_CACHE_SIZE) {
+    cache.pop_back();
+  }
+
+  std::vector<std::weak_ptr<prepared_statement>>& statements = state->statements;
+  statements.erase(std::remove_if(statements.begin(), statements.end(),
+      [](const std::weak_ptr<prepared_statement>& s) { return s.expired(); }), statements.end());
+  statements.push_back(statement);
+
+  return statement;
+}
+
+std::shared_ptr<table_appender> get_table_appender(const SQLHDBC& dbc, const std::string& tbl_name,
+    const std::string& insert_SQL, size_t ncols, const appender_options& options) {
+  std::shared_ptr<connection_state> state = get_connection_state(dbc);
+  std::shared_ptr<table_appender> appender = std::make_shared<table_appender>(dbc, tbl_name, insert_SQL, ncols, options);
+
+  std::lock_guard<std::mutex> lock(state->mutex);
+  std::vector<std::weak_ptr<table_appender>>& appenders = state->appenders;
+  appenders.erase(std::remove_if(appenders.begin(), appenders.end(),
+      [](const std::weak_ptr<table_appender>& a) { return a.expired(); }), appenders.end());
+  appenders.push_back(appender);
+
+  return appender;
+}
+
+void register_cursor(const SQLHDBC& dbc, const std::shared_ptr<odbc_stmt_handle>& cursor) {
+  std::shared_ptr<connection_state> state = get_connection_state(dbc);
+
+  std::lock_guard<std::mutex> lock(state->mutex);
+  std::vector<std::weak_ptr<odbc_stmt_handle>>& cursors = state->cursors;
+  cursors.erase(std::remove_if(cursors.begin(), cursors.end(),
+      [](const std::weak_ptr<odbc_stmt_handle>& c) { return c.expired(); }), cursors.end());
+  cursors.push_back(cursor);
+}
+
 void closeConn(SQLHDBC dbc, bool disconnect) {
   SQLRETURN ret;
+  std::string flush_error;
 
   /* disconnect */
   if (dbc == NULL)
     return;
 
+  {
+    // statement handles must be freed before the connection is, even if R still holds on to them
+    std::lock_guard<std::mutex> lock(connection_states_mutex);
+    std::map<SQLHDBC, std::shared_ptr<connection_state>>::iterator found = connection_states.find(dbc);
+    if (found != connection_states.end()) {
+      std::lock_guard<std::mutex> state_lock(found->second->mutex);
+      // write out rows still buffered by appenders. The connection is closed even if that fails
+      for (size_t i = 0; i < found->second->appenders.size(); i++) {
+        std::shared_ptr<table_appender> appender = found->second->appenders[i].lock();
+        if (appender) {
+          try {
+            appender->close();
+          } catch (std::exception& e) {
+            flush_error += (flush_error.empty() ? "" : "\n") + std::string(e.what());
+          }
+          appender->release();
+        }
+      }
+      found->second->appenders.clear();
+      for (size_t i = 0; i < found->second->statements.size(); i++) {
+        std::shared_ptr<prepared_statement> statement = found->second->statements[i].lock();
+        if (statement) {
+          statement->release();
+        }
+      }
+      for (size_t i = 0; i < found->second->cursors.size(); i++) {
+        std::shared_ptr<odbc_stmt_handle> cursor = found->second->cursors[i].lock();
+        if (cursor && cursor->stmt != NULL) {
+          SQLFreeHandle(SQL_HANDLE_STMT, cursor->stmt);
+          cursor->stmt = NULL;
+        }
+      }
+      found->second->cursors.clear();
+      found->second->statement_cache.clear();
+      found->second->statements.clear();
+      connection_states.erase(found);
+    }
+  }
+
   if (disconnect) {   /* disconnect from driver */
     if (!SQL_SUCCEEDED(ret = SQLDisconnect(dbc))) {
       throw std::runtime_error(extract_error("Error while disconnecting from database", dbc, SQL_HANDLE_DBC));
@@ -72,6 +185,9 @@ void closeConn(SQLHDBC dbc, bool disconnect) {
     env_struct.env = NULL;
   }
 
+  if (!flush_error.empty()) {
+    throw std::runtime_error("Connection closed but buffered rows could not be written: " + flush_error);
+  }
 }
 
 SQLHDBC getConn(const std::string& conn_string, const long& login_timeout, const long& connection_timeout) {
@@ -124,6 +240,10 @@ SQLHDBC getConn(const std::string& conn_string, const long& login_timeout, const
     throw std::runtime_error(err_msg);
   }
 
+  std::shared_ptr<connection_state> state = get_connection_state(dbc);
+  std::lock_guard<std::mutex> lock(state->mutex);
+  state->conn_string = conn_string;
+
   return dbc;
 
 }
@@ -148,4 +268,135 @@ void execute_update(const SQLHDBC& dbc, const std::string& query) {
   }
 }
 
+static SQLLEN __row_count(SQLHSTMT stmt, SQLRETURN ret) {
+  SQLLEN count = 0;
+
+  if (ret == SQL_NO_DATA) {
+    return 0;
+  }
+
+  if (!SQL_SUCCEEDED(SQLRowCount(stmt, &count))) {
+    return -1;
+  }
+
+  // the DB2 driver only writes 32 bits here so -1 (no count available) comes back as 0xFFFFFFFF
+  return (count == 0xFFFFFFFF) ? -1 : count;
+}
+
+static double __seconds_since(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool __execute_compound(SQLHSTMT stmt, const std::vector<std::string>& statements, batch_results& results) {
+  // sends every statement in one SQLExecDirect and reads the row counts back with SQLMoreResults.
+  // Returns false if any statement failed, in which case the caller rolls back and runs them one at a time
+  std::string batch;
+  size_t i;
+
+  for (i = 0; i < statements.size(); i++) {
+    batch += (i > 0 ? ";\n" : "") + statements[i];
+  }
+
+  SQLRETURN ret = SQLExecDirectW(stmt, get_UTF16_string(batch).get(), SQL_NTS);
+  if (!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+    return false;
+  }
+
+  for (i = 0; i < statements.size(); i++) {
+    results.rows_affected[i] = __row_count(stmt, ret);
+    if (i + 1 < statements.size()) {
+      ret = SQLMoreResults(stmt);
+      if (!SQL_SUCCEEDED(ret)) {
+        // SQL_NO_DATA here means the driver ran fewer statements than we sent
+        SQLFreeStmt(stmt, SQL_CLOSE);
+        return false;
+      }
+    }
+  }
+
+  SQLFreeStmt(stmt, SQL_CLOSE);
+  return true;
+}
+
+batch_results execute_batch(const SQLHDBC& dbc, const std::vector<std::string>& statements, bool transaction,
+    bool compound) {
+
+  struct odbc_stmt_handle stmt_holder;
+  batch_results results;
+  size_t nstatements = statements.size();
+  size_t i;
+
+  results.rows_affected.assign(nstatements, -1);
+  results.seconds.assign(nstatements, -1);
+
+  if (nstatements == 0) {
+    return results;
+  }
+
+  // autocommit is set once for the whole batch rather than for every statement
+  autocommit_guard autocommit(dbc, transaction ? SQL_AUTOCOMMIT_OFF : SQL_AUTOCOMMIT_ON);
+
+  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt_holder.stmt))) {
+    throw std::runtime_error(
+        extract_error("Error in " + std::string(__func__) + " while allocating statement", dbc, SQL_HANDLE_DBC));
+  }
+
+  std::chrono::steady_clock::time_point batch_start = std::chrono::steady_clock::now();
+
+  SQLUINTEGER batch_support = 0;
+  if (compound && transaction && nstatements > 1) {
+    SQLGetInfo(dbc, SQL_BATCH_SUPPORT, &batch_support, sizeof(batch_support), NULL);
+  }
+
+  // anything that goes wrong (including an interrupt) rolls back an open batch transaction before it is passed
+  // on. Otherwise restoring autocommit would commit the statements that did run
+  try {
+    if (batch_support & SQL_BS_ROW_COUNT_EXPLICIT) {
+      results.compound = __execute_compound(stmt_holder.stmt, statements, results);
+      if (!results.compound) {
+        // find out which statement failed by running them again one at a time
+        SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK);
+        results.rows_affected.assign(nstatements, -1);
+      }
+    }
+
+    for (i = 0; !results.compound && i < nstatements; i++) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      SQLRETURN ret = SQLExecDirectW(stmt_holder.stmt, get_UTF16_string(statements[i]).get(), SQL_NTS);
+      if (!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+        std::string error = extract_error("Error while executing statement " + std::to_string(i + 1) + " of "
+            + std::to_string(nstatements), stmt_holder.stmt, SQL_HANDLE_STMT);
+        if (transaction) {
+          error += "The batch was rolled back.";
+        } else if (i > 0) {
+          error += "Statements 1 to " + std::to_string(i) + " were committed.";
+        }
+        throw std::runtime_error(error);
+      }
+
+      results.rows_affected[i] = __row_count(stmt_holder.stmt, ret);
+      SQLFreeStmt(stmt_holder.stmt, SQL_CLOSE);
+      results.seconds[i] = __seconds_since(start);
+
+      checkInterrupt();
+    }
+
+    if (transaction && !SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_COMMIT))) {
+      throw std::runtime_error(extract_error("Error while committing batch", dbc, SQL_HANDLE_DBC));
+    }
+  } catch (...) {
+    if (transaction) {
+      SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK);
+    }
+    throw;
+  }
+
+  results.total_seconds = __seconds_since(batch_start);
+
+  autocommit.restore();
+
+  return results;
+}
+
 }  // namespace
@@ -24,6 +24,14 @@
 #include "rwedb2_DML.h"
 #include "rwedb2_utils.h"
 
+#include <stdexcept>
+#include <map>
+#include <list>
+#include <mutex>
+
+// number of prepared statements kept per connection by get_prepared_statement
+#define STATEMENT_CACHE_SIZE 32
+
 namespace rdb2 {
 
 struct odbc_env_handle {
@@ -49,6 +57,85 @@ struct odbc_stmt_handle {
   }
 };
 
+struct autocommit_guard {
+  // sets autocommit on the connection for the lifetime of this object and
+  // then restores the original value
+  SQLHDBC dbc;
+  SQLINTEGER original;
+  bool restored;
+
+  autocommit_guard(SQLHDBC connection, SQLULEN autocommit) {
+    dbc = connection;
+    restored = false;
+
+    if (!SQL_SUCCEEDED(SQLGetConnectAttr(dbc, SQL_AUTOCOMMIT, &original, 0, NULL))) {
+      throw std::runtime_error(extract_error("Error retrieving autocommit parameter", dbc, SQL_HANDLE_DBC));
+    }
+
+    if (!SQL_SUCCEEDED(SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER) autocommit, 0))) {
+      throw std::runtime_error(extract_error("Error modifying autocommit parameter", dbc, SQL_HANDLE_DBC));
+    }
+  }
+
+  void set(SQLULEN autocommit) {
+    // changes the value while still restoring the original one at the end
+    if (!SQL_SUCCEEDED(SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER) autocommit, 0))) {
+      throw std::runtime_error(extract_error("Error modifying autocommit parameter", dbc, SQL_HANDLE_DBC));
+    }
+  }
+
+  void restore() {
+    restored = true;
+    if (!SQL_SUCCEEDED(SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER) (long) original, 0))) {
+      throw std::runtime_error(extract_error("Error restoring autocommit parameter", dbc, SQL_HANDLE_DBC));
+    }
+  }
+
+  ~autocommit_guard() {
+    // errors are ignored here since we may already be unwinding from another error
+    if (!restored) {
+      SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER) (long) original, 0);
+    }
+  }
+};
+
+struct connection_state {
+  // state the library keeps for a connection between calls (eg. staging tables that have already been
+  // declared). It is dropped when the connection is closed. Hold mutex while using it
+  std::mutex mutex;
+  std::map<std::string, std::string> staging_tables;  // staging table declared for each target table and column list
+  unsigned long next_staging_id;
+  std::string conn_string;   // the connection string it was opened with, part of the key of cached results
+
+  // prepared statements, most recently used first. Statements that fall off the end are freed
+  // once nobody else holds them
+  std::list<std::shared_ptr<prepared_statement>> statement_cache;
+  // every statement prepared on the connection, so that they can all be released before it is closed
+  std::vector<std::weak_ptr<prepared_statement>> statements;
+  // appenders on the connection, which are flushed and released before it is closed
+  std::vector<std::weak_ptr<table_appender>> appenders;
+  // statements of result streams that outlive the call that opened them. Freed before the connection is closed
+  std::vector<std::weak_ptr<odbc_stmt_handle>> cursors;
+
+  connection_state() {
+    next_staging_id = 0;
+  }
+};
+
+std::shared_ptr<connection_state> get_connection_state(const SQLHDBC& dbc);
+
+// returns the cached prepared statement for sql on this connection, preparing it if needed
+std::shared_ptr<prepared_statement> get_prepared_statement(const SQLHDBC& dbc, const std::string& sql,
+    unsigned int chunksize);
+
+// creates an appender for tbl_name and registers it with the connection so that it is flushed on close
+std::shared_ptr<table_appender> get_table_appender(const SQLHDBC& dbc, const std::string& tbl_name,
+    const std::string& insert_SQL, size_t ncols, const appender_options& options);
+
+// registers the statement of a long lived result stream so that it is freed when the connection is closed.
+// Its owner sees a NULL stmt from then on
+void register_cursor(const SQLHDBC& dbc, const std::shared_ptr<odbc_stmt_handle>& cursor);
+
 void closeConn(SQLHDBC dbc, bool disconnect = true);
 
 SQLHDBC getConn(const std::string& conn_string, const long& login_timeout = 120, 
@@ -56,6 +143,24 @@ SQLHDBC getConn(const std::string& conn_string, const long& login_timeout = 120,
                   
 void execute_update(const SQLHDBC& dbc, const std::string& query);
 
+struct batch_results {
+  std::vector<SQLLEN> rows_affected;  // -1 if the driver has no count for a statement (eg. DDL)
+  std::vector<double> seconds;        // -1 for statements that were sent together in one batch
+  double total_seconds;
+  bool compound;                      // the statements were sent to the server in a single round trip
+
+  batch_results() {
+    total_seconds = 0;
+    compound = false;
+  }
+};
+
+// executes statements in order on one statement handle, stopping at the first one that fails.
+// With transaction, they run in a single transaction that is rolled back on failure. Otherwise each statement
+// is committed as it completes. compound sends them as one batch if the driver supports it (transaction only)
+batch_results execute_batch(const SQLHDBC& dbc, const std::vector<std::string>& statements, bool transaction,
+    bool compound);
+
 void setInterruptHandler(void (*fn) (void));
 
 void clearInterruptHandler();
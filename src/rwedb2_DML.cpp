@@ -18,9 +18,22 @@
  *      Author: karthik
  */
 #include "rwedb2.h"
+#include "rwedb2_spill.h"
 #include <iostream>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+
+#ifdef RDB2_HAVE_DB2API
+// the DB2 administrative API headers are needed to pass LOAD options that have no CLI attribute
+// of their own (warning limit, message file). Define RDB2_HAVE_DB2API when building against a DB2 client
+#include <db2ApiDf.h>
+#endif
 
 #include "utf8.h"
 
@@ -34,21 +47,26 @@
 // the real null indicator is in the null_indic array and 
 // callers of this library should rely on that to identify NULL values
 
+// longest text sent for columns that are not fetched as strings (eg. GRAPHIC), the VARCHAR limit
+#define MAX_TEXT_PARAM_LENGTH 32672
+
 #define DUMMY_INT 0
 #define DUMMY_STRING ""
 
+// bytes requested from SQLGetData for the first piece of a LOB value. The buffer grows to the longest value
+#define LOB_PIECE_SIZE (64 * 1024)
+
 namespace rdb2 {
 
 /***************************************************
  Functions to support dbReadTable 
 ****************************************************/
 
-static std::vector<column_desc> __get_column_descs(SQLHSTMT stmt, size_t ncols) {
-  std::vector<column_desc> col_desc(ncols);
-  size_t i;
+static void __get_column_attributes(SQLHSTMT stmt, size_t i, std::vector<column_desc>& col_desc) {
+  // describes column i one attribute at a time. Only used if SQLDescribeCol fails
   SQLRETURN ret; /* ODBC API return status */
 
-  for (i = 0; i < ncols; i++) {
+  {
     if (!SQL_SUCCEEDED(
         ret = SQLColAttribute(stmt, i + 1, SQL_DESC_NAME, col_desc[i].colname, sizeof(col_desc[i].colname), NULL,
             NULL))) {
@@ -84,6 +102,35 @@ static std::vector<column_desc> __get_column_descs(SQLHSTMT stmt, size_t ncols)
           extract_error("Error in SQLColAttribute in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
     }
 
+    col_desc[i].scale = 0;
+  }
+}
+
+static std::vector<column_desc> __get_column_descs(SQLHSTMT stmt, size_t ncols) {
+  // SQLDescribeCol gets the name, type and size of a column in one call instead of one SQLColAttribute call
+  // per attribute. The type name is only needed for error messages so it is left empty (see __bind_cols)
+  std::vector<column_desc> col_desc(ncols);
+  size_t i;
+
+  for (i = 0; i < ncols; i++) {
+    SQLSMALLINT name_length = 0;
+    SQLSMALLINT type = 0;
+    SQLULEN size = 0;  // the DB2 driver only writes 32 bits here
+    SQLSMALLINT digits = 0;
+    SQLSMALLINT nullable = 0;
+
+    if (!SQL_SUCCEEDED(SQLDescribeCol(stmt, i + 1, col_desc[i].colname, sizeof(col_desc[i].colname), &name_length,
+        &type, &size, &digits, &nullable))) {
+      __get_column_attributes(stmt, i, col_desc);
+      continue;
+    }
+
+    col_desc[i].coltype[0] = 0;
+    col_desc[i].type = type;
+    col_desc[i].precision = size;
+    col_desc[i].scale = digits;
+    // the column size of a decimal is its precision. It is displayed with a sign and a decimal point
+    col_desc[i].displaysize = (type == SQL_DECIMAL || type == SQL_NUMERIC) ? size + 2 : size;
   }
 
   return col_desc;
@@ -193,19 +240,56 @@ static void __bind_cols(SQLHSTMT stmt, const std::vector<column_desc>& col_desc,
       }
       break;
     }
-    default:
+    case SQL_BLOB:
+    case SQL_CLOB:
+    case SQL_DBCLOB:
+    case SQL_XML:
+    case SQL_LONGVARCHAR:
+    case SQL_WLONGVARCHAR:
+    case SQL_LONGVARBINARY:
+      // left unbound, see __get_lob_values
+      break;
+    default: {
+      // the type name is not part of the description from SQLDescribeCol so look it up for the message
+      SQLCHAR type_name[32] = "";
+      if (col_desc[i].coltype[0] == 0) {
+        SQLColAttribute(stmt, i + 1, SQL_DESC_TYPE_NAME, type_name, sizeof(type_name), NULL, NULL);
+      } else {
+        std::memcpy(type_name, col_desc[i].coltype, sizeof(type_name));
+      }
       throw std::runtime_error(std::string("Unable to bind column of type ") + 
-      						reinterpret_cast<const char*>(col_desc[i].coltype));
+      						reinterpret_cast<const char*>(type_name));
+    }
     }
   }
 }
 
 void process_string_col(struct read_results& result, SQLROWSETSIZE row_count, const size_t i, int field_width,
-    const std::vector<std::shared_ptr<void>>& data, const std::vector<column_desc>& col_desc, INDIC_TYPE* indic) {
+    const std::vector<std::shared_ptr<void>>& data, const std::vector<column_desc>& col_desc, INDIC_TYPE* indic,
+    bool compact = false) {
   long offset = 0;
   size_t j;
 
   result.stl_vecs[i].type = COLTYPE_STRING;
+  if (compact) {
+    // converted straight onto the end of the column's buffer
+    if (!result.stl_vecs[i].compact_data) {
+      result.stl_vecs[i].compact_data = std::make_shared<compact_strings>();
+    }
+    compact_strings& strings = *result.stl_vecs[i].compact_data;
+    for (j = 0; j < row_count; j++) {
+      bool is_null = (indic[j] == SQL_NULL_DATA);
+      if (!is_null) {
+        const SQLWCHAR* value = (SQLWCHAR*) (data[i].get()) + offset;
+        utf8::utf16to8(value, value + indic[j] / sizeof(SQLWCHAR), std::back_inserter(strings.data));
+      }
+      strings.push_back(!is_null);
+      result.null_indics[i].push_back(is_null);
+      offset += field_width;
+    }
+    return;
+  }
+
   for (j = 0; j < row_count; j++) {
     if (indic[j] == SQL_NULL_DATA) {
       result.stl_vecs[i].string_data.push_back(DUMMY_STRING);
@@ -219,83 +303,326 @@ void process_string_col(struct read_results& result, SQLROWSETSIZE row_count, co
   }
 }
 
-static read_results __fetch_data(SQLHSTMT stmt, const std::vector<column_desc>& col_desc, unsigned int chunksize) {
+static void __collect_lob_col(struct read_results& result, SQLROWSETSIZE row_count, const size_t i,
+    const fetch_buffers& buffers, INDIC_TYPE* indic, bool compact) {
+  // the values were already converted by __get_lob_values. Binary LOBs are always collected compact so
+  // that they can be turned into raw vectors without going through std::string
+  result.stl_vecs[i].type = COLTYPE_STRING;
+  if (compact && !result.stl_vecs[i].compact_data) {
+    result.stl_vecs[i].compact_data = std::make_shared<compact_strings>();
+  }
+
+  for (size_t j = 0; j < row_count; j++) {
+    bool is_null = (indic[j] == SQL_NULL_DATA);
+    const std::string& value = buffers.lob_values[i][j];
+    if (compact) {
+      result.stl_vecs[i].compact_data->data += value;
+      result.stl_vecs[i].compact_data->push_back(!is_null);
+    } else {
+      result.stl_vecs[i].string_data.push_back(is_null ? std::string(DUMMY_STRING) : value);
+    }
+    result.null_indics[i].push_back(is_null);
+  }
+}
+
+short result_coltype(const column_desc& desc) {
+  // the same types as __fetch_bound collects
+  switch (desc.type) {
+  case SQL_INTEGER:
+  case SQL_SMALLINT:
+    return COLTYPE_INTEGER;
+  case SQL_BIGINT:
+  case SQL_REAL:
+  case SQL_DOUBLE:
+  case SQL_FLOAT:
+    return COLTYPE_NUMERIC;
+  default:
+    return COLTYPE_STRING;
+  }
+}
+
+bool is_lob(const column_desc& desc) {
+  switch (desc.type) {
+  case SQL_BLOB:
+  case SQL_CLOB:
+  case SQL_DBCLOB:
+  case SQL_XML:
+  case SQL_LONGVARCHAR:
+  case SQL_WLONGVARCHAR:
+  case SQL_LONGVARBINARY:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool is_binary_lob(const column_desc& desc) {
+  return desc.type == SQL_BLOB || desc.type == SQL_LONGVARBINARY;
+}
+
+int bound_field_width(const column_desc& desc) {
+  // width in SQLWCHARs (including the terminating null) of the field of a column that __bind_cols binds
+  // as a wide string, or 0 if the column is bound to a native type
+  switch (desc.type) {
+  case SQL_CHAR:
+  case SQL_VARCHAR:
+    return desc.displaysize + 1;
+  case SQL_DECIMAL:
+  case SQL_NUMERIC:
+    return desc.precision + 3;
+  case SQL_DECFLOAT:
+    return DECFLOAT_FIELD_WIDTH;
+  case SQL_TYPE_DATE:
+  case SQL_TYPE_TIME:
+  case SQL_TYPE_TIMESTAMP:
+    return (desc.displaysize > DATE_FIELD_MIN_LENGTH) ? desc.displaysize : DATE_FIELD_MIN_LENGTH;
+  default:
+    return 0;
+  }
+}
+
+short get_param_coltype(const column_desc& desc, int& width) {
+  // integers are sent as BIGINT and floating point as DOUBLE. Everything else (including DECIMAL and
+  // dates) is sent as text and converted by the server
+  width = 0;
+
+  switch (desc.type) {
+  case SQL_SMALLINT:
+  case SQL_INTEGER:
+  case SQL_BIGINT:
+    return COLTYPE_INTEGER;
+  case SQL_REAL:
+  case SQL_FLOAT:
+  case SQL_DOUBLE:
+    return COLTYPE_NUMERIC;
+  default:
+    width = bound_field_width(desc) - 1;
+    if (width <= 0) {
+      width = std::min<SQLLEN>(std::max<SQLLEN>(desc.displaysize, 1), MAX_TEXT_PARAM_LENGTH);
+    }
+    return COLTYPE_STRING;
+  }
+}
+
+static void __bind_fetch_buffers(SQLHSTMT stmt, const std::vector<column_desc>& col_desc, fetch_buffers& buffers,
+    unsigned int chunksize) {
+  // allocates the buffers for chunksize rows and binds them to the result columns. The bindings stay in
+  // place for later executions of the same statement
   size_t i;
-  size_t j;
   SQLRETURN ret;
-  INDIC_TYPE* indic;
-  short field_width;
-
   size_t ncols = col_desc.size();
 
-  SQLROWSETSIZE row_count_param;
-  SQLUINTEGER row_count;
+  for (i = 0; i < ncols; i++) {
+    if (is_lob(col_desc[i])) {
+      buffers.lob_cols.push_back(i);
+    }
+  }
 
-  std::unique_ptr<SQLUSMALLINT[]> row_status(new SQLUSMALLINT[chunksize]);
-  
-  std::vector<std::unique_ptr<SQLLEN[]>> indicator(ncols);
-  std::vector<std::shared_ptr<void>> data(ncols);
-  struct read_results result(ncols);
+  if (!buffers.lob_cols.empty()) {
+    // SQLGetData can only read from the current row, so results with LOB columns are fetched one row at a time.
+    // Only the LOB values that are actually there are held in memory, never chunksize times their declared length
+    chunksize = 1;
+    ret = SQLSetStmtAttr(stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER) (long) chunksize, SQL_IS_INTEGER);
+    if (!SQL_SUCCEEDED(ret)) {
+      throw std::runtime_error(
+          extract_error("Error in SQLSetStmtAttr in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+    }
+    buffers.lob_values.resize(ncols);
+    for (i = 0; i < buffers.lob_cols.size(); i++) {
+      buffers.lob_values[buffers.lob_cols[i]].resize(chunksize);
+    }
+  }
+
+  buffers.row_status.reset(new SQLUSMALLINT[chunksize]);
+  buffers.indicator.resize(ncols);
+  buffers.data.resize(ncols);
+  buffers.row_count = 0;
 
   for (i = 0; i < ncols; i++) {
-    indicator[i] = std::unique_ptr<SQLLEN[]>(new SQLLEN[chunksize]);
+    buffers.indicator[i] = std::unique_ptr<SQLLEN[]>(new SQLLEN[chunksize]);
     // not sure why the below zero-initialization line is needed but the read will fail without it
-    std::memset(indicator[i].get(), 0, sizeof(SQLLEN) * chunksize);
+    std::memset(buffers.indicator[i].get(), 0, sizeof(SQLLEN) * chunksize);
   }
 
-  ret = SQLSetStmtAttr(stmt, SQL_ATTR_ROWS_FETCHED_PTR, &row_count_param, 0 );
+  ret = SQLSetStmtAttr(stmt, SQL_ATTR_ROWS_FETCHED_PTR, &buffers.row_count, 0 );
   if (!SQL_SUCCEEDED(ret)) {
     throw std::runtime_error(
         extract_error("Error setting row count parameter in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
   }
 
-  ret = SQLSetStmtAttr(stmt, SQL_ATTR_ROW_STATUS_PTR, row_status.get(), 0);
+  ret = SQLSetStmtAttr(stmt, SQL_ATTR_ROW_STATUS_PTR, buffers.row_status.get(), 0);
   if (!SQL_SUCCEEDED(ret)) {
     throw std::runtime_error(
         extract_error("Error setting row status parameter in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
   }
 
-  result.col_desc = col_desc;
-  __bind_cols(stmt, col_desc, data, indicator, chunksize);
+  __bind_cols(stmt, col_desc, buffers.data, buffers.indicator, chunksize);
+}
 
-  while (SQL_SUCCEEDED(ret = SQLFetchScroll(stmt, SQL_FETCH_NEXT, 0))) {
-    // DB2 actually returns a 32-bit value in row_count_param
-    // so we have to cast it to SQLUINTEGER
-    row_count = (SQLUINTEGER) row_count_param;
-    for (j = 0; j < row_count; j++) {
-      if (row_status[j] != SQL_SUCCESS && row_status[j] != SQL_SUCCESS_WITH_INFO) {
-        throw std::runtime_error(
-            extract_error("Error " + std::to_string(row_status[j]) + " when reading row " + std::to_string(j)
-                          + " in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+static SQLUINTEGER __check_row_status(SQLHSTMT stmt, const fetch_buffers& buffers) {
+  // returns the number of rows in the last fetch, throwing if any of them could not be read
+  // DB2 actually returns a 32-bit value in row_count_param
+  // so we have to cast it to SQLUINTEGER
+  SQLUINTEGER row_count = (SQLUINTEGER) buffers.row_count;
+  for (SQLUINTEGER j = 0; j < row_count; j++) {
+    if (buffers.row_status[j] != SQL_SUCCESS && buffers.row_status[j] != SQL_SUCCESS_WITH_INFO) {
+      throw std::runtime_error(
+          extract_error("Error " + std::to_string(buffers.row_status[j]) + " when reading row " + std::to_string(j)
+                        + " in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+    }
+  }
+  return row_count;
+}
+
+static bool __get_lob(SQLHSTMT stmt, size_t col, bool binary, std::vector<char>& buffer, std::string& value) {
+  // reads the value of column col of the current row in pieces, growing buffer until the whole value fits.
+  // Text is read as UTF-16 and converted to UTF-8 once it is complete. Returns false if the value is NULL
+  SQLSMALLINT c_type = binary ? SQL_C_BINARY : SQL_C_WCHAR;
+  size_t terminator = binary ? 0 : sizeof(SQLWCHAR);
+  size_t length = 0;
+
+  if (buffer.size() < LOB_PIECE_SIZE) {
+    buffer.resize(LOB_PIECE_SIZE);
+  }
+
+  for (;;) {
+    SQLLEN indicator = 0;
+    SQLRETURN ret = SQLGetData(stmt, col + 1, c_type, &buffer[length], buffer.size() - length, &indicator);
+    if (ret == SQL_NO_DATA) {
+      break;   // the previous piece was the last one
+    }
+    if (!SQL_SUCCEEDED(ret)) {
+      throw std::runtime_error(extract_error("Error in SQLGetData in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+    }
+
+    // bytes left before this piece. The DB2 driver only writes 32 bits here
+    SQLINTEGER available = (SQLINTEGER) indicator;
+    if (available == SQL_NULL_DATA) {
+      return false;
+    }
+
+    size_t room = buffer.size() - length - terminator;
+    if (available != SQL_NO_TOTAL && (size_t) available <= room) {
+      length += available;
+      break;
+    }
+
+    // the piece filled the buffer. Make room for the rest, or double it if the driver cannot tell how much is left
+    size_t needed = (available == SQL_NO_TOTAL) ? 2 * buffer.size() : length + available + terminator;
+    length += room;
+    buffer.resize(std::max(needed, buffer.size() + 1));
+  }
+
+  value.clear();
+  if (binary) {
+    value.assign(buffer.data(), length);
+  } else {
+    const SQLWCHAR* text = (const SQLWCHAR*) buffer.data();
+    utf8::utf16to8(text, text + length / sizeof(SQLWCHAR), std::back_inserter(value));
+  }
+  return true;
+}
+
+static void __get_lob_values(SQLHSTMT stmt, const std::vector<column_desc>& col_desc, fetch_buffers& buffers,
+    SQLUINTEGER row_count) {
+  // reads the unbound LOB columns of the row that was just fetched (see __bind_fetch_buffers)
+  for (size_t k = 0; k < buffers.lob_cols.size() && row_count > 0; k++) {
+    size_t i = buffers.lob_cols[k];
+    INDIC_TYPE* indic = (INDIC_TYPE*) buffers.indicator[i].get();
+    std::string& value = buffers.lob_values[i][0];
+
+    if (__get_lob(stmt, i, is_binary_lob(col_desc[i]), buffers.lob_buffer, value)) {
+      indic[0] = (INDIC_TYPE) value.size();
+    } else {
+      indic[0] = SQL_NULL_DATA;
+      value.clear();
+    }
+  }
+}
+
+static size_t __rowset_bytes(const std::vector<column_desc>& col_desc, const fetch_buffers& buffers,
+    SQLUINTEGER row_count) {
+  // roughly how much memory the rows of the last fetch take once collected by __fetch_bound
+  size_t bytes = 0;
+  for (size_t i = 0; i < col_desc.size(); i++) {
+    if (is_lob(col_desc[i])) {
+      for (SQLUINTEGER j = 0; j < row_count; j++) {
+        bytes += sizeof(std::string) + buffers.lob_values[i][j].size();
       }
+      continue;
+    }
+    if (bound_field_width(col_desc[i]) == 0) {
+      bytes += row_count * sizeof(SQLDOUBLE);
+      continue;
     }
+    const INDIC_TYPE* indic = (const INDIC_TYPE*) buffers.indicator[i].get();
+    for (SQLUINTEGER j = 0; j < row_count; j++) {
+      bytes += sizeof(std::string) + ((indic[j] > 0) ? indic[j] / sizeof(SQLWCHAR) : 0);
+    }
+  }
+  return bytes;
+}
+
+static read_results __fetch_bound(SQLHSTMT stmt, const std::vector<column_desc>& col_desc, fetch_buffers& buffers,
+    const read_options& options = read_options()) {
+  // fetches every row of the open cursor into buffers that were bound by __bind_fetch_buffers
+  size_t i;
+  size_t j;
+  SQLRETURN ret;
+  INDIC_TYPE* indic;
+  short field_width;
+
+  size_t ncols = col_desc.size();
+
+  SQLUINTEGER row_count;
+  std::vector<std::unique_ptr<SQLLEN[]>>& indicator = buffers.indicator;
+  std::vector<std::shared_ptr<void>>& data = buffers.data;
+  struct read_results result(ncols);
+
+  result.col_desc = col_desc;
+
+  // rows go to column files once they no longer fit in the memory we were given
+  std::shared_ptr<spilled_result> spilled;
+  size_t collected_bytes = 0;
+  if (options.spill_threshold == 0) {
+    spilled = std::make_shared<spilled_result>(options.spill_dir, col_desc, options);
+  }
+
+  while (SQL_SUCCEEDED(ret = SQLFetchScroll(stmt, SQL_FETCH_NEXT, 0))) {
+    row_count = __check_row_status(stmt, buffers);
+    __get_lob_values(stmt, col_desc, buffers, row_count);
 
     checkInterrupt();
 
+    if (spilled) {
+      spilled->append_rowset(col_desc, buffers, row_count);
+      continue;
+    }
+
+    collected_bytes += __rowset_bytes(col_desc, buffers, row_count);
+    if (collected_bytes > options.spill_threshold) {
+      spilled = std::make_shared<spilled_result>(options.spill_dir, col_desc, options);
+      spilled->append_results(result);
+      spilled->append_rowset(col_desc, buffers, row_count);
+      result = read_results(ncols);
+      result.col_desc = col_desc;
+      continue;
+    }
+
   /* Loop through the ncols */
     for (i = 0; i < ncols; i++) {
       indic = (INDIC_TYPE*) indicator[i].get();
       switch (col_desc[i].type) {
       case SQL_CHAR:
       case SQL_VARCHAR:
-        field_width = col_desc[i].displaysize + 1;
-        process_string_col(result, row_count, i, field_width, data, col_desc, indic);
-        break;
       case SQL_DECIMAL:
       case SQL_NUMERIC:
-        field_width = col_desc[i].precision + 3;
-        process_string_col(result, row_count, i, field_width, data, col_desc, indic);
-        break;
       case SQL_DECFLOAT:
-        field_width = DECFLOAT_FIELD_WIDTH;
-        process_string_col(result, row_count, i, field_width, data, col_desc, indic);
-        break;
       case SQL_TYPE_DATE:
       case SQL_TYPE_TIME:
       case SQL_TYPE_TIMESTAMP:
-        field_width = (col_desc[i].displaysize > DATE_FIELD_MIN_LENGTH) ?
-                      col_desc[i].displaysize : DATE_FIELD_MIN_LENGTH;
-        process_string_col(result, row_count, i, field_width, data, col_desc, indic);
+        field_width = bound_field_width(col_desc[i]);
+        process_string_col(result, row_count, i, field_width, data, col_desc, indic, options.compact_strings);
         break;
       case SQL_INTEGER:
         result.stl_vecs[i].type = COLTYPE_INTEGER;
@@ -352,6 +679,16 @@ static read_results __fetch_data(SQLHSTMT stmt, const std::vector<column_desc>&
           }
         }
         break;
+      case SQL_BLOB:
+      case SQL_CLOB:
+      case SQL_DBCLOB:
+      case SQL_XML:
+      case SQL_LONGVARCHAR:
+      case SQL_WLONGVARCHAR:
+      case SQL_LONGVARBINARY:
+        __collect_lob_col(result, row_count, i, buffers, indic,
+            options.compact_strings || is_binary_lob(col_desc[i]));
+        break;
       default:
         result.stl_vecs[i].type = COLTYPE_STRING;
         for (j = 0; j < row_count; j++) {
@@ -367,12 +704,27 @@ static read_results __fetch_data(SQLHSTMT stmt, const std::vector<column_desc>&
         extract_error("Error in " + std::string(__func__) + " while reading", stmt, SQL_HANDLE_STMT));
   }
 
+  if (spilled) {
+    spilled->finish();
+    result.spilled = spilled;
+  }
+
   return result;
 }
 
-struct read_results execute_query(const SQLHDBC& dbc, const std::string& query, unsigned int chunksize) {
-  
-  struct odbc_stmt_handle stmt_holder;
+static read_results __fetch_data(SQLHSTMT stmt, const std::vector<column_desc>& col_desc, unsigned int chunksize,
+    const read_options& options) {
+  fetch_buffers buffers;
+
+  __bind_fetch_buffers(stmt, col_desc, buffers, chunksize);
+
+  return __fetch_bound(stmt, col_desc, buffers, options);
+}
+
+std::vector<column_desc> open_query(const SQLHDBC& dbc, struct odbc_stmt_handle& stmt_holder,
+    const std::string& query, unsigned int chunksize) {
+  // executes query on a new statement handle that fetches chunksize rows at a time and returns
+  // the description of its result columns
   SQLRETURN ret; /* ODBC API return status */
   SQLSMALLINT ncols = 0; /* number of columns in result-set */
 
@@ -399,13 +751,61 @@ struct read_results execute_query(const SQLHDBC& dbc, const std::string& query,
         extract_error("Error in SQLNumResultCols in " + std::string(__func__), stmt_holder.stmt, SQL_HANDLE_STMT));
   }
 
-  std::vector<column_desc> col_descs = __get_column_descs(stmt_holder.stmt, ncols);
+  return __get_column_descs(stmt_holder.stmt, ncols);
+}
+
+struct read_results execute_query(const SQLHDBC& dbc, const std::string& query, unsigned int chunksize,
+    const read_options& options) {
 
-  struct read_results results = __fetch_data(stmt_holder.stmt, col_descs, chunksize);
+  struct odbc_stmt_handle stmt_holder;
+
+  std::vector<column_desc> col_descs = open_query(dbc, stmt_holder, query, chunksize);
+
+  struct read_results results = __fetch_data(stmt_holder.stmt, col_descs, chunksize, options);
 
   return results;
 }
 
+std::vector<column_desc> describe_query(const SQLHDBC& dbc, const std::string& query) {
+  struct odbc_stmt_handle stmt_holder;
+
+  return open_query(dbc, stmt_holder, query, 1);
+}
+
+unsigned long stream_query(const SQLHDBC& dbc, const std::string& query, unsigned int chunksize,
+    const rowset_function& on_rowset) {
+
+  struct odbc_stmt_handle stmt_holder;
+  fetch_buffers buffers;
+  SQLRETURN ret;
+  unsigned long rows = 0;
+
+  std::vector<column_desc> col_descs = open_query(dbc, stmt_holder, query, chunksize);
+
+  __bind_fetch_buffers(stmt_holder.stmt, col_descs, buffers, chunksize);
+
+  // called once with no rows before the first fetch so that the caller can set up (eg. write a header)
+  // even if the result is empty
+  on_rowset(col_descs, buffers, 0);
+
+  while (SQL_SUCCEEDED(ret = SQLFetchScroll(stmt_holder.stmt, SQL_FETCH_NEXT, 0))) {
+    SQLUINTEGER row_count = __check_row_status(stmt_holder.stmt, buffers);
+    __get_lob_values(stmt_holder.stmt, col_descs, buffers, row_count);
+
+    checkInterrupt();
+
+    on_rowset(col_descs, buffers, row_count);
+    rows += row_count;
+  }
+
+  if (ret != SQL_NO_DATA) {
+    throw std::runtime_error(
+        extract_error("Error in " + std::string(__func__) + " while reading", stmt_holder.stmt, SQL_HANDLE_STMT));
+  }
+
+  return rows;
+}
+
 /***************************************************
  Functions to support dbWriteTable 
 ****************************************************/
@@ -477,19 +877,79 @@ static void __get_db_coltypes(const SQLHDBC& dbc, const std::string& tbl_name,
   }
 }
 
-static void __bind_params(const SQLHDBC& dbc, const SQLHSTMT& stmt, const std::string& tbl_name, data_arrays& data,
+indic_arrays alloc_indic_mem(const unsigned long nrows, const size_t& ncols) {
+  // allocate memory for null indicators
+
+  indic_arrays null_indicator(ncols);
+  size_t i;
+
+  for (i = 0; i < ncols; i++) {
+    std::unique_ptr<INDIC_TYPE[]> ptr(new INDIC_TYPE[nrows]);
+    null_indicator[i] = std::move(ptr);
+  }
+
+  return null_indicator;
+}
+
+data_arrays alloc_mem(const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
+    const unsigned long nrows) {
+
+  // allocate memory for data - the ODBC driver requires that data be stored in contiguous memory
+  // specifically for strings, ODBC driver requires that all strings be stored as constant width
+  // so we need to allocate a contiguous 2-D array of strings where every string occupies as much memory
+  // as the longest string in that column!
+
+  size_t i;
+  size_t ncols = coltypes.size();
+  data_arrays data(ncols);
+
+  for (i = 0; i < ncols; i++) {
+    if (coltypes[i] == COLTYPE_STRING) {
+      SQLWCHAR* char_data = new SQLWCHAR[nrows * (varchar_col_lengths[i] + 1)];
+      std::shared_ptr<SQLWCHAR> ptr(char_data, std::default_delete<SQLWCHAR[]>());
+      colData cd(ptr);
+      data[i] = std::move(cd);
+    } else if (coltypes[i] == COLTYPE_INTEGER) {
+      std::shared_ptr < SQLBIGINT > ptr(new SQLBIGINT[nrows], std::default_delete<SQLBIGINT[]>());
+      colData cd(ptr);
+      data[i] = std::move(cd);
+    } else if (coltypes[i] == COLTYPE_NUMERIC) {
+      std::shared_ptr < SQLDOUBLE > ptr(new SQLDOUBLE[nrows], std::default_delete<SQLDOUBLE[]>());
+      colData cd(ptr);
+      data[i] = std::move(cd);
+    }
+  }
+
+  return data;
+}
+
+unsigned long rows_within_budget(const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
+    unsigned long max_rows, size_t budget) {
+  size_t row_bytes = 0;
+
+  for (size_t i = 0; i < coltypes.size(); i++) {
+    if (coltypes[i] == COLTYPE_STRING) {
+      row_bytes += sizeof(SQLWCHAR) * (varchar_col_lengths[i] + 1);
+    } else if (coltypes[i] == COLTYPE_INTEGER) {
+      row_bytes += sizeof(SQLBIGINT);
+    } else {
+      row_bytes += sizeof(SQLDOUBLE);
+    }
+    row_bytes += sizeof(INDIC_TYPE);
+  }
+
+  unsigned long rows = (unsigned long) (budget / std::max<size_t>(row_bytes, 1));
+  return std::max(std::min(rows, max_rows), 1UL);
+}
+
+static void __bind_params(const SQLHSTMT& stmt, const column_desc* col_desc, data_arrays& data,
     indic_arrays& null_indicator, const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths) {
 
   size_t i;
   size_t ncols = coltypes.size();
   std::string error = "";
-  std::unique_ptr<column_desc[]> col_desc(new column_desc[ncols]);
-
-  __get_db_coltypes(dbc, tbl_name, col_desc, ncols);
 
   for (i = 0; i < ncols; i++) {
-    checkInterrupt();
-
     if (coltypes[i] == 0) {
       if (!SQL_SUCCEEDED(
           SQLBindParameter(stmt, i + 1, SQL_PARAM_INPUT, SQL_C_WCHAR, col_desc[i].type, col_desc[i].precision,
@@ -515,11 +975,27 @@ static void __bind_params(const SQLHDBC& dbc, const SQLHSTMT& stmt, const std::s
   }
 }
 
-static void __set_stmt_attributes(SQLHSTMT stmt, unsigned long nrows) {
-  // TODO: add param status array. See https://msdn.microsoft.com/en-us/library/ms711818%28v=vs.85%29.aspx
+static void __set_stmt_attributes(SQLHSTMT stmt, unsigned long nrows, SQLUSMALLINT* param_status = NULL,
+    SQLULEN* params_processed = NULL) {
+  // param_status and params_processed are optional and receive the per row status of the array insert.
+  // See https://msdn.microsoft.com/en-us/library/ms711818%28v=vs.85%29.aspx
   SQLRETURN ret; /* ODBC API return status */
   std::string error = "";
 
+  if (param_status != NULL) {
+    if (!SQL_SUCCEEDED(ret = SQLSetStmtAttr(stmt, SQL_ATTR_PARAM_STATUS_PTR, param_status, 0))) {
+      error = extract_error("Error while setting param status array", stmt, SQL_HANDLE_STMT);
+      throw std::runtime_error(error);
+    }
+  }
+
+  if (params_processed != NULL) {
+    if (!SQL_SUCCEEDED(ret = SQLSetStmtAttr(stmt, SQL_ATTR_PARAMS_PROCESSED_PTR, params_processed, 0))) {
+      error = extract_error("Error while setting params processed pointer", stmt, SQL_HANDLE_STMT);
+      throw std::runtime_error(error);
+    }
+  }
+
   if (!SQL_SUCCEEDED(ret = SQLSetStmtAttr(stmt, SQL_ATTR_PARAM_BIND_TYPE, SQL_PARAM_BIND_BY_COLUMN, 0))) {
     error = extract_error("Error while setting up parameter binding", stmt, SQL_HANDLE_STMT);
     throw std::runtime_error(error);
@@ -531,60 +1007,967 @@ static void __set_stmt_attributes(SQLHSTMT stmt, unsigned long nrows) {
   }
 }
 
-void write_table(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL, data_arrays& data,
-    indic_arrays& null_indicator, const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
-    unsigned long nrows) {
-
-  SQLRETURN ret; /* ODBC API return status */
+static void __prepare_insert(const SQLHDBC& dbc, struct odbc_stmt_handle& stmt_holder, const std::string& insert_SQL) {
   std::string error = "";
-  struct odbc_stmt_handle stmt_holder;
-
-  SQLINTEGER autocommit;
-
-  if (!SQL_SUCCEEDED(ret = SQLGetConnectAttr(dbc, SQL_AUTOCOMMIT, &autocommit, 0, NULL))) {
-    throw std::runtime_error(extract_error("Error retrieving autocommit parameter", dbc, SQL_HANDLE_DBC));
-  }
-
-  // set autocommit to false
-  if (!SQL_SUCCEEDED(ret = SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER) SQL_AUTOCOMMIT_OFF, 0))) {
-    throw std::runtime_error(extract_error("Error turning autocommit off", dbc, SQL_HANDLE_DBC));
-  }
 
-  /* Allocate a statement handle */
-  if (!SQL_SUCCEEDED(ret = SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt_holder.stmt))) {
+  /* Allocate a statement handle unless the caller already did to set attributes that must precede the prepare */
+  if (stmt_holder.stmt == NULL && !SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt_holder.stmt))) {
     error = extract_error("Error while allocating statement handle", dbc, SQL_HANDLE_DBC);
     throw std::runtime_error(error);
   }
 
-  if (!SQL_SUCCEEDED(ret = SQLPrepareW(stmt_holder.stmt, get_UTF16_string(insert_SQL).get(), SQL_NTS))) {
+  if (!SQL_SUCCEEDED(SQLPrepareW(stmt_holder.stmt, get_UTF16_string(insert_SQL).get(), SQL_NTS))) {
     error = extract_error("Error while preparing statement ", dbc, SQL_HANDLE_DBC);
     throw std::runtime_error(error);
   }
+}
+
+static std::string __rollback(const SQLHDBC& dbc, const std::string& error) {
+  // rolls back the open transaction and returns error with any rollback failure appended
+  if (!SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK))) {
+    return error + " " + extract_error("Error in SQLExecute in dbWriteTableInternal - "
+        "could not rollback. Table may be in corrupted state.", dbc, SQL_HANDLE_DBC);
+  }
+  return error;
+}
 
-  __set_stmt_attributes(stmt_holder.stmt, nrows);
+static void __commit(const SQLHDBC& dbc) {
+  if (!SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_COMMIT))) {
+    throw std::runtime_error(
+        extract_error("Error in SQLExecute in dbWriteTable - could not commit transaction.", dbc, SQL_HANDLE_DBC).c_str());
+  }
+}
+
+static void __execute_insert(const SQLHDBC& dbc, const SQLHSTMT& stmt) {
+  // executes the bound insert, rolling back the open transaction if the insert fails
+
+  if (!SQL_SUCCEEDED(SQLExecute(stmt))) {
+    throw std::runtime_error(
+        __rollback(dbc, extract_error("Error in SQLExecute in dbWriteTableInternal", stmt, SQL_HANDLE_STMT)));
+  }
+}
 
-  __bind_params(dbc, stmt_holder.stmt, tbl_name, data, null_indicator, coltypes, varchar_col_lengths);
+static void __collect_row_diagnostics(const SQLHSTMT& stmt, std::vector<row_error>& rejected, size_t first_rejected,
+    const unsigned long first_row) {
+  // matches the diagnostic records of the last execute to the rejected rows using SQL_DIAG_ROW_NUMBER
+  SQLSMALLINT i = 0;
+  SQLINTEGER native = 0;
+  SQLCHAR state[7] = "";
+  SQLCHAR text[512] = "";
+  SQLSMALLINT len = 0;
+  SQLLEN row_number;
+
+  while (SQL_SUCCEEDED(SQLGetDiagRec(SQL_HANDLE_STMT, stmt, ++i, state, &native, text, sizeof(text), &len))) {
+    row_number = 0;  // the DB2 driver only writes 32 bits here
+    if (!SQL_SUCCEEDED(SQLGetDiagField(SQL_HANDLE_STMT, stmt, i, SQL_DIAG_ROW_NUMBER, &row_number, SQL_IS_INTEGER, NULL))
+        || row_number <= 0) {
+      continue;
+    }
 
-  if (!SQL_SUCCEEDED(SQLExecute(stmt_holder.stmt))) {
-    error = extract_error("Error in SQLExecute in dbWriteTableInternal", stmt_holder.stmt, SQL_HANDLE_STMT);
-    if (!SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK))) {
-      error = error + " " + extract_error("Error in SQLExecute in dbWriteTableInternal - "
-          "could not rollback. Table may be in corrupted state.", dbc, SQL_HANDLE_DBC);
+    for (size_t k = first_rejected; k < rejected.size(); k++) {
+      if (rejected[k].row == first_row + row_number - 1 && rejected[k].sqlstate.empty()) {
+        rejected[k].sqlstate = (const char*) state;
+        rejected[k].native_error = native;
+        rejected[k].message = (const char*) text;
+        break;
+      }
     }
-    throw std::runtime_error(error);
   }
+}
 
-  if (!SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_COMMIT))) {
+static unsigned long __execute_insert_rows(const SQLHDBC& dbc, const SQLHSTMT& stmt, const SQLUSMALLINT* param_status,
+    SQLULEN& params_processed, const unsigned long first_row, const unsigned long nrows, const int on_error,
+    std::vector<row_error>& rejected) {
+  /* executes the bound insert without stopping at failing rows. The rows that failed are added to rejected
+   * and the number of rows that were inserted is returned. If the statement failed as a whole (eg. the table
+   * does not exist) rather than for individual rows, the transaction is rolled back and the error is thrown
+   */
+  unsigned long j;
+  size_t first_rejected = rejected.size();
+
+  params_processed = 0;
+  SQLRETURN ret = SQLExecute(stmt);
+
+  if (ret == SQL_SUCCESS) {
+    return nrows;
+  }
+
+  bool row_errors = false;
+  for (j = 0; j < (unsigned long) params_processed && j < nrows; j++) {
+    row_errors = row_errors || (param_status[j] == SQL_PARAM_ERROR);
+  }
+
+  if (!SQL_SUCCEEDED(ret) && !row_errors) {
     throw std::runtime_error(
-        extract_error("Error in SQLExecute in dbWriteTable - could not commit transaction.", dbc, SQL_HANDLE_DBC).c_str());
+        __rollback(dbc, extract_error("Error in SQLExecute in dbWriteTableInternal", stmt, SQL_HANDLE_STMT)));
   }
 
-  // reset autocommit to original value
-  if (!SQL_SUCCEEDED(ret = SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER) (long) autocommit, 0))) {
-    throw std::runtime_error(extract_error("Error restoring autocommit parameter", dbc, SQL_HANDLE_DBC));
+  // rows after params_processed were never attempted so they are rejected too
+  for (j = 0; j < nrows; j++) {
+    if (j >= (unsigned long) params_processed || param_status[j] == SQL_PARAM_ERROR
+        || param_status[j] == SQL_PARAM_UNUSED) {
+      rejected.push_back(row_error(first_row + j));
+    }
+  }
+
+  if (on_error == WRITE_ON_ERROR_COLLECT) {
+    __collect_row_diagnostics(stmt, rejected, first_rejected, first_row);
   }
-    	
+
+  return nrows - (rejected.size() - first_rejected);
 }
 
-} // namespace
+static bool __activate_not_logged(const SQLHDBC& dbc, struct odbc_stmt_handle& alter_stmt, const std::string& tbl_name) {
+  // turns off logging for the rest of the current transaction. Returns false if DB2 refused,
+  // eg. because the table was not created with NOT LOGGED INITIALLY, in which case the inserts are logged as usual
+  std::string alter_SQL = "ALTER TABLE " + tbl_name + " ACTIVATE NOT LOGGED INITIALLY";
+
+  if (alter_stmt.stmt == NULL && !SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &alter_stmt.stmt))) {
+    throw std::runtime_error(extract_error("Error while allocating statement handle", dbc, SQL_HANDLE_DBC));
+  }
 
+  return SQL_SUCCEEDED(SQLExecDirectW(alter_stmt.stmt, get_UTF16_string(alter_SQL).get(), SQL_NTS));
+}
+
+struct load_info {
+  // buffers handed to the driver with SQL_ATTR_LOAD_INFO. They must stay put until the load is finished
+#ifdef RDB2_HAVE_DB2API
+  struct db2LoadStruct load;
+  struct db2LoadIn load_in;
+#endif
+  std::string message_file;
+
+  ~load_info() {
+    if (!message_file.empty()) {
+      unlink(message_file.c_str());
+    }
+  }
+};
+
+static void __append_diagnostics(SQLHANDLE handle, SQLSMALLINT type, std::vector<std::string>& messages) {
+  // appends the diagnostic records of the last call on handle, one message per record
+  SQLSMALLINT i = 0;
+  SQLINTEGER native = 0;
+  SQLCHAR state[7] = "";
+  SQLCHAR text[1024] = "";
+  SQLSMALLINT len = 0;
+
+  while (SQL_SUCCEEDED(SQLGetDiagRec(type, handle, ++i, state, &native, text, sizeof(text), &len))) {
+    messages.push_back(std::string((const char*) state) + ":" + std::to_string(native) + ":" + (const char*) text);
+  }
+}
+
+static bool __enable_load(const stmt_attr_setter& set_attr, const write_options& options, write_stats& stats,
+    load_info& info) {
+  // switches the statement to the LOAD utility. Must be called before the insert is prepared.
+  // Returns false, leaving the statement as a plain insert, if the driver does not support it. The attributes
+  // are set through set_attr so that the sequence can be checked without a driver (see trace_load_attributes)
+  if (!SQL_SUCCEEDED(set_attr(SQL_ATTR_USE_LOAD_API, (SQLPOINTER)(SQLLEN) options.load_mode))) {
+    return false;
+  }
+
+#ifdef RDB2_HAVE_DB2API
+  memset(&info.load, 0, sizeof(info.load));
+  memset(&info.load_in, 0, sizeof(info.load_in));
+  info.load.piLoadInfoIn = &info.load_in;
+  info.load_in.iWarningcount = options.load_warning_limit;
+
+  if (options.load_messages) {
+    char message_file[] = "/tmp/rdb2_loadXXXXXX";
+    int fd = mkstemp(message_file);
+    if (fd >= 0) {
+      close(fd);
+      info.message_file = message_file;
+      info.load.piLocalMsgFileName = &info.message_file[0];
+    }
+  }
+
+  if (!SQL_SUCCEEDED(set_attr(SQL_ATTR_LOAD_INFO, &info.load))) {
+    set_attr(SQL_ATTR_USE_LOAD_API, (SQLPOINTER) SQL_USE_LOAD_OFF);
+    return false;
+  }
+#endif
+
+  // the counters are only filled in when the load is finished. Older drivers write 32 bit values
+  // but the counters start at 0 so either way they read back correctly
+  set_attr(SQL_ATTR_LOAD_ROWS_READ_PTR, &stats.load_rows_read);
+  set_attr(SQL_ATTR_LOAD_ROWS_SKIPPED_PTR, &stats.load_rows_skipped);
+  set_attr(SQL_ATTR_LOAD_ROWS_LOADED_PTR, &stats.load_rows_loaded);
+  set_attr(SQL_ATTR_LOAD_ROWS_REJECTED_PTR, &stats.load_rows_rejected);
+  set_attr(SQL_ATTR_LOAD_ROWS_DELETED_PTR, &stats.load_rows_deleted);
+  set_attr(SQL_ATTR_LOAD_ROWS_COMMITTED_PTR, &stats.load_rows_committed);
+
+  return true;
+}
+
+bool trace_load_attributes(const write_options& options, SQLINTEGER failing_attribute,
+    std::vector<std::pair<SQLINTEGER, SQLLEN>>& calls) {
+  write_stats stats;
+  load_info info;
+
+  stmt_attr_setter record = [&](SQLINTEGER attribute, SQLPOINTER value) {
+    // only the value of SQL_ATTR_USE_LOAD_API is a number, the others are pointers
+    calls.push_back(std::make_pair(attribute, attribute == SQL_ATTR_USE_LOAD_API ? (SQLLEN) value : 0));
+    return attribute == failing_attribute ? (SQLRETURN) SQL_ERROR : (SQLRETURN) SQL_SUCCESS;
+  };
+
+  return __enable_load(record, options, stats, info);
+}
+
+static void __finish_load(const SQLHSTMT& stmt, const write_options& options, write_stats& stats,
+    const load_info& info) {
+  // turning the load attribute off ends the load and commits the loaded rows
+  SQLRETURN ret = SQLSetStmtAttr(stmt, SQL_ATTR_USE_LOAD_API, (SQLPOINTER) SQL_USE_LOAD_OFF, 0);
+
+  if (options.load_messages) {
+    __append_diagnostics(stmt, SQL_HANDLE_STMT, stats.load_messages);
+
+    std::ifstream messages(info.message_file.c_str());
+    std::string line;
+    while (!info.message_file.empty() && std::getline(messages, line)) {
+      if (!line.empty()) {
+        stats.load_messages.push_back(line);
+      }
+    }
+  }
+
+  if (!SQL_SUCCEEDED(ret)) {
+    throw std::runtime_error(extract_error("Error while finishing load in dbWriteTableInternal", stmt, SQL_HANDLE_STMT));
+  }
+
+  stats.rows = stats.load_rows_loaded;
+}
+
+static double __seconds_since(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void write_table(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL, data_arrays& data,
+    indic_arrays& null_indicator, const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
+    unsigned long nrows) {
+
+  struct odbc_stmt_handle stmt_holder;
+  size_t ncols = coltypes.size();
+  std::unique_ptr<column_desc[]> col_desc(new column_desc[ncols]);
+
+  // set autocommit to false. The original value is restored when we return
+  autocommit_guard autocommit(dbc, SQL_AUTOCOMMIT_OFF);
+
+  __prepare_insert(dbc, stmt_holder, insert_SQL);
+
+  __set_stmt_attributes(stmt_holder.stmt, nrows);
+
+  __get_db_coltypes(dbc, tbl_name, col_desc, ncols);
+
+  __bind_params(stmt_holder.stmt, col_desc.get(), data, null_indicator, coltypes, varchar_col_lengths);
+
+  __execute_insert(dbc, stmt_holder.stmt);
+
+  __commit(dbc);
+
+  // reset autocommit to original value
+  autocommit.restore();
+}
+
+write_stats write_table_chunked(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL,
+    const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths, unsigned long nrows,
+    const fill_function& fill, const write_options& options) {
+  // Writes nrows rows by handing out consecutive ranges of rows to fill
+  unsigned long next_row = 0;
+
+  chunk_source next_chunk = [&](data_arrays& data, indic_arrays& null_indicator, unsigned long max_rows) {
+    unsigned long count = std::min(max_rows, nrows - next_row);
+    if (count > 0) {
+      fill(data, null_indicator, next_row, count);
+    }
+    next_row += count;
+    return count;
+  };
+
+  return write_table_streamed(dbc, tbl_name, insert_SQL, coltypes, varchar_col_lengths, next_chunk, options, nrows);
+}
+
+write_stats write_table_streamed(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL,
+    const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths, const chunk_source& next_chunk,
+    const write_options& options, unsigned long max_rows, const std::vector<column_desc>& param_descs) {
+  /* Writes the rows produced by next_chunk in chunks of up to options.chunksize rows, committing after every
+   * options.commit_every chunks. next_chunk is called to encode each chunk into the parameter buffers until it
+   * returns 0. When options.pipelined is set, two sets of buffers are used and the next chunk is encoded on a
+   * worker thread while the current chunk is executing on the server. The buffer sets are swapped by
+   * rebinding the parameters.
+   */
+
+  write_stats stats;
+  struct odbc_stmt_handle stmt_holder;
+  struct odbc_stmt_handle alter_stmt;
+  size_t ncols = coltypes.size();
+  std::unique_ptr<column_desc[]> col_desc(new column_desc[ncols]);
+  bool transaction_open = false;
+  load_info load;
+
+  unsigned long chunksize = std::min(std::max(options.chunksize, 1UL), std::max(max_rows, 1UL));
+  unsigned long buffer_rows = chunksize;
+  size_t nbuffers = options.pipelined ? 2 : 1;
+  size_t i;
+
+  std::vector<data_arrays> data(nbuffers);
+  std::vector<indic_arrays> null_indicator(nbuffers);
+
+  bool row_status = (options.on_error != WRITE_ON_ERROR_ABORT);
+  // rows rejected with skip or collect could roll back a not logged unit of work and lose the table
+  bool not_logged = options.not_logged && !row_status;
+  std::unique_ptr<SQLUSMALLINT[]> param_status(row_status ? new SQLUSMALLINT[buffer_rows] : NULL);
+  SQLULEN params_processed = 0;
+  for (i = 0; i < nbuffers; i++) {
+    null_indicator[i] = alloc_indic_mem(buffer_rows, ncols);
+    data[i] = alloc_mem(coltypes, varchar_col_lengths, buffer_rows);
+  }
+
+  // declared after the buffers so that if we bail out early, the destructor waits for the
+  // worker thread to finish with the buffers before they are freed
+  std::future<unsigned long> next_fill;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  unsigned long count = next_chunk(data[0], null_indicator[0], chunksize);
+  stats.fill_seconds += __seconds_since(start);
+
+  if (count == 0) {
+    return stats;
+  }
+
+  if (options.method == WRITE_METHOD_LOAD && !row_status) {
+    if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt_holder.stmt))) {
+      throw std::runtime_error(extract_error("Error while allocating statement handle", dbc, SQL_HANDLE_DBC));
+    }
+    SQLHSTMT stmt = stmt_holder.stmt;
+    stmt_attr_setter set_attr = [stmt](SQLINTEGER attribute, SQLPOINTER value) {
+      return SQLSetStmtAttr(stmt, attribute, value, 0);
+    };
+    stats.load_used = __enable_load(set_attr, options, stats, load);
+  }
+
+  // LOAD commits as it goes, so it runs with autocommit on. Inserts are committed by us
+  autocommit_guard autocommit(dbc, stats.load_used ? SQL_AUTOCOMMIT_ON : SQL_AUTOCOMMIT_OFF);
+
+  if (stats.load_used) {
+    try {
+      __prepare_insert(dbc, stmt_holder, insert_SQL);
+    } catch (const std::runtime_error&) {
+      // some tables (eg. declared temporary tables) cannot be loaded. Go back to plain inserts
+      SQLSetStmtAttr(stmt_holder.stmt, SQL_ATTR_USE_LOAD_API, (SQLPOINTER) SQL_USE_LOAD_OFF, 0);
+      stats.load_used = false;
+      autocommit.set(SQL_AUTOCOMMIT_OFF);
+    }
+  }
+
+  if (!stats.load_used) {
+    __prepare_insert(dbc, stmt_holder, insert_SQL);
+  }
+
+  if (param_descs.empty()) {
+    __get_db_coltypes(dbc, tbl_name, col_desc, ncols);
+  } else if (param_descs.size() != ncols) {
+    throw std::runtime_error("Expected " + std::to_string(ncols) + " column descriptions for " + tbl_name + " but got "
+        + std::to_string(param_descs.size()));
+  } else {
+    // only the type, and the precision and scale of decimals, are used to bind, as from __get_db_coltypes
+    for (i = 0; i < ncols; i++) {
+      col_desc[i] = param_descs[i];
+      if (col_desc[i].type != SQL_DECIMAL && col_desc[i].type != SQL_NUMERIC && col_desc[i].type != SQL_DECFLOAT) {
+        col_desc[i].precision = 0;
+        col_desc[i].scale = 0;
+      }
+    }
+  }
+
+  if (row_status) {
+    // ask DB2 to carry on past failing rows. Other drivers do this by default so failure is ignored
+    SQLSetStmtAttr(stmt_holder.stmt, SQL_ATTR_PARAMOPT_ATOMIC, (SQLPOINTER) SQL_ATOMIC_NO, 0);
+  }
+
+  unsigned long first_row = 0;
+  size_t current = 0;
+
+  // anything that goes wrong from here on (including an interrupt or an error from the worker)
+  // rolls back the uncommitted chunks before it is passed on
+  try {
+    while (count > 0) {
+
+      __set_stmt_attributes(stmt_holder.stmt, count, param_status.get(), row_status ? &params_processed : NULL);
+      __bind_params(stmt_holder.stmt, col_desc.get(), data[current], null_indicator[current], coltypes,
+          varchar_col_lengths);
+
+      size_t next = (current + 1) % nbuffers;
+      if (options.pipelined) {
+        next_fill = std::async(std::launch::async, next_chunk, std::ref(data[next]), std::ref(null_indicator[next]),
+            chunksize);
+      }
+
+      start = std::chrono::steady_clock::now();
+      if (!transaction_open && !stats.load_used) {
+        // autocommit is off so the transaction starts implicitly with the first statement
+        transaction_open = true;
+        stats.transactions++;
+        if (not_logged && __activate_not_logged(dbc, alter_stmt, tbl_name)) {
+          stats.not_logged_transactions++;
+        }
+      }
+
+      if (row_status) {
+        stats.rows += __execute_insert_rows(dbc, stmt_holder.stmt, param_status.get(), params_processed, first_row,
+            count, options.on_error, stats.rejected);
+      } else {
+        __execute_insert(dbc, stmt_holder.stmt);
+        stats.rows += count;
+        if (stats.load_used && options.load_messages) {
+          __append_diagnostics(stmt_holder.stmt, SQL_HANDLE_STMT, stats.load_messages);
+        }
+      }
+      if (!stats.load_used && options.commit_every > 0 && (stats.chunks + 1) % options.commit_every == 0) {
+        __commit(dbc);
+        transaction_open = false;
+        stats.commits++;
+      }
+      stats.execute_seconds += __seconds_since(start);
+
+      stats.chunks++;
+
+      checkInterrupt();
+      if (options.progress) {
+        options.progress(stats.rows);
+      }
+
+      // with pipelining this is just the time we had to wait for the worker to catch up
+      start = std::chrono::steady_clock::now();
+      unsigned long next_count;
+      if (options.pipelined) {
+        next_count = next_fill.get();  // rethrows any error from the worker
+      } else {
+        next_count = next_chunk(data[next], null_indicator[next], chunksize);
+      }
+      stats.fill_seconds += __seconds_since(start);
+
+      first_row += count;
+      count = next_count;
+      current = next;
+    }
+  } catch (...) {
+    if (stats.load_used) {
+      // ends the load. Rows loaded so far stay in the table since LOAD cannot be rolled back
+      SQLSetStmtAttr(stmt_holder.stmt, SQL_ATTR_USE_LOAD_API, (SQLPOINTER) SQL_USE_LOAD_OFF, 0);
+    }
+    __rollback(dbc, "");
+    throw;
+  }
+
+  if (stats.load_used) {
+    __finish_load(stmt_holder.stmt, options, stats, load);
+  }
+
+  if (options.commit_every > 0 && transaction_open) {
+    __commit(dbc);
+    stats.commits++;
+  }
+
+  autocommit.restore();
+
+  return stats;
+}
+
+static void __describe_params(const SQLHSTMT& stmt, column_desc* col_desc, const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths) {
+  // gets the SQL type of each parameter marker so that the parameters can be bound like the columns of a table
+  SQLSMALLINT nparams = 0;
+  size_t i;
+
+  if (!SQL_SUCCEEDED(SQLNumParams(stmt, &nparams))) {
+    throw std::runtime_error(extract_error("Error in SQLNumParams in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+  }
+
+  if ((size_t) nparams != coltypes.size()) {
+    throw std::runtime_error("Statement has " + std::to_string(nparams) + " parameter markers but "
+        + std::to_string(coltypes.size()) + " parameter columns were given");
+  }
+
+  for (i = 0; i < coltypes.size(); i++) {
+    SQLSMALLINT type = 0;
+    SQLULEN size = 0;  // the DB2 driver only writes 32 bits here
+    SQLSMALLINT digits = 0;
+    SQLSMALLINT nullable = 0;
+
+    if (SQL_SUCCEEDED(SQLDescribeParam(stmt, i + 1, &type, &size, &digits, &nullable))) {
+      col_desc[i].type = type;
+      col_desc[i].precision = size;
+      col_desc[i].scale = digits;
+    } else if (coltypes[i] == COLTYPE_STRING) {
+      // the driver could not describe the marker so send it as the type of the R column
+      col_desc[i].type = SQL_WVARCHAR;
+      col_desc[i].precision = std::max(varchar_col_lengths[i], 1);
+      col_desc[i].scale = 0;
+    } else {
+      col_desc[i].type = (coltypes[i] == COLTYPE_INTEGER) ? SQL_BIGINT : SQL_DOUBLE;
+      col_desc[i].precision = 0;
+      col_desc[i].scale = 0;
+    }
+  }
+}
+
+static void __get_row_counts(const SQLHDBC& dbc, const SQLHSTMT& stmt, SQLRETURN ret, const unsigned long nrows,
+    params_stats& stats) {
+  /* adds the rows affected by the last execute to stats. When the driver reports a count for each parameter
+   * row (SQL_PARC_BATCH), the counts are returned as one result per row and read with SQLMoreResults.
+   * Otherwise there is a single count for the whole array
+   */
+  SQLLEN count;
+  unsigned long j;
+
+  if (!stats.per_row) {
+    count = 0;  // the DB2 driver only writes 32 bits here
+    if (ret != SQL_NO_DATA && !SQL_SUCCEEDED(SQLRowCount(stmt, &count))) {
+      throw std::runtime_error(__rollback(dbc, extract_error("Error in SQLRowCount", stmt, SQL_HANDLE_STMT)));
+    }
+    stats.total += std::max(count, (SQLLEN) 0);
+    return;
+  }
+
+  for (j = 0; j < nrows; j++) {
+    count = 0;
+    if (ret != SQL_NO_DATA && !SQL_SUCCEEDED(SQLRowCount(stmt, &count))) {
+      throw std::runtime_error(__rollback(dbc, extract_error("Error in SQLRowCount", stmt, SQL_HANDLE_STMT)));
+    }
+    count = std::max(count, (SQLLEN) 0);
+    stats.row_counts.push_back(count);
+    stats.total += count;
+
+    if (j + 1 < nrows && ret != SQL_NO_DATA) {
+      ret = SQLMoreResults(stmt);
+      if (!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+        throw std::runtime_error(__rollback(dbc, extract_error("Error in SQLMoreResults", stmt, SQL_HANDLE_STMT)));
+      }
+    }
+  }
+
+  SQLFreeStmt(stmt, SQL_CLOSE);
+}
+
+params_stats execute_params(const SQLHDBC& dbc, const std::string& sql, const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths, unsigned long nrows, const fill_function& fill,
+    const write_options& options) {
+
+  params_stats stats;
+  struct odbc_stmt_handle stmt_holder;
+  size_t ncols = coltypes.size();
+  std::unique_ptr<column_desc[]> col_desc(new column_desc[ncols]);
+  SQLUINTEGER row_counts = SQL_PARC_NO_BATCH;
+
+  unsigned long chunksize = std::max(options.chunksize, 1UL);
+  unsigned long buffer_rows = std::min(chunksize, nrows);
+
+  indic_arrays null_indicator = alloc_indic_mem(buffer_rows, ncols);
+  data_arrays data = alloc_mem(coltypes, varchar_col_lengths, buffer_rows);
+
+  if (nrows == 0) {
+    return stats;
+  }
+
+  autocommit_guard autocommit(dbc, SQL_AUTOCOMMIT_OFF);
+
+  __prepare_insert(dbc, stmt_holder, sql);
+
+  __describe_params(stmt_holder.stmt, col_desc.get(), coltypes, varchar_col_lengths);
+
+  SQLGetInfo(dbc, SQL_PARAM_ARRAY_ROW_COUNTS, &row_counts, sizeof(row_counts), NULL);
+  stats.per_row = (row_counts == SQL_PARC_BATCH);
+
+  unsigned long first_row = 0;
+  bool transaction_open = false;
+
+  try {
+    while (first_row < nrows) {
+      unsigned long count = std::min(chunksize, nrows - first_row);
+
+      fill(data, null_indicator, first_row, count);
+
+      __set_stmt_attributes(stmt_holder.stmt, count);
+      __bind_params(stmt_holder.stmt, col_desc.get(), data, null_indicator, coltypes, varchar_col_lengths);
+
+      transaction_open = true;
+
+      // SQL_NO_DATA just means that no rows were affected (eg. an UPDATE whose keys were not found)
+      SQLRETURN ret = SQLExecute(stmt_holder.stmt);
+      if (!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+        throw std::runtime_error(
+            __rollback(dbc, extract_error("Error in SQLExecute in execute_params", stmt_holder.stmt, SQL_HANDLE_STMT)));
+      }
+
+      __get_row_counts(dbc, stmt_holder.stmt, ret, count, stats);
+
+      stats.chunks++;
+      stats.rows += count;
+
+      if (options.commit_every > 0 && stats.chunks % options.commit_every == 0) {
+        __commit(dbc);
+        transaction_open = false;
+      }
+
+      checkInterrupt();
+      if (options.progress) {
+        options.progress(stats.rows);
+      }
+
+      first_row += count;
+    }
+  } catch (...) {
+    __rollback(dbc, "");
+    throw;
+  }
+
+  if (transaction_open) {
+    __commit(dbc);
+  }
+
+  autocommit.restore();
+
+  return stats;
+}
+
+/***************************************************
+ Prepared statements
+****************************************************/
+
+prepared_statement::prepared_statement(const SQLHDBC& connection, const std::string& statement_SQL,
+    unsigned int rows_per_fetch) :
+    dbc(connection), sql(statement_SQL), stmt(NULL), chunksize(std::max(rows_per_fetch, 1u)), nparams(0),
+    nexecutions(0), param_rows(0) {
+
+  struct odbc_stmt_handle stmt_holder;
+  SQLSMALLINT count = 0;
+
+  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt_holder.stmt))) {
+    throw std::runtime_error(extract_error("Error while allocating statement handle", dbc, SQL_HANDLE_DBC));
+  }
+
+  if (!SQL_SUCCEEDED(
+      SQLSetStmtAttr(stmt_holder.stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER) (long) chunksize, SQL_IS_INTEGER))) {
+    throw std::runtime_error(extract_error("Error in SQLSetStmtAttr in prepared_statement", stmt_holder.stmt,
+        SQL_HANDLE_STMT));
+  }
+
+  if (!SQL_SUCCEEDED(SQLPrepareW(stmt_holder.stmt, get_UTF16_string(sql).get(), SQL_NTS))) {
+    throw std::runtime_error(extract_error("Error while preparing statement", stmt_holder.stmt, SQL_HANDLE_STMT));
+  }
+
+  if (!SQL_SUCCEEDED(SQLNumParams(stmt_holder.stmt, &count))) {
+    throw std::runtime_error(extract_error("Error in SQLNumParams in prepared_statement", stmt_holder.stmt,
+        SQL_HANDLE_STMT));
+  }
+  nparams = count;
+
+  // the result set is described and bound once, here, instead of on every execution
+  count = 0;
+  if (!SQL_SUCCEEDED(SQLNumResultCols(stmt_holder.stmt, &count))) {
+    throw std::runtime_error(extract_error("Error in SQLNumResultCols in prepared_statement", stmt_holder.stmt,
+        SQL_HANDLE_STMT));
+  }
+
+  if (count > 0) {
+    col_desc = __get_column_descs(stmt_holder.stmt, count);
+    __bind_fetch_buffers(stmt_holder.stmt, col_desc, results, chunksize);
+  }
+
+  stmt = stmt_holder.stmt;
+  stmt_holder.stmt = NULL;
+}
+
+prepared_statement::~prepared_statement() {
+  release();
+}
+
+void prepared_statement::release() {
+  if (stmt != NULL) {
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    stmt = NULL;
+  }
+}
+
+std::vector<int> prepared_statement::fit_param_lengths(const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths) const {
+  std::vector<int> lengths = varchar_col_lengths;
+
+  if (coltypes == param_coltypes) {
+    for (size_t i = 0; i < lengths.size(); i++) {
+      lengths[i] = std::max(lengths[i], param_lengths[i]);
+    }
+  }
+
+  return lengths;
+}
+
+read_results prepared_statement::execute(const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
+    unsigned long nrows, const fill_function& fill, SQLLEN& rows_affected) {
+
+  size_t i;
+
+  if (stmt == NULL) {
+    throw std::runtime_error("The prepared statement can no longer be used because its connection was closed");
+  }
+
+  if (coltypes.size() != nparams) {
+    throw std::runtime_error("Statement has " + std::to_string(nparams) + " parameter markers but "
+        + std::to_string(coltypes.size()) + " parameters were given");
+  }
+
+  if (nparams > 0 && (nrows == 0 || (is_query() && nrows > 1))) {
+    throw std::runtime_error(is_query() ? "A query can only be executed with one row of parameters"
+                                        : "No parameter values were given");
+  }
+
+  if (nparams > 0) {
+    // the buffers are only allocated, described and bound again when the new parameters do not fit
+    bool fits = (coltypes == param_coltypes) && (nrows <= param_rows);
+    for (i = 0; fits && i < nparams; i++) {
+      fits = (varchar_col_lengths[i] == param_lengths[i]);
+    }
+
+    if (!fits) {
+      if (coltypes != param_coltypes) {
+        param_desc.reset(new column_desc[nparams]);
+        __describe_params(stmt, param_desc.get(), coltypes, varchar_col_lengths);
+      }
+      param_rows = std::max(nrows, param_rows);
+      param_coltypes = coltypes;
+      param_lengths = varchar_col_lengths;
+      param_indic = alloc_indic_mem(param_rows, nparams);
+      param_data = alloc_mem(param_coltypes, param_lengths, param_rows);
+      __bind_params(stmt, param_desc.get(), param_data, param_indic, param_coltypes, param_lengths);
+    }
+
+    fill(param_data, param_indic, 0, nrows);
+    __set_stmt_attributes(stmt, nrows);
+  }
+
+  SQLRETURN ret = SQLExecute(stmt);
+  if (!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+    throw std::runtime_error(extract_error("Error in SQLExecute in prepared_statement", stmt, SQL_HANDLE_STMT));
+  }
+  nexecutions++;
+
+  rows_affected = 0;  // the DB2 driver only writes 32 bits here
+  if (!is_query()) {
+    if (ret != SQL_NO_DATA) {
+      SQLRowCount(stmt, &rows_affected);
+    }
+    return read_results(0);
+  }
+
+  read_results result;
+  try {
+    result = __fetch_bound(stmt, col_desc, results);
+  } catch (...) {
+    SQLFreeStmt(stmt, SQL_CLOSE);
+    throw;
+  }
+  SQLFreeStmt(stmt, SQL_CLOSE);
+
+  return result;
+}
+
+/***************************************************
+ Appender
+****************************************************/
+
+static void __copy_rows(const std::vector<short>& coltypes, data_arrays& src, indic_arrays& src_indic,
+    const std::vector<int>& src_widths, data_arrays& dest, indic_arrays& dest_indic,
+    const std::vector<int>& dest_widths, const unsigned long dest_first, const unsigned long nrows) {
+  // copies the first nrows rows of src to dest starting at row dest_first. Strings may be laid out
+  // with a wider field in dest than in src
+  size_t i;
+  unsigned long j;
+
+  for (i = 0; i < coltypes.size(); i++) {
+    std::memcpy(dest_indic[i].get() + dest_first, src_indic[i].get(), nrows * sizeof(INDIC_TYPE));
+
+    if (coltypes[i] == COLTYPE_STRING) {
+      size_t src_width = src_widths[i] + 1;
+      size_t dest_width = dest_widths[i] + 1;
+      SQLWCHAR* from = (SQLWCHAR*) src[i].get();
+      SQLWCHAR* to = (SQLWCHAR*) dest[i].get() + dest_first * dest_width;
+      for (j = 0; j < nrows; j++) {
+        std::memcpy(to + j * dest_width, from + j * src_width, src_width * sizeof(SQLWCHAR));
+      }
+    } else if (coltypes[i] == COLTYPE_INTEGER) {
+      std::memcpy((SQLBIGINT*) dest[i].get() + dest_first, src[i].get(), nrows * sizeof(SQLBIGINT));
+    } else if (coltypes[i] == COLTYPE_NUMERIC) {
+      std::memcpy((SQLDOUBLE*) dest[i].get() + dest_first, src[i].get(), nrows * sizeof(SQLDOUBLE));
+    }
+  }
+}
+
+table_appender::table_appender(const SQLHDBC& connection, const std::string& table, const std::string& insert_SQL,
+    size_t columns, const appender_options& appender_opts) :
+    dbc(connection), tbl_name(table), stmt(NULL), options(appender_opts), ncols(columns),
+    col_desc(new column_desc[columns]), capacity(0), nrows(0), nbytes(0), total_rows(0), nflushes(0) {
+
+  struct odbc_stmt_handle stmt_holder;
+
+  __prepare_insert(dbc, stmt_holder, insert_SQL);
+
+  __get_db_coltypes(dbc, tbl_name, col_desc, ncols);
+
+  stmt = stmt_holder.stmt;
+  stmt_holder.stmt = NULL;
+}
+
+table_appender::~table_appender() {
+  release();
+}
+
+void table_appender::release() {
+  if (stmt != NULL) {
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    stmt = NULL;
+  }
+}
+
+void table_appender::reserve(unsigned long rows, const std::vector<int>& varchar_col_lengths) {
+  // makes room for rows rows with strings of up to varchar_col_lengths. The buffers grow geometrically
+  // so that appending one row at a time does not reallocate every time
+  std::vector<int> new_widths = widths;
+  bool wider = false;
+  size_t i;
+
+  for (i = 0; i < ncols; i++) {
+    if (varchar_col_lengths[i] > new_widths[i]) {
+      new_widths[i] = varchar_col_lengths[i];
+      wider = true;
+    }
+  }
+
+  if (rows <= capacity && !wider) {
+    return;
+  }
+
+  unsigned long new_capacity = std::max(rows, capacity);
+  if (rows > capacity) {
+    new_capacity = std::max(std::max(rows, 2 * capacity), 64UL);
+  }
+
+  data_arrays new_data = alloc_mem(coltypes, new_widths, new_capacity);
+  indic_arrays new_indicator = alloc_indic_mem(new_capacity, ncols);
+
+  if (nrows > 0) {
+    __copy_rows(coltypes, data, null_indicator, widths, new_data, new_indicator, new_widths, 0, nrows);
+  }
+
+  data = std::move(new_data);
+  null_indicator = std::move(new_indicator);
+  widths = new_widths;
+  capacity = new_capacity;
+}
+
+unsigned long table_appender::append(const std::vector<short>& col_types, const std::vector<int>& varchar_col_lengths,
+    unsigned long count, const fill_function& fill) {
+
+  size_t i;
+
+  if (stmt == NULL) {
+    throw std::runtime_error("The appender for " + tbl_name + " has been closed");
+  }
+
+  if (col_types.size() != ncols) {
+    throw std::runtime_error("Expected " + std::to_string(ncols) + " columns to append to " + tbl_name + " but got "
+        + std::to_string(col_types.size()));
+  }
+
+  if (count == 0) {
+    return 0;
+  }
+
+  // the buffers hold one set of column types. If they change (eg. an integer column arrives as numeric)
+  // write out what is buffered and start again with the new types
+  unsigned long flushed = 0;
+  if (col_types != coltypes) {
+    flushed = flush();
+    coltypes = col_types;
+    widths.assign(ncols, 0);
+    capacity = 0;
+    data.clear();
+    null_indicator.clear();
+  }
+
+  // encode into a scratch buffer of exactly the right size and then copy into the growable buffers
+  data_arrays scratch = alloc_mem(coltypes, varchar_col_lengths, count);
+  indic_arrays scratch_indicator = alloc_indic_mem(count, ncols);
+  fill(scratch, scratch_indicator, 0, count);
+
+  reserve(nrows + count, varchar_col_lengths);
+  __copy_rows(coltypes, scratch, scratch_indicator, varchar_col_lengths, data, null_indicator, widths, nrows, count);
+
+  if (nrows == 0) {
+    oldest = std::chrono::steady_clock::now();
+  }
+  nrows += count;
+
+  // approximate size of the rows as sent to the server
+  for (i = 0; i < ncols; i++) {
+    nbytes += count * ((coltypes[i] == COLTYPE_STRING) ? sizeof(SQLWCHAR) * varchar_col_lengths[i] : sizeof(SQLBIGINT));
+  }
+
+  if (nrows >= options.max_rows || nbytes >= options.max_bytes
+      || std::chrono::duration<double>(std::chrono::steady_clock::now() - oldest).count() >= options.max_seconds) {
+    flushed += flush();
+  }
+
+  return flushed;
+}
+
+unsigned long table_appender::flush() {
+  if (nrows == 0) {
+    return 0;
+  }
+
+  if (stmt == NULL) {
+    throw std::runtime_error("The appender for " + tbl_name + " has been closed");
+  }
+
+  // the buffer is emptied up front so that rows that fail to insert are dropped rather than retried forever
+  unsigned long count = nrows;
+  nrows = 0;
+  nbytes = 0;
+
+  autocommit_guard autocommit(dbc, SQL_AUTOCOMMIT_OFF);
+
+  __set_stmt_attributes(stmt, count);
+  __bind_params(stmt, col_desc.get(), data, null_indicator, coltypes, widths);
+
+  if (!SQL_SUCCEEDED(SQLExecute(stmt))) {
+    throw std::runtime_error(
+        __rollback(dbc, extract_error("Error in SQLExecute while flushing appender for " + tbl_name, stmt, SQL_HANDLE_STMT))
+        + " " + std::to_string(count) + " buffered rows were not written.");
+  }
+
+  __commit(dbc);
+
+  autocommit.restore();
+
+  total_rows += count;
+  nflushes++;
+
+  return count;
+}
+
+void table_appender::close() {
+  if (stmt == NULL) {
+    return;
+  }
+
+  try {
+    flush();
+  } catch (...) {
+    release();
+    throw;
+  }
+  release();
+}
+
+} // namespace
@@ -21,17 +21,33 @@
 #ifndef SRC_RWEDB2_DML_H_
 #define SRC_RWEDB2_DML_H_
 
+#include <cstdint>
 #include <vector>
 #include <sql.h>
 #include <sqlext.h>
 #include <memory>
 #include <string>
+#include <functional>
+#include <chrono>
 
 #include "rwedb2_utils.h"
 
 #define COLTYPE_STRING 0
 #define COLTYPE_INTEGER 1
 #define COLTYPE_NUMERIC 2
+#define COLTYPE_BINARY 3   // R list of raw vectors, only written by write_lob_rows
+
+// what to do when some rows of an array insert fail
+#define WRITE_ON_ERROR_ABORT 0    // roll back the chunk and throw
+#define WRITE_ON_ERROR_SKIP 1     // commit the good rows and report the row numbers of the rejected ones
+#define WRITE_ON_ERROR_COLLECT 2  // same as skip but also collect the SQLSTATE and message for each rejected row
+
+// how rows are sent to the server
+#define WRITE_METHOD_INSERT 0     // array INSERT
+#define WRITE_METHOD_LOAD 1       // array INSERT routed through the DB2 LOAD utility (SQL_ATTR_USE_LOAD_API)
+
+// bytes of one set of parameter buffers for sources whose row count is not known up front (see rows_within_budget)
+#define WRITE_BUFFER_BUDGET (128UL * 1024 * 1024)
 
 /* below is workaround for the fact that indicator type in
  # SQLBindParameter and SQLBindCol is supposed to be SQLLEN (64-bit)
@@ -50,17 +66,72 @@ typedef struct {
   SQLLEN scale;
 } column_desc;
 
+struct compact_strings {
+  // UTF-8 strings stored back to back. Element j is data[offsets[j], offsets[j + 1]) and is NA if its bit
+  // in valid is clear. Used to keep string columns out of R's string cache until they are accessed
+  std::string data;
+  std::vector<uint64_t> offsets;
+  std::vector<uint8_t> valid;
+
+  compact_strings() {
+    offsets.push_back(0);
+  }
+
+  size_t size() const {
+    return offsets.size() - 1;
+  }
+
+  bool is_na(size_t j) const {
+    return !((valid[j / 8] >> (j % 8)) & 1);
+  }
+
+  void push_back(bool is_valid) {
+    // ends the element whose bytes have been appended to data
+    size_t j = size();
+    if (j % 8 == 0) {
+      valid.push_back(0);
+    }
+    if (is_valid) {
+      valid[j / 8] |= (uint8_t) (1 << (j % 8));
+    }
+    offsets.push_back(data.size());
+  }
+};
+
 struct stl_vector_var_data {
   std::vector<SQLINTEGER> integer_data;
   std::vector<SQLDOUBLE> numeric_data;
   std::vector<std::string> string_data;
+  std::shared_ptr<compact_strings> compact_data;  // replaces string_data when strings are read compact
   short type;
 };
 
+class spilled_result;
+
+struct read_options {
+  bool compact_strings;     // collect string columns into stl_vector_var_data::compact_data
+  // once the rows collected in memory take more than this many bytes, they and the rest of the result
+  // are written to column files in a new directory under spill_dir instead (see rwedb2_spill.h).
+  // 0 spills from the first row
+  size_t spill_threshold;
+  std::string spill_dir;
+  int32_t null_integer;     // stored in the null rows of spilled integer and double columns
+  double null_double;
+
+  read_options() {
+    compact_strings = false;
+    spill_threshold = (size_t) -1;
+    spill_dir = "/tmp";
+    null_integer = INT32_MIN;
+    null_double = 0;
+  }
+};
+
 struct read_results {
   std::vector<struct stl_vector_var_data> stl_vecs;
   std::vector<std::vector<bool>> null_indics;
   std::vector<column_desc> col_desc;
+  std::shared_ptr<spilled_result> spilled;  // set instead of stl_vecs when the result was spilled to disk
   
   read_results() {}
   
@@ -81,6 +152,25 @@ struct read_results {
   }
 };
 
+struct fetch_buffers {
+  // result buffers bound with SQLBindCol, one block of rows per fetch
+  std::unique_ptr<SQLUSMALLINT[]> row_status;
+  std::vector<std::unique_ptr<SQLLEN[]>> indicator;
+  std::vector<std::shared_ptr<void>> data;
+  SQLROWSETSIZE row_count;  // rows returned by the last fetch. DB2 only writes 32 bits here
+
+  // LOB columns are not bound. Their values in the last fetch are read with SQLGetData into lob_values
+  // (UTF-8 text, or the bytes of binary LOBs) and their indicators hold SQL_NULL_DATA or the length in bytes
+  std::vector<size_t> lob_cols;
+  std::vector<std::vector<std::string>> lob_values;
+  std::vector<char> lob_buffer;   // reused for every value and grown to the longest one
+};
+
+// called with the bound result buffers after each fetch of row_count rows. The buffers are overwritten by
+// the next fetch
+typedef std::function<void(const std::vector<column_desc>& col_desc, const fetch_buffers& buffers,
+    unsigned long row_count)> rowset_function;
+
 typedef std::vector<std::unique_ptr<INDIC_TYPE[]>> indic_arrays;
 
 typedef struct colData {
@@ -131,11 +221,490 @@ public:
 
 typedef std::vector<colData> data_arrays;
 
-struct read_results execute_query(const SQLHDBC& handle, const std::string& query, unsigned int chunksize = 1);
+// encodes nrows rows of the caller's data starting at first_row into the start of data and null_indicator
+// When writes are pipelined this is called on a worker thread so it must not use any non thread safe
+// API (eg. R's API)
+typedef std::function<void(data_arrays& data, indic_arrays& null_indicator, unsigned long first_row,
+    unsigned long nrows)> fill_function;
+
+// encodes the next rows of a source of unknown length into the start of data and null_indicator and
+// returns how many it wrote, at most max_rows. Returns 0 when there are no more rows. Called on a worker
+// thread when writes are pipelined, as fill_function
+typedef std::function<unsigned long(data_arrays& data, indic_arrays& null_indicator, unsigned long max_rows)>
+    chunk_source;
+
+struct write_options {
+  unsigned long chunksize;  // number of rows sent to the server in each SQLExecute
+  bool pipelined;           // encode the next chunk on a worker thread while the current chunk executes
+  unsigned long commit_every;  // commit after this many chunks. 0 leaves the transaction open for the caller
+  int on_error;             // one of WRITE_ON_ERROR_*
+  // reissue ALTER TABLE ... ACTIVATE NOT LOGGED INITIALLY at the start of every transaction so that
+  // inserts are not logged. The table must have been created with NOT LOGGED INITIALLY. Note that if
+  // such a transaction is rolled back, DB2 marks the table as inaccessible and it has to be dropped.
+  // Only honoured with WRITE_ON_ERROR_ABORT, where any rejected row ends the write anyway
+  bool not_logged;
+
+  // WRITE_METHOD_LOAD falls back to WRITE_METHOD_INSERT if the driver rejects the load attributes.
+  // LOAD commits its own work, so commit_every and not_logged are ignored, and it cannot report
+  // individual rows, so it is only used when on_error is WRITE_ON_ERROR_ABORT
+  int method;
+  SQLINTEGER load_mode;        // SQL_USE_LOAD_INSERT or SQL_USE_LOAD_REPLACE
+  unsigned long load_warning_limit;  // stop the load after this many warnings. 0 for no limit (needs RDB2_HAVE_DB2API)
+  bool load_messages;          // collect the messages from the load utility into write_stats::load_messages
+
+  // called after each chunk is executed with the total number of rows written so far.
+  // It may throw to abandon the write, in which case the open transaction is rolled back
+  std::function<void(unsigned long rows)> progress;
+
+  write_options() {
+    chunksize = 1000000;
+    pipelined = false;
+    commit_every = 1;
+    on_error = WRITE_ON_ERROR_ABORT;
+    not_logged = false;
+    method = WRITE_METHOD_INSERT;
+    load_mode = SQL_USE_LOAD_INSERT;
+    load_warning_limit = 0;
+    load_messages = false;
+  }
+};
+
+struct row_error {
+  unsigned long row;    // 0-based row number in the data being written
+  std::string sqlstate; // empty unless the diagnostics were collected
+  SQLINTEGER native_error;
+  std::string message;
+
+  row_error(unsigned long r = 0) {
+    row = r;
+    native_error = 0;
+  }
+};
+
+struct write_stats {
+  unsigned long rows;       // rows successfully written
+  unsigned long chunks;
+  unsigned long transactions;         // transactions started, including one left open for the caller
+  unsigned long commits;
+  unsigned long not_logged_transactions;  // transactions in which NOT LOGGED INITIALLY was activated
+  double fill_seconds;      // time spent encoding chunks (or waiting for the worker thread to encode them)
+  double execute_seconds;   // time spent executing and committing chunks
+  std::vector<row_error> rejected;  // rows that failed when options.on_error is not WRITE_ON_ERROR_ABORT
+
+  // only set when the LOAD utility was used
+  bool load_used;
+  SQLBIGINT load_rows_read;
+  SQLBIGINT load_rows_skipped;
+  SQLBIGINT load_rows_loaded;
+  SQLBIGINT load_rows_rejected;
+  SQLBIGINT load_rows_deleted;
+  SQLBIGINT load_rows_committed;
+  std::vector<std::string> load_messages;
+
+  write_stats() {
+    rows = 0;
+    chunks = 0;
+    transactions = 0;
+    commits = 0;
+    not_logged_transactions = 0;
+    fill_seconds = 0;
+    execute_seconds = 0;
+    load_used = false;
+    load_rows_read = 0;
+    load_rows_skipped = 0;
+    load_rows_loaded = 0;
+    load_rows_rejected = 0;
+    load_rows_deleted = 0;
+    load_rows_committed = 0;
+  }
+};
+
+struct params_stats {
+  unsigned long rows;       // parameter rows executed
+  unsigned long chunks;
+  SQLLEN total;             // rows affected by all executions
+  bool per_row;             // row_counts has the rows affected by each parameter row. Only set if the driver reports them
+  std::vector<SQLLEN> row_counts;
+
+  params_stats() {
+    rows = 0;
+    chunks = 0;
+    total = 0;
+    per_row = false;
+  }
+};
+
+struct upsert_stats {
+  unsigned long inserted;
+  unsigned long updated;
+  write_stats staged;   // statistics of the write to the staging table
+
+  upsert_stats() {
+    inserted = 0;
+    updated = 0;
+  }
+};
+
+// runs query and collects every row, in memory or in column files as set by options
+struct read_results execute_query(const SQLHDBC& handle, const std::string& query, unsigned int chunksize = 1,
+    const read_options& options = read_options());
+
+// runs query and passes each block of rows to on_rowset straight from the bound buffers, without
+// collecting them. Returns the number of rows fetched
+unsigned long stream_query(const SQLHDBC& dbc, const std::string& query, unsigned int chunksize,
+    const rowset_function& on_rowset);
+
+// runs query and returns the description of its result columns
+std::vector<column_desc> describe_query(const SQLHDBC& dbc, const std::string& query);
+
+// executes query on a new statement handle in stmt_holder that fetches chunksize rows at a time and
+// returns the description of its result columns. The caller binds and fetches
+std::vector<column_desc> open_query(const SQLHDBC& dbc, struct odbc_stmt_handle& stmt_holder,
+    const std::string& query, unsigned int chunksize);
+
+// the parameter type (COLTYPE_*) to send values of a column of this description as. For COLTYPE_STRING,
+// width is set to the longest value in UTF-16 code units
+short get_param_coltype(const column_desc& desc, int& width);
+
+// width in SQLWCHARs of the buffer field of a column that is fetched as a wide string, 0 for other columns
+int bound_field_width(const column_desc& desc);
+
+// the type (COLTYPE_*) that values of a result column are collected as
+short result_coltype(const column_desc& desc);
+
+// true for the large object and XML columns that are read with SQLGetData instead of being bound
+bool is_lob(const column_desc& desc);
+
+// true for the LOB columns whose values are bytes (BLOB) rather than text. They are collected as strings
+// of bytes and converted to raw vectors
+bool is_binary_lob(const column_desc& desc);
+
+indic_arrays alloc_indic_mem(const unsigned long nrows, const size_t& ncols);
+
+data_arrays alloc_mem(const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
+    const unsigned long nrows);
+
+// the largest number of rows, at most max_rows and at least 1, whose parameter buffers and null indicators
+// (as from alloc_mem and alloc_indic_mem) fit in budget bytes
+unsigned long rows_within_budget(const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
+    unsigned long max_rows, size_t budget = WRITE_BUFFER_BUDGET);
 
 void write_table(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL, data_arrays& data,
     indic_arrays& null_indicator, const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
     unsigned long nrows);
+
+write_stats write_table_chunked(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL,
+    const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths, unsigned long nrows,
+    const fill_function& fill, const write_options& options = write_options());
+
+// same as write_table_chunked for a source whose number of rows is not known up front. next_chunk is
+// called until it returns 0. max_rows, if known, limits the size of the buffers. param_descs describes the
+// target column of each parameter of insert_SQL, in order. If it is empty the parameters are taken to be
+// all the columns of tbl_name in table order
+write_stats write_table_streamed(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL,
+    const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths, const chunk_source& next_chunk,
+    const write_options& options = write_options(), unsigned long max_rows = (unsigned long) -1,
+    const std::vector<column_desc>& param_descs = std::vector<column_desc>());
+
+// sets one statement attribute, as SQLSetStmtAttr does for a statement
+typedef std::function<SQLRETURN(SQLINTEGER attribute, SQLPOINTER value)> stmt_attr_setter;
+
+// runs the statement attribute sequence that switches an insert to the LOAD utility for options against a
+// recorder instead of a driver. Setting failing_attribute fails, as with a driver that does not support it.
+// Each attribute that is set is appended to calls with its value (only kept for SQL_ATTR_USE_LOAD_API).
+// Returns whether LOAD would be used
+bool trace_load_attributes(const write_options& options, SQLINTEGER failing_attribute,
+    std::vector<std::pair<SQLINTEGER, SQLLEN>>& calls);
+
+// prepares sql once and executes it for nrows rows of parameters, options.chunksize rows at a time.
+// Each parameter marker is bound to the matching column using the type the driver describes for it.
+// Transactions are committed every options.commit_every chunks, and options.commit_every = 0 runs all chunks
+// in a single transaction that is committed after the last one. Any error rolls back the open transaction
+params_stats execute_params(const SQLHDBC& dbc, const std::string& sql, const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths, unsigned long nrows, const fill_function& fill,
+    const write_options& options = write_options());
+
+class prepared_statement {
+  // a statement that is prepared once and executed many times. The result column descriptors, the bound
+  // result buffers and the parameter buffers are kept between executions. Not thread safe
+public:
+  prepared_statement(const SQLHDBC& dbc, const std::string& sql, unsigned int chunksize);
+  ~prepared_statement();
+
+  const SQLHDBC& get_dbc() const {
+    return dbc;
+  }
+
+  const std::string& get_sql() const {
+    return sql;
+  }
+
+  unsigned int get_chunksize() const {
+    return chunksize;
+  }
+
+  size_t num_params() const {
+    return nparams;
+  }
+
+  // true if the statement returns a result set
+  bool is_query() const {
+    return !col_desc.empty();
+  }
+
+  // false once the statement has been released because its connection was closed
+  bool valid() const {
+    return stmt != NULL;
+  }
+
+  unsigned long executions() const {
+    return nexecutions;
+  }
+
+  // the string lengths to encode the next parameters with. They are never shorter than the current
+  // buffers so that the buffers can be reused
+  std::vector<int> fit_param_lengths(const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths) const;
+
+  // executes the statement for nrows rows of parameters, filled by fill (nrows is 0 if there are no parameter
+  // markers). varchar_col_lengths must come from fit_param_lengths. A query may only have one row of parameters
+  // and returns its results. Otherwise rows_affected is set and the returned results are empty
+  read_results execute(const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
+      unsigned long nrows, const fill_function& fill, SQLLEN& rows_affected);
+
+  // frees the statement handle. Called before the connection is closed
+  void release();
+
+private:
+  SQLHDBC dbc;
+  std::string sql;
+  SQLHSTMT stmt;
+  unsigned int chunksize;
+  size_t nparams;
+  unsigned long nexecutions;
+
+  std::vector<column_desc> col_desc;
+  fetch_buffers results;
+
+  // parameter buffers for param_rows rows. They are reused while the R column types stay the same
+  // and the values fit
+  std::vector<short> param_coltypes;
+  std::vector<int> param_lengths;
+  unsigned long param_rows;
+  std::unique_ptr<column_desc[]> param_desc;
+  data_arrays param_data;
+  indic_arrays param_indic;
+
+  prepared_statement(const prepared_statement&);
+  prepared_statement& operator=(const prepared_statement&);
+};
+
+struct appender_options {
+  unsigned long max_rows;   // flush once this many rows are buffered
+  size_t max_bytes;         // or once the buffered rows take about this many bytes
+  double max_seconds;       // or once the oldest buffered row is this old. Only checked when rows are appended
+
+  appender_options() {
+    max_rows = 10000;
+    max_bytes = 16 * 1024 * 1024;
+    max_seconds = 5;
+  }
+};
+
+class table_appender {
+  // buffers small batches of rows for a table and writes them with a single array insert when a threshold
+  // is reached or flush is called. The insert is prepared and the table's column types are looked up once.
+  // Not thread safe
+public:
+  table_appender(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL, size_t ncols,
+      const appender_options& options = appender_options());
+
+  // frees the statement without flushing. Anything still buffered is lost, so call close first
+  ~table_appender();
+
+  // encodes nrows rows with fill, which writes strings with varchar_col_lengths, and adds them to the buffer.
+  // The column types must be the same for every call. Returns the number of rows written by the flush
+  // this triggered, if any
+  unsigned long append(const std::vector<short>& coltypes, const std::vector<int>& varchar_col_lengths,
+      unsigned long nrows, const fill_function& fill);
+
+  // writes and commits the buffered rows. If the insert fails the rows are dropped and the error is thrown.
+  // Returns the number of rows written
+  unsigned long flush();
+
+  // flushes and frees the statement
+  void close();
+
+  // frees the statement. Called before the connection is closed
+  void release();
+
+  bool valid() const {
+    return stmt != NULL;
+  }
+
+  unsigned long buffered_rows() const {
+    return nrows;
+  }
+
+  unsigned long rows_written() const {
+    return total_rows;
+  }
+
+  unsigned long flushes() const {
+    return nflushes;
+  }
+
+private:
+  SQLHDBC dbc;
+  std::string tbl_name;
+  SQLHSTMT stmt;
+  appender_options options;
+  size_t ncols;
+  std::unique_ptr<column_desc[]> col_desc;
+
+  // growable parameter buffers holding nrows rows with room for capacity rows
+  std::vector<short> coltypes;
+  std::vector<int> widths;
+  unsigned long capacity;
+  unsigned long nrows;
+  size_t nbytes;
+  std::chrono::steady_clock::time_point oldest;
+  data_arrays data;
+  indic_arrays null_indicator;
+
+  unsigned long total_rows;
+  unsigned long nflushes;
+
+  void reserve(unsigned long rows, const std::vector<int>& varchar_col_lengths);
+
+  table_appender(const table_appender&);
+  table_appender& operator=(const table_appender&);
+};
+
+// inserts or updates nrows rows of tbl_name keyed by key_cols in a single transaction. The rows are array
+// inserted into a declared temporary table, which is reused by later calls on the same connection, and
+// then merged into tbl_name with one MERGE statement
+upsert_stats upsert_table(const SQLHDBC& dbc, const std::string& tbl_name, const std::vector<std::string>& col_names,
+    const std::vector<std::string>& key_cols, const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths, unsigned long nrows, const fill_function& fill,
+    const write_options& options = write_options());
+
+// reads select_list of the rows of tbl_name whose key_col is one of nkeys keys (a single column of parameters
+// filled by fill), optionally also filtered by where_clause. The keys are array inserted into an indexed
+// declared temporary table, which is reused by later calls on the same connection, and the rows are read
+// with one query that semi-joins tbl_name with it
+read_results read_by_keys(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& select_list,
+    const std::string& key_col, const std::string& where_clause, const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths, unsigned long nkeys, const fill_function& fill,
+    unsigned int chunksize, const read_options& options = read_options());
+
+struct lob_param {
+  // one value of a row written by write_lob_rows, for a column of type COLTYPE_*
+  bool is_null;
+  SQLBIGINT integer;
+  SQLDOUBLE number;
+  const char* data;   // UTF-8 text (COLTYPE_STRING) or bytes (COLTYPE_BINARY)
+  size_t length;
+};
+
+// sets values to the row of the caller's data with index row
+typedef std::function<void(unsigned long row, std::vector<lob_param>& values)> lob_row_function;
+
+// inserts nrows rows one at a time. Text and binary values are sent at execution time (SQL_DATA_AT_EXEC) in
+// pieces with SQLPutData, so memory does not depend on the length of the values or on options.chunksize, which
+// with options.commit_every only sets how many rows go in each transaction. Pipelining, LOAD and skipping
+// rejected rows are not supported
+write_stats write_lob_rows(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL,
+    const std::vector<short>& coltypes, unsigned long nrows, const lob_row_function& get_row,
+    const write_options& options = write_options());
+
+struct import_options {
+  write_options write;        // chunk size, commits and pipelining of the inserts
+  char sep;                   // field separator
+  char quote;                 // quote character, 0 if fields are never quoted
+  bool header;                // the first line holds the column names
+  std::string na;             // unquoted fields equal to this are NULL. Empty fields are NULL except in text columns
+  unsigned int threads;       // threads parsing each chunk
+  unsigned long max_rejected; // fail once more lines than this have been rejected
+
+  import_options() {
+    sep = ',';
+    quote = '"';
+    header = true;
+    na = "NA";
+    threads = 1;
+    max_rejected = (unsigned long) -1;
+  }
+};
+
+struct import_error {
+  unsigned long line;   // 1-based line of the file where the rejected record starts
+  std::string message;
+};
+
+struct import_stats {
+  unsigned long records;   // records read from the file, not counting the header
+  write_stats written;
+  std::vector<import_error> rejected;
+
+  import_stats() {
+    records = 0;
+  }
+};
+
+// inserts the records of the delimited text file at path into tbl_name. The file is memory mapped and each
+// chunk of records is parsed (by options.threads threads) straight into the parameter buffers using the
+// types of the table's columns. The fields are matched to the columns by col_names, or by the header, or
+// else by position, and must cover every column. Records that cannot be parsed are skipped and reported.
+// Errors from the server end the import as they do for write_table_chunked
+import_stats import_file(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& path,
+    const std::vector<std::string>& col_names, const import_options& options = import_options());
+
+// inserts the result of query on src_dbc into dst_table on dst_dbc, whose columns must match the result's in
+// order. Each rowset is fetched straight into the parameter buffers of the insert. With options.pipelined the
+// next rowset is fetched on a worker thread while the current one is inserted (unless both are the same
+// connection). Commits on dst_dbc follow options.commit_every
+write_stats copy_query(const SQLHDBC& src_dbc, const std::string& query, const SQLHDBC& dst_dbc,
+    const std::string& dst_table, const write_options& options = write_options());
+
+// compression of files written by export_query
+#define EXPORT_COMPRESS_NONE 0
+#define EXPORT_COMPRESS_GZIP 1
+
+struct export_options {
+  unsigned int chunksize;   // rows fetched at a time
+  std::string sep;          // field separator
+  bool quote;               // quote character columns and the header, doubling embedded quotes
+  std::string na;           // written for NULLs
+  bool header;              // write the column names as the first line
+  int compress;
+
+  export_options() {
+    chunksize = 1;
+    sep = ",";
+    quote = true;
+    na = "NA";
+    header = true;
+    compress = EXPORT_COMPRESS_NONE;
+  }
+};
+
+struct export_stats {
+  unsigned long rows;
+  unsigned long long bytes;   // uncompressed bytes written
+  double seconds;
+
+  export_stats() {
+    rows = 0;
+    bytes = 0;
+    seconds = 0;
+  }
+};
+
+// runs query and writes its result to a delimited text file at path, formatting each block of rows
+// straight from the fetch buffers. Memory use does not depend on the size of the result. The file is
+// removed if the export fails
+export_stats export_query(const SQLHDBC& dbc, const std::string& query, const std::string& path,
+    const export_options& options = export_options());
 }
 
 
@@ -0,0 +1,1078 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_arrow.cpp
+ *
+ *  Query results as Arrow C data interface streams
+ */
+
+#include "rwedb2.h"
+#include "rwedb2_arrow.h"
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+
+#include "utf8.h"
+
+// a chunk that fits in the current record batch is bound straight to its buffers if it has at least this
+// many rows. Shorter runs are copied so that small batches do not become small inserts
+#define ARROW_DIRECT_MIN_ROWS 16384
+
+namespace rdb2 {
+
+// how each result column is fetched and laid out in Arrow
+enum arrow_layout {
+  ARROW_FIXED,      // fetched straight into the Arrow values buffer
+  ARROW_UTF8,       // fetched as UTF-16 and converted to offsets and UTF-8 data
+  ARROW_DECIMAL,    // fetched as text and converted to 128-bit integers
+  ARROW_DATE,       // fetched as SQL_DATE_STRUCT, stored as days since the epoch
+  ARROW_TIME,       // fetched as SQL_TIME_STRUCT, stored as seconds since midnight
+  ARROW_TIMESTAMP   // fetched as SQL_TIMESTAMP_STRUCT, stored as microseconds since the epoch
+};
+
+struct arrow_column {
+  std::string name;
+  std::string format;
+  arrow_layout layout;
+  SQLSMALLINT c_type;
+  SQLLEN field_size;   // bytes per row of the fetch buffer
+  int scale;
+};
+
+struct arrow_stream_state {
+  std::shared_ptr<odbc_stmt_handle> stmt;
+  unsigned int chunksize;
+  std::vector<arrow_column> columns;
+
+  // buffers for the columns that need converting. The fixed width columns are bound to a new Arrow
+  // buffer before every fetch
+  std::vector<std::unique_ptr<uint64_t[]>> fetch_data;
+  std::vector<std::unique_ptr<SQLLEN[]>> indicator;
+  std::unique_ptr<SQLUSMALLINT[]> row_status;
+  SQLULEN rows_fetched;   // DB2 only writes 32 bits here
+  bool finished;
+
+  std::string last_error;
+};
+
+struct arrow_array_data {
+  // owns the buffers and children of one array
+  std::vector<std::string> buffers;
+  std::vector<const void*> buffer_pointers;
+  std::vector<struct ArrowArray> children;
+  std::vector<struct ArrowArray*> child_pointers;
+};
+
+struct arrow_schema_data {
+  std::string format;
+  std::string name;
+  std::vector<struct ArrowSchema> children;
+  std::vector<struct ArrowSchema*> child_pointers;
+};
+
+/***************************************************
+ Release callbacks
+****************************************************/
+
+static void __release_schema(struct ArrowSchema* schema) {
+  arrow_schema_data* data = (arrow_schema_data*) schema->private_data;
+  for (size_t i = 0; i < data->children.size(); i++) {
+    if (data->children[i].release != NULL) {
+      data->children[i].release(&data->children[i]);
+    }
+  }
+  delete data;
+  schema->release = NULL;
+}
+
+static void __release_array(struct ArrowArray* array) {
+  arrow_array_data* data = (arrow_array_data*) array->private_data;
+  for (size_t i = 0; i < data->children.size(); i++) {
+    if (data->children[i].release != NULL) {
+      data->children[i].release(&data->children[i]);
+    }
+  }
+  delete data;
+  array->release = NULL;
+}
+
+static void __init_schema(struct ArrowSchema* schema, const std::string& format, const std::string& name,
+    int64_t flags, size_t n_children) {
+  arrow_schema_data* data = new arrow_schema_data();
+  data->format = format;
+  data->name = name;
+  data->children.resize(n_children);
+  for (size_t i = 0; i < n_children; i++) {
+    data->child_pointers.push_back(&data->children[i]);
+  }
+
+  schema->format = data->format.c_str();
+  schema->name = data->name.c_str();
+  schema->metadata = NULL;
+  schema->flags = flags;
+  schema->n_children = n_children;
+  schema->children = n_children > 0 ? data->child_pointers.data() : NULL;
+  schema->dictionary = NULL;
+  schema->release = &__release_schema;
+  schema->private_data = data;
+}
+
+static arrow_array_data* __init_array(struct ArrowArray* array, int64_t length, size_t n_buffers, size_t n_children) {
+  arrow_array_data* data = new arrow_array_data();
+  // reserved so that pointers into the buffers stay put as they are added
+  data->buffers.reserve(n_buffers);
+  data->buffer_pointers.assign(n_buffers, NULL);
+  data->children.resize(n_children);
+  for (size_t i = 0; i < n_children; i++) {
+    data->child_pointers.push_back(&data->children[i]);
+  }
+
+  array->length = length;
+  array->null_count = 0;
+  array->offset = 0;
+  array->n_buffers = n_buffers;
+  array->n_children = n_children;
+  array->buffers = data->buffer_pointers.data();
+  array->children = n_children > 0 ? data->child_pointers.data() : NULL;
+  array->dictionary = NULL;
+  array->release = &__release_array;
+  array->private_data = data;
+
+  return data;
+}
+
+static char* __add_buffer(arrow_array_data* data, size_t index, size_t bytes) {
+  data->buffers.push_back(std::string(bytes, '\0'));
+  char* buffer = &data->buffers.back()[0];
+  data->buffer_pointers[index] = buffer;
+  return buffer;
+}
+
+/***************************************************
+ Conversions
+****************************************************/
+
+static int64_t __days_from_civil(int64_t y, unsigned m, unsigned d) {
+  // days since 1970-01-01 of a proleptic Gregorian date
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned) (y - era * 400);
+  const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t) doe - 719468;
+}
+
+static bool __parse_decimal(const char* text, SQLLEN length, int scale, __int128& value) {
+  // converts the text of a DECIMAL value to an integer with scale implied digits
+  bool negative = false;
+  int fraction_digits = -1;
+  value = 0;
+
+  for (SQLLEN k = 0; k < length; k++) {
+    char c = text[k];
+    if (c >= '0' && c <= '9') {
+      if (fraction_digits >= scale) {
+        continue;   // more digits than the scale, which DB2 does not return
+      }
+      value = value * 10 + (c - '0');
+      if (fraction_digits >= 0) {
+        fraction_digits++;
+      }
+    } else if (c == '.' || c == ',') {
+      fraction_digits = 0;
+    } else if (c == '-') {
+      negative = true;
+    } else if (c != '+' && c != ' ') {
+      return false;
+    }
+  }
+
+  for (int k = std::max(fraction_digits, 0); k < scale; k++) {
+    value *= 10;
+  }
+  if (negative) {
+    value = -value;
+  }
+  return true;
+}
+
+static arrow_column __get_arrow_column(const column_desc& desc) {
+  arrow_column column;
+  column.name = reinterpret_cast<const char*>(desc.colname);
+  column.layout = ARROW_FIXED;
+  column.scale = 0;
+
+  // LOBs can only be read whole with SQLGetData, one row at a time, so they cannot be fetched into a batch
+  if (is_lob(desc)) {
+    throw std::runtime_error("Column " + column.name + " is a LOB column, which cannot be read as Arrow. "
+        "Use dbExecuteQuery or cast it to VARCHAR in the query");
+  }
+
+  switch (desc.type) {
+  case SQL_SMALLINT:
+    column.format = "s";
+    column.c_type = SQL_C_SHORT;
+    column.field_size = sizeof(SQLSMALLINT);
+    break;
+  case SQL_INTEGER:
+    column.format = "i";
+    column.c_type = SQL_C_LONG;
+    column.field_size = sizeof(SQLINTEGER);
+    break;
+  case SQL_BIGINT:
+    column.format = "l";
+    column.c_type = SQL_C_SBIGINT;
+    column.field_size = sizeof(SQLBIGINT);
+    break;
+  case SQL_REAL:
+  case SQL_FLOAT:
+  case SQL_DOUBLE:
+    column.format = "g";
+    column.c_type = SQL_C_DOUBLE;
+    column.field_size = sizeof(SQLDOUBLE);
+    break;
+  case SQL_DECIMAL:
+  case SQL_NUMERIC:
+    column.layout = ARROW_DECIMAL;
+    column.format = "d:" + std::to_string(desc.precision) + "," + std::to_string(desc.scale);
+    column.c_type = SQL_C_CHAR;
+    column.field_size = desc.precision + 3;
+    column.scale = desc.scale;
+    break;
+  case SQL_TYPE_DATE:
+    column.layout = ARROW_DATE;
+    column.format = "tdD";
+    column.c_type = SQL_C_TYPE_DATE;
+    column.field_size = sizeof(SQL_DATE_STRUCT);
+    break;
+  case SQL_TYPE_TIME:
+    column.layout = ARROW_TIME;
+    column.format = "tts";
+    column.c_type = SQL_C_TYPE_TIME;
+    column.field_size = sizeof(SQL_TIME_STRUCT);
+    break;
+  case SQL_TYPE_TIMESTAMP:
+    column.layout = ARROW_TIMESTAMP;
+    column.format = "tsu:";
+    column.c_type = SQL_C_TYPE_TIMESTAMP;
+    column.field_size = sizeof(SQL_TIMESTAMP_STRUCT);
+    break;
+  default: {
+    // text, including DECFLOAT whose values do not fit any Arrow number type exactly
+    int width;
+    get_param_coltype(desc, width);
+    column.layout = ARROW_UTF8;
+    column.format = "u";
+    column.c_type = SQL_C_WCHAR;
+    column.field_size = sizeof(SQLWCHAR) * (width + 1);
+    break;
+  }
+  }
+
+  return column;
+}
+
+static void __fill_validity(arrow_array_data* data, struct ArrowArray* array, const INDIC_TYPE* indic,
+    unsigned long nrows) {
+  int64_t null_count = 0;
+  for (unsigned long j = 0; j < nrows; j++) {
+    null_count += (indic[j] == SQL_NULL_DATA);
+  }
+
+  array->null_count = null_count;
+  if (null_count == 0) {
+    return;   // no validity bitmap means every value is valid
+  }
+
+  uint8_t* bitmap = (uint8_t*) __add_buffer(data, 0, (nrows + 7) / 8);
+  for (unsigned long j = 0; j < nrows; j++) {
+    if (indic[j] != SQL_NULL_DATA) {
+      bitmap[j / 8] |= (uint8_t) (1 << (j % 8));
+    }
+  }
+}
+
+static void __convert_column(const arrow_column& column, const char* fetched, const INDIC_TYPE* indic,
+    unsigned long nrows, arrow_array_data* data) {
+  // builds the values buffers of a column that was fetched into a conversion buffer
+  unsigned long j;
+
+  switch (column.layout) {
+  case ARROW_UTF8: {
+    int32_t* offsets = (int32_t*) __add_buffer(data, 1, sizeof(int32_t) * (nrows + 1));
+    std::string utf8_data;
+    for (j = 0; j < nrows; j++) {
+      offsets[j] = (int32_t) utf8_data.size();
+      if (indic[j] != SQL_NULL_DATA) {
+        // a longer value was truncated by the driver
+        if (indic[j] < 0 || indic[j] > (SQLLEN) (column.field_size - sizeof(SQLWCHAR))) {
+          throw std::runtime_error("Value of column " + column.name + " in row " + std::to_string(j + 1)
+              + " is longer than " + std::to_string(column.field_size / sizeof(SQLWCHAR) - 1) + " characters");
+        }
+        const SQLWCHAR* value = (const SQLWCHAR*) (fetched + j * column.field_size);
+        SQLLEN units = indic[j] / sizeof(SQLWCHAR);
+        utf8::utf16to8(value, value + units, std::back_inserter(utf8_data));
+      }
+    }
+    offsets[nrows] = (int32_t) utf8_data.size();
+    data->buffers.push_back(utf8_data);
+    data->buffer_pointers[2] = data->buffers.back().data();
+    break;
+  }
+  case ARROW_DECIMAL: {
+    __int128* values = (__int128*) __add_buffer(data, 1, sizeof(__int128) * nrows);
+    for (j = 0; j < nrows; j++) {
+      if (indic[j] != SQL_NULL_DATA
+          && !__parse_decimal(fetched + j * column.field_size, indic[j], column.scale, values[j])) {
+        throw std::runtime_error("Unable to convert the value of " + column.name + " in row " + std::to_string(j + 1)
+            + " to a decimal");
+      }
+    }
+    break;
+  }
+  case ARROW_DATE: {
+    int32_t* values = (int32_t*) __add_buffer(data, 1, sizeof(int32_t) * nrows);
+    for (j = 0; j < nrows; j++) {
+      if (indic[j] != SQL_NULL_DATA) {
+        const SQL_DATE_STRUCT* date = (const SQL_DATE_STRUCT*) (fetched + j * column.field_size);
+        values[j] = (int32_t) __days_from_civil(date->year, date->month, date->day);
+      }
+    }
+    break;
+  }
+  case ARROW_TIME: {
+    int32_t* values = (int32_t*) __add_buffer(data, 1, sizeof(int32_t) * nrows);
+    for (j = 0; j < nrows; j++) {
+      if (indic[j] != SQL_NULL_DATA) {
+        const SQL_TIME_STRUCT* time = (const SQL_TIME_STRUCT*) (fetched + j * column.field_size);
+        values[j] = time->hour * 3600 + time->minute * 60 + time->second;
+      }
+    }
+    break;
+  }
+  case ARROW_TIMESTAMP: {
+    int64_t* values = (int64_t*) __add_buffer(data, 1, sizeof(int64_t) * nrows);
+    for (j = 0; j < nrows; j++) {
+      if (indic[j] != SQL_NULL_DATA) {
+        const SQL_TIMESTAMP_STRUCT* ts = (const SQL_TIMESTAMP_STRUCT*) (fetched + j * column.field_size);
+        int64_t seconds = __days_from_civil(ts->year, ts->month, ts->day) * 86400
+            + ts->hour * 3600 + ts->minute * 60 + ts->second;
+        values[j] = seconds * 1000000 + ts->fraction / 1000;   // fraction is in nanoseconds
+      }
+    }
+    break;
+  }
+  case ARROW_FIXED:
+    break;
+  }
+}
+
+/***************************************************
+ Stream callbacks
+****************************************************/
+
+static int __get_schema(struct ArrowArrayStream* stream, struct ArrowSchema* out) {
+  arrow_stream_state* state = (arrow_stream_state*) stream->private_data;
+  try {
+    __init_schema(out, "+s", "", 0, state->columns.size());
+    for (size_t i = 0; i < state->columns.size(); i++) {
+      __init_schema(out->children[i], state->columns[i].format, state->columns[i].name, ARROW_FLAG_NULLABLE, 0);
+    }
+  } catch (const std::exception& e) {
+    state->last_error = e.what();
+    if (out->release != NULL) {
+      out->release(out);
+    }
+    return ENOMEM;
+  }
+  return 0;
+}
+
+static void __fetch_batch(arrow_stream_state* state, struct ArrowArray* out) {
+  SQLHSTMT stmt = state->stmt->stmt;
+  size_t ncols = state->columns.size();
+  unsigned int chunksize = state->chunksize;
+  size_t i;
+
+  if (stmt == NULL) {
+    throw std::runtime_error("The connection of the stream has been closed");
+  }
+
+  // fixed width columns are fetched straight into the values buffers of a new batch
+  std::unique_ptr<struct ArrowArray> batch(new struct ArrowArray());
+  arrow_array_data* batch_data = __init_array(batch.get(), 0, 1, ncols);
+  for (i = 0; i < ncols; i++) {
+    __init_array(&batch_data->children[i], 0, state->columns[i].layout == ARROW_UTF8 ? 3 : 2, 0);
+  }
+
+  for (i = 0; i < ncols; i++) {
+    const arrow_column& column = state->columns[i];
+    SQLPOINTER target;
+    if (column.layout == ARROW_FIXED) {
+      target = __add_buffer((arrow_array_data*) batch_data->children[i].private_data, 1, column.field_size * chunksize);
+    } else {
+      target = state->fetch_data[i].get();
+    }
+    if (!SQL_SUCCEEDED(SQLBindCol(stmt, i + 1, column.c_type, target, column.field_size, state->indicator[i].get()))) {
+      throw std::runtime_error(extract_error("Error in SQLBindCol in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+    }
+  }
+
+  SQLRETURN ret = SQLFetchScroll(stmt, SQL_FETCH_NEXT, 0);
+  if (ret == SQL_NO_DATA) {
+    state->finished = true;
+    batch->release(batch.get());
+    out->release = NULL;   // end of stream
+    return;
+  }
+  if (!SQL_SUCCEEDED(ret)) {
+    batch->release(batch.get());
+    throw std::runtime_error(extract_error("Error in " + std::string(__func__) + " while reading", stmt, SQL_HANDLE_STMT));
+  }
+
+  unsigned long nrows = (SQLUINTEGER) state->rows_fetched;
+  try {
+    for (unsigned long j = 0; j < nrows; j++) {
+      if (state->row_status[j] != SQL_SUCCESS && state->row_status[j] != SQL_SUCCESS_WITH_INFO) {
+        throw std::runtime_error(extract_error("Error " + std::to_string(state->row_status[j]) + " when reading row "
+            + std::to_string(j) + " in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+      }
+    }
+
+    batch->length = nrows;
+    for (i = 0; i < ncols; i++) {
+      struct ArrowArray* child = &batch_data->children[i];
+      arrow_array_data* child_data = (arrow_array_data*) child->private_data;
+      // DB2 only writes 32-bit indicators, see __fetch_bound
+      const INDIC_TYPE* indic = (const INDIC_TYPE*) state->indicator[i].get();
+
+      child->length = nrows;
+      __fill_validity(child_data, child, indic, nrows);
+      __convert_column(state->columns[i], (const char*) state->fetch_data[i].get(), indic, nrows, child_data);
+    }
+  } catch (...) {
+    batch->release(batch.get());
+    throw;
+  }
+
+  // the consumer takes over the batch. Its buffers were only ever pointed to by the private data
+  *out = *batch;
+}
+
+static int __get_next(struct ArrowArrayStream* stream, struct ArrowArray* out) {
+  arrow_stream_state* state = (arrow_stream_state*) stream->private_data;
+  out->release = NULL;
+
+  if (state->finished) {
+    return 0;
+  }
+
+  try {
+    __fetch_batch(state, out);
+  } catch (const std::exception& e) {
+    state->last_error = e.what();
+    return EIO;
+  }
+  return 0;
+}
+
+static const char* __get_last_error(struct ArrowArrayStream* stream) {
+  arrow_stream_state* state = (arrow_stream_state*) stream->private_data;
+  return state->last_error.empty() ? NULL : state->last_error.c_str();
+}
+
+static void __release_stream(struct ArrowArrayStream* stream) {
+  delete (arrow_stream_state*) stream->private_data;
+  stream->private_data = NULL;
+  stream->release = NULL;
+}
+
+void execute_query_stream(const SQLHDBC& dbc, const std::string& query, unsigned int chunksize,
+    struct ArrowArrayStream* out) {
+
+  std::unique_ptr<arrow_stream_state> state(new arrow_stream_state());
+  state->chunksize = std::max(chunksize, 1u);
+  state->rows_fetched = 0;
+  state->finished = false;
+  state->stmt = std::make_shared<odbc_stmt_handle>();
+
+  std::vector<column_desc> col_desc = open_query(dbc, *state->stmt, query, state->chunksize);
+  SQLHSTMT stmt = state->stmt->stmt;
+  size_t ncols = col_desc.size();
+
+  state->row_status.reset(new SQLUSMALLINT[state->chunksize]);
+  if (!SQL_SUCCEEDED(SQLSetStmtAttr(stmt, SQL_ATTR_ROWS_FETCHED_PTR, &state->rows_fetched, 0))
+      || !SQL_SUCCEEDED(SQLSetStmtAttr(stmt, SQL_ATTR_ROW_STATUS_PTR, state->row_status.get(), 0))) {
+    throw std::runtime_error(
+        extract_error("Error setting fetch attributes in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+  }
+
+  for (size_t i = 0; i < ncols; i++) {
+    arrow_column column = __get_arrow_column(col_desc[i]);
+
+    state->indicator.push_back(std::unique_ptr<SQLLEN[]>(new SQLLEN[state->chunksize]));
+    std::memset(state->indicator[i].get(), 0, sizeof(SQLLEN) * state->chunksize);
+
+    if (column.layout == ARROW_FIXED) {
+      state->fetch_data.push_back(std::unique_ptr<uint64_t[]>());
+    } else {
+      size_t words = (column.field_size * state->chunksize + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+      state->fetch_data.push_back(std::unique_ptr<uint64_t[]>(new uint64_t[words]));
+    }
+    state->columns.push_back(column);
+  }
+
+  // the statement is freed if the connection is closed before the stream is released
+  register_cursor(dbc, state->stmt);
+
+  out->get_schema = &__get_schema;
+  out->get_next = &__get_next;
+  out->get_last_error = &__get_last_error;
+  out->release = &__release_stream;
+  out->private_data = state.release();
+}
+
+/***************************************************
+ Arrow input
+****************************************************/
+
+// kinds of Arrow columns we can write, from the format strings of the C data interface
+enum arrow_input_kind {
+  ARROW_IN_BOOL, ARROW_IN_INT8, ARROW_IN_UINT8, ARROW_IN_INT16, ARROW_IN_UINT16, ARROW_IN_INT32, ARROW_IN_UINT32,
+  ARROW_IN_INT64, ARROW_IN_UINT64, ARROW_IN_FLOAT, ARROW_IN_DOUBLE, ARROW_IN_UTF8, ARROW_IN_LARGE_UTF8,
+  ARROW_IN_DECIMAL, ARROW_IN_DATE32, ARROW_IN_DATE64, ARROW_IN_TIME32, ARROW_IN_TIME64, ARROW_IN_TIMESTAMP
+};
+
+struct arrow_input_column {
+  std::string name;
+  std::string format;
+  arrow_input_kind kind;
+  int64_t units_per_second;   // for times and timestamps
+  int scale;                  // for decimals
+  short coltype;
+  int width;
+  bool direct;   // values buffer is bound as the parameter array
+};
+
+static int64_t __time_units(char unit) {
+  switch (unit) {
+  case 's':
+    return 1;
+  case 'm':
+    return 1000;
+  case 'u':
+    return 1000000;
+  case 'n':
+    return 1000000000;
+  }
+  return 0;
+}
+
+static bool __parse_input_format(arrow_input_column& column) {
+  const std::string& f = column.format;
+  column.units_per_second = 1;
+  column.scale = 0;
+
+  if (f.size() == 1) {
+    switch (f[0]) {
+    case 'b': column.kind = ARROW_IN_BOOL; return true;
+    case 'c': column.kind = ARROW_IN_INT8; return true;
+    case 'C': column.kind = ARROW_IN_UINT8; return true;
+    case 's': column.kind = ARROW_IN_INT16; return true;
+    case 'S': column.kind = ARROW_IN_UINT16; return true;
+    case 'i': column.kind = ARROW_IN_INT32; return true;
+    case 'I': column.kind = ARROW_IN_UINT32; return true;
+    case 'l': column.kind = ARROW_IN_INT64; return true;
+    case 'L': column.kind = ARROW_IN_UINT64; return true;
+    case 'f': column.kind = ARROW_IN_FLOAT; return true;
+    case 'g': column.kind = ARROW_IN_DOUBLE; return true;
+    case 'u': column.kind = ARROW_IN_UTF8; return true;
+    case 'U': column.kind = ARROW_IN_LARGE_UTF8; return true;
+    }
+    return false;
+  }
+
+  if (f.compare(0, 2, "d:") == 0) {
+    // d:precision,scale[,bitwidth]. Only 128-bit decimals
+    size_t comma = f.find(',');
+    if (comma == std::string::npos) {
+      return false;
+    }
+    size_t second = f.find(',', comma + 1);
+    if (second != std::string::npos && f.substr(second + 1) != "128") {
+      return false;
+    }
+    column.kind = ARROW_IN_DECIMAL;
+    column.scale = std::atoi(f.c_str() + comma + 1);
+    return true;
+  }
+
+  if (f == "tdD") {
+    column.kind = ARROW_IN_DATE32;
+    return true;
+  }
+  if (f == "tdm") {
+    column.kind = ARROW_IN_DATE64;
+    column.units_per_second = 1000;
+    return true;
+  }
+  if (f.size() == 3 && f.compare(0, 2, "tt") == 0 && __time_units(f[2]) > 0) {
+    column.kind = (f[2] == 's' || f[2] == 'm') ? ARROW_IN_TIME32 : ARROW_IN_TIME64;
+    column.units_per_second = __time_units(f[2]);
+    return true;
+  }
+  if (f.size() >= 4 && f.compare(0, 2, "ts") == 0 && f[3] == ':' && __time_units(f[2]) > 0) {
+    // the values are UTC whatever the time zone after the colon
+    column.kind = ARROW_IN_TIMESTAMP;
+    column.units_per_second = __time_units(f[2]);
+    return true;
+  }
+
+  return false;
+}
+
+static bool __is_numeric_kind(arrow_input_kind kind) {
+  return kind <= ARROW_IN_DOUBLE || kind == ARROW_IN_DECIMAL;
+}
+
+static void __civil_from_days(int64_t z, int64_t& y, unsigned& m, unsigned& d) {
+  // inverse of __days_from_civil
+  z += 719468;
+  const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = (unsigned) (z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = (int64_t) yoe + era * 400 + (m <= 2);
+}
+
+static int64_t __floor_div(int64_t a, int64_t b) {
+  return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+static inline int64_t __arrow_integer(const arrow_input_column& column, const struct ArrowArray* array, int64_t k) {
+  const void* values = array->buffers[1];
+  switch (column.kind) {
+  case ARROW_IN_BOOL:
+    return (((const uint8_t*) values)[k / 8] >> (k % 8)) & 1;
+  case ARROW_IN_INT8:
+    return ((const int8_t*) values)[k];
+  case ARROW_IN_UINT8:
+    return ((const uint8_t*) values)[k];
+  case ARROW_IN_INT16:
+  case ARROW_IN_UINT16:
+    return column.kind == ARROW_IN_INT16 ? ((const int16_t*) values)[k] : ((const uint16_t*) values)[k];
+  case ARROW_IN_INT32:
+  case ARROW_IN_DATE32:
+  case ARROW_IN_TIME32:
+    return ((const int32_t*) values)[k];
+  case ARROW_IN_UINT32:
+    return ((const uint32_t*) values)[k];
+  case ARROW_IN_UINT64:
+    if (((const uint64_t*) values)[k] > (uint64_t) INT64_MAX) {
+      throw std::runtime_error("Value of column " + column.name + " is too large for a BIGINT");
+    }
+    return (int64_t) ((const uint64_t*) values)[k];
+  case ARROW_IN_DECIMAL: {
+    __int128 value = ((const __int128*) values)[k];
+    for (int s = 0; s < column.scale; s++) {
+      value /= 10;
+    }
+    return (int64_t) value;
+  }
+  default:
+    return ((const int64_t*) values)[k];
+  }
+}
+
+static inline double __arrow_double(const arrow_input_column& column, const struct ArrowArray* array, int64_t k) {
+  switch (column.kind) {
+  case ARROW_IN_FLOAT:
+    return ((const float*) array->buffers[1])[k];
+  case ARROW_IN_DOUBLE:
+    return ((const double*) array->buffers[1])[k];
+  case ARROW_IN_DECIMAL: {
+    __int128 value = ((const __int128*) array->buffers[1])[k];
+    double scaled = (double) value;
+    for (int s = 0; s < column.scale; s++) {
+      scaled /= 10;
+    }
+    return scaled;
+  }
+  default:
+    return (double) __arrow_integer(column, array, k);
+  }
+}
+
+static void __append_decimal(std::string& out, __int128 value, int scale) {
+  bool negative = value < 0;
+  unsigned __int128 magnitude = negative ? -(unsigned __int128) value : (unsigned __int128) value;
+  char digits[48];
+  int n = 0;
+
+  do {
+    digits[n++] = '0' + (char) (magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0 || n <= scale);
+
+  if (negative) {
+    out += '-';
+  }
+  while (n > 0) {
+    if (n == scale) {
+      out += '.';
+    }
+    out += digits[--n];
+  }
+}
+
+static void __append_time_of_day(std::string& out, int64_t units, int64_t units_per_second, char sep,
+    bool fraction) {
+  // units since midnight as HH<sep>MM<sep>SS, with the fraction of the second if asked
+  int64_t seconds = units / units_per_second;
+  char formatted[32];
+  int n = std::snprintf(formatted, sizeof(formatted), "%02d%c%02d%c%02d", (int) (seconds / 3600), sep,
+      (int) (seconds / 60 % 60), sep, (int) (seconds % 60));
+  out.append(formatted, n);
+
+  if (fraction) {
+    int digits = units_per_second >= 1000000000 ? 9 : 6;
+    int64_t sub = units % units_per_second * (digits == 9 ? 1 : 1000000) / (digits == 9 ? 1 : units_per_second);
+    n = std::snprintf(formatted, sizeof(formatted), ".%0*lld", digits, (long long) sub);
+    out.append(formatted, n);
+  }
+}
+
+static void __append_date(std::string& out, int64_t days) {
+  int64_t y;
+  unsigned m, d;
+  __civil_from_days(days, y, m, d);
+  char formatted[32];
+  int n = std::snprintf(formatted, sizeof(formatted), "%04lld-%02u-%02u", (long long) y, m, d);
+  out.append(formatted, n);
+}
+
+static void __arrow_text(const arrow_input_column& column, const struct ArrowArray* array, int64_t k,
+    std::string& out) {
+  // the value as text in a form DB2 converts to the column's type
+  out.clear();
+  switch (column.kind) {
+  case ARROW_IN_UTF8: {
+    const int32_t* offsets = (const int32_t*) array->buffers[1];
+    out.assign((const char*) array->buffers[2] + offsets[k], offsets[k + 1] - offsets[k]);
+    break;
+  }
+  case ARROW_IN_LARGE_UTF8: {
+    const int64_t* offsets = (const int64_t*) array->buffers[1];
+    out.assign((const char*) array->buffers[2] + offsets[k], offsets[k + 1] - offsets[k]);
+    break;
+  }
+  case ARROW_IN_FLOAT:
+  case ARROW_IN_DOUBLE: {
+    char formatted[32];
+    int n = std::snprintf(formatted, sizeof(formatted), "%.15g", __arrow_double(column, array, k));
+    out.append(formatted, n);
+    break;
+  }
+  case ARROW_IN_DECIMAL:
+    __append_decimal(out, ((const __int128*) array->buffers[1])[k], column.scale);
+    break;
+  case ARROW_IN_DATE32:
+    __append_date(out, __arrow_integer(column, array, k));
+    break;
+  case ARROW_IN_DATE64:
+    __append_date(out, __floor_div(__arrow_integer(column, array, k), 86400000));
+    break;
+  case ARROW_IN_TIME32:
+  case ARROW_IN_TIME64:
+    __append_time_of_day(out, __arrow_integer(column, array, k), column.units_per_second, ':', false);
+    break;
+  case ARROW_IN_TIMESTAMP: {
+    // DB2's own format, yyyy-mm-dd-hh.mm.ss.ffffff
+    int64_t units_per_day = 86400 * column.units_per_second;
+    int64_t units = __arrow_integer(column, array, k);
+    int64_t days = __floor_div(units, units_per_day);
+    __append_date(out, days);
+    out += '-';
+    __append_time_of_day(out, units - days * units_per_day, column.units_per_second, '.', true);
+    break;
+  }
+  default:
+    out = std::to_string(__arrow_integer(column, array, k));
+    break;
+  }
+}
+
+static void __release_batch(struct ArrowArray* batch) {
+  if (batch->release != NULL) {
+    batch->release(batch);
+  }
+  delete batch;
+}
+
+class arrow_batch_reader {
+  // hands out the rows of an Arrow stream chunk by chunk. A chunk that fits in the current batch binds the
+  // direct columns to the batch's own buffers, which the parameter buffers then keep alive. Otherwise the
+  // rows are copied, so that small batches are gathered into full chunks
+public:
+  arrow_batch_reader(struct ArrowArrayStream* source, const std::vector<arrow_input_column>& cols) :
+      stream(source), columns(cols), position(0), has_direct(false) {
+    for (size_t i = 0; i < columns.size(); i++) {
+      has_direct = has_direct || columns[i].direct;
+    }
+  }
+
+  unsigned long fill(data_arrays& data, indic_arrays& null_indicator, unsigned long max_rows) {
+    // the buffers the writer allocated for this set, to go back to after a chunk was bound to a batch
+    std::map<const data_arrays*, data_arrays>::iterator own = owned.find(&data);
+    if (own == owned.end()) {
+      own = owned.insert(std::make_pair(&data, data)).first;
+    }
+
+    unsigned long filled = 0;
+    while (filled < max_rows) {
+      if (!batch || position >= batch->length) {
+        if (!__next_batch()) {
+          break;
+        }
+        continue;
+      }
+
+      unsigned long n = (unsigned long) std::min<int64_t>(batch->length - position, max_rows - filled);
+      if (filled == 0 && has_direct && (n == max_rows || n >= ARROW_DIRECT_MIN_ROWS)) {
+        __bind_rows(data, null_indicator, n);
+        position += n;
+        return n;
+      }
+
+      for (size_t i = 0; i < columns.size(); i++) {
+        if (columns[i].direct) {
+          data[i] = own->second[i];
+        }
+      }
+      __copy_rows(data, null_indicator, filled, n);
+      position += n;
+      filled += n;
+    }
+
+    return filled;
+  }
+
+private:
+  struct ArrowArrayStream* stream;
+  const std::vector<arrow_input_column>& columns;
+  std::shared_ptr<struct ArrowArray> batch;
+  int64_t position;   // next row of batch
+  bool has_direct;
+  std::map<const data_arrays*, data_arrays> owned;
+  std::string scratch;
+  std::vector<SQLWCHAR> utf16;
+
+  bool __next_batch() {
+    std::shared_ptr<struct ArrowArray> next(new struct ArrowArray(), __release_batch);
+    next->release = NULL;
+
+    if (stream->get_next(stream, next.get()) != 0) {
+      const char* error = stream->get_last_error(stream);
+      throw std::runtime_error("Error reading the Arrow stream: " + std::string(error != NULL ? error : "unknown error"));
+    }
+    if (next->release == NULL) {
+      return false;   // end of stream
+    }
+    if (next->n_children != (int64_t) columns.size()) {
+      throw std::runtime_error("Arrow batch has " + std::to_string(next->n_children) + " columns but "
+          + std::to_string(columns.size()) + " were expected");
+    }
+
+    batch = next;
+    position = 0;
+    return true;
+  }
+
+  void __set_indicators(const struct ArrowArray* child, int64_t first, unsigned long n, INDIC_TYPE* indic) {
+    const uint8_t* bitmap = (const uint8_t*) child->buffers[0];
+    if (child->null_count == 0 || bitmap == NULL) {
+      for (unsigned long j = 0; j < n; j++) {
+        indic[j] = 0;
+      }
+      return;
+    }
+    for (unsigned long j = 0; j < n; j++) {
+      int64_t k = first + j;
+      indic[j] = ((bitmap[k / 8] >> (k % 8)) & 1) ? 0 : SQL_NULL_DATA;
+    }
+  }
+
+  void __bind_rows(data_arrays& data, indic_arrays& null_indicator, unsigned long n) {
+    for (size_t i = 0; i < columns.size(); i++) {
+      const struct ArrowArray* child = batch->children[i];
+      int64_t first = child->offset + batch->offset + position;
+      if (columns[i].direct) {
+        // int64 and float64 values are laid out like the SQLBIGINT and SQLDOUBLE parameter arrays
+        SQLPOINTER values = (SQLPOINTER) ((const char*) child->buffers[1] + first * 8);
+        if (columns[i].coltype == COLTYPE_INTEGER) {
+          data[i] = colData(std::shared_ptr<SQLBIGINT>(batch, (SQLBIGINT*) values));
+        } else {
+          data[i] = colData(std::shared_ptr<SQLDOUBLE>(batch, (SQLDOUBLE*) values));
+        }
+        __set_indicators(child, first, n, null_indicator[i].get());
+      }
+    }
+    __copy_rows(data, null_indicator, 0, n, false);
+  }
+
+  void __copy_rows(data_arrays& data, indic_arrays& null_indicator, unsigned long to, unsigned long n,
+      bool direct = true) {
+    // converts n rows of the batch from position into the buffers from row to. The direct columns are
+    // skipped unless direct is set
+    for (size_t i = 0; i < columns.size(); i++) {
+      const arrow_input_column& column = columns[i];
+      if (column.direct && !direct) {
+        continue;
+      }
+
+      const struct ArrowArray* child = batch->children[i];
+      int64_t first = child->offset + batch->offset + position;
+      INDIC_TYPE* indic = null_indicator[i].get() + to;
+      __set_indicators(child, first, n, indic);
+
+      for (unsigned long j = 0; j < n; j++) {
+        if (indic[j] == SQL_NULL_DATA) {
+          continue;
+        }
+        int64_t k = first + j;
+        unsigned long row = to + j;
+
+        if (column.coltype == COLTYPE_INTEGER) {
+          *((SQLBIGINT*) data[i].get() + row) = __arrow_integer(column, child, k);
+        } else if (column.coltype == COLTYPE_NUMERIC) {
+          *((SQLDOUBLE*) data[i].get() + row) = __arrow_double(column, child, k);
+        } else {
+          __arrow_text(column, child, k, scratch);
+          utf16.resize(scratch.size() + 1);
+          size_t units;
+          try {
+            units = encodeUTF8StringAsUTF16(utf16.data(), scratch.data(), scratch.size());
+          } catch (const utf8::exception&) {
+            throw std::runtime_error("Invalid UTF-8 in column " + column.name);
+          }
+          if (units > (size_t) column.width) {
+            throw std::runtime_error("Value of column " + column.name + " is longer than "
+                + std::to_string(column.width) + " characters");
+          }
+          std::memcpy((SQLWCHAR*) data[i].get() + row * (column.width + 1), utf16.data(), (units + 1) * sizeof(SQLWCHAR));
+          indic[j] = SQL_NTS;
+        }
+      }
+    }
+  }
+
+  arrow_batch_reader(const arrow_batch_reader&);
+  arrow_batch_reader& operator=(const arrow_batch_reader&);
+};
+
+write_stats write_arrow_stream(const SQLHDBC& dbc, const std::string& tbl_name, const std::vector<std::string>& col_names,
+    struct ArrowArrayStream* stream, const write_options& options) {
+
+  size_t i;
+
+  if (stream == NULL || stream->release == NULL) {
+    throw std::runtime_error("The Arrow stream has already been released");
+  }
+
+  struct ArrowSchema schema;
+  schema.release = NULL;
+  if (stream->get_schema(stream, &schema) != 0) {
+    const char* error = stream->get_last_error(stream);
+    throw std::runtime_error("Error reading the schema of the Arrow stream: "
+        + std::string(error != NULL ? error : "unknown error"));
+  }
+
+  std::vector<arrow_input_column> columns;
+  std::string schema_error;
+  if (std::string(schema.format) != "+s") {
+    schema_error = "The Arrow stream does not contain record batches";
+  } else {
+    for (int64_t c = 0; c < schema.n_children; c++) {
+      arrow_input_column column;
+      column.name = schema.children[c]->name != NULL ? schema.children[c]->name : "";
+      column.format = schema.children[c]->format;
+      if (schema.children[c]->dictionary != NULL || !__parse_input_format(column)) {
+        schema_error = "Arrow type " + column.format + " of column " + column.name + " cannot be written";
+        break;
+      }
+      columns.push_back(column);
+    }
+  }
+  schema.release(&schema);
+  if (!schema_error.empty()) {
+    throw std::runtime_error(schema_error);
+  }
+
+  std::vector<std::string> names = col_names;
+  if (names.empty()) {
+    for (i = 0; i < columns.size(); i++) {
+      names.push_back(columns[i].name);
+    }
+  }
+  if (names.size() != columns.size() || names.empty()) {
+    throw std::runtime_error("The Arrow stream has " + std::to_string(columns.size()) + " columns but "
+        + std::to_string(names.size()) + " column names were given");
+  }
+
+  // the parameter types come from the target columns, as for dbImportFile
+  std::string select_list = names[0];
+  std::string insert_SQL = "INSERT INTO " + tbl_name + " (" + names[0];
+  for (i = 1; i < names.size(); i++) {
+    select_list += ", " + names[i];
+    insert_SQL += ", " + names[i];
+  }
+  insert_SQL += ") VALUES (?";
+  for (i = 1; i < names.size(); i++) {
+    insert_SQL += ", ?";
+  }
+  insert_SQL += ")";
+
+  std::vector<column_desc> descs = describe_query(dbc, "SELECT " + select_list + " FROM " + tbl_name + " WHERE 1 = 0");
+  std::vector<short> coltypes;
+  std::vector<int> widths;
+  for (i = 0; i < columns.size(); i++) {
+    arrow_input_column& column = columns[i];
+    column.coltype = get_param_coltype(descs[i], column.width);
+    if (column.coltype != COLTYPE_STRING && !__is_numeric_kind(column.kind)) {
+      throw std::runtime_error("Arrow type " + column.format + " of column " + column.name
+          + " cannot be written to numeric column " + names[i]);
+    }
+    column.direct = (column.coltype == COLTYPE_INTEGER && column.kind == ARROW_IN_INT64)
+        || (column.coltype == COLTYPE_NUMERIC && column.kind == ARROW_IN_DOUBLE);
+    coltypes.push_back(column.coltype);
+    widths.push_back(column.coltype == COLTYPE_STRING ? column.width : 0);
+  }
+
+  arrow_batch_reader reader(stream, columns);
+  chunk_source next_chunk = [&](data_arrays& data, indic_arrays& null_indicator, unsigned long max_rows) {
+    return reader.fill(data, null_indicator, max_rows);
+  };
+
+  // the parameters are bound with the types of the named columns, which need not be all of the table's
+  // columns or in table order
+  return write_table_streamed(dbc, tbl_name, insert_SQL, coltypes, widths, next_chunk, options,
+      (unsigned long) -1, descs);
+}
+
+} // namespace
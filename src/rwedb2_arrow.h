@@ -0,0 +1,115 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_arrow.h
+ *
+ *  Query results as Arrow C data interface streams
+ */
+
+#ifndef SRC_RWEDB2_ARROW_H_
+#define SRC_RWEDB2_ARROW_H_
+
+#include <stdint.h>
+#include <string>
+#include <sql.h>
+#include <sqlext.h>
+
+#include "rwedb2_DML.h"
+
+/* The structures of the Arrow C data and stream interfaces. They are meant to be copied into every
+ * project that produces or consumes them. The guards make them compatible with the same definitions
+ * in arrow, nanoarrow and duckdb headers
+ */
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  // Array type description
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowSchema*);
+  // Opaque producer-specific data
+  void* private_data;
+};
+
+struct ArrowArray {
+  // Array data description
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowArray*);
+  // Opaque producer-specific data
+  void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream {
+  // Callbacks providing stream functionality
+  int (*get_schema)(struct ArrowArrayStream*, struct ArrowSchema* out);
+  int (*get_next)(struct ArrowArrayStream*, struct ArrowArray* out);
+  const char* (*get_last_error)(struct ArrowArrayStream*);
+
+  // Release callback
+  void (*release)(struct ArrowArrayStream*);
+
+  // Opaque producer-specific data
+  void* private_data;
+};
+
+#endif  // ARROW_C_STREAM_INTERFACE
+
+namespace rdb2 {
+
+// runs query and fills out with a stream that fetches chunksize rows per record batch. Column types map to
+// int16/int32/int64/float64, utf8 (text and DECFLOAT), decimal128 (DECIMAL), date32, time32[s] and
+// timestamp[us]. Integer and floating point columns are fetched straight into the Arrow buffers.
+// The stream owns a statement on dbc, which must not be used for anything else until the stream is
+// exhausted or released. The statement is freed if the connection is closed first
+void execute_query_stream(const SQLHDBC& dbc, const std::string& query, unsigned int chunksize,
+    struct ArrowArrayStream* out);
+
+// writes every record batch of stream to col_names of tbl_name (the names of the stream's fields if empty),
+// options.chunksize rows at a time. int64 and float64 columns going to integer and floating point columns
+// are bound straight to the Arrow buffers when a batch holds a large enough run of rows. Other columns are
+// converted into the parameter buffers: numbers, booleans and decimals to integers or doubles, and
+// anything (including dates, times and timestamps) to text for other column types. With options.pipelined
+// the stream is read on a worker thread, so it must not be implemented in R
+write_stats write_arrow_stream(const SQLHDBC& dbc, const std::string& tbl_name, const std::vector<std::string>& col_names,
+    struct ArrowArrayStream* stream, const write_options& options);
+
+}
+
+#endif /* SRC_RWEDB2_ARROW_H_ */
@@ -0,0 +1,516 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_cache.cpp
+ *
+ *  Query results cached in files on the client
+ */
+
+#include "rwedb2_cache.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <regex>
+#include <stdexcept>
+#include <unordered_map>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define CACHE_MAGIC "RDB2CAC1"
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_SUFFIX ".rdb2c"
+// sections smaller than this are not worth compressing
+#define CACHE_MIN_COMPRESS_SIZE 256
+
+namespace rdb2 {
+
+static std::mutex cache_stats_mutex;
+static cache_stats stats = { 0, 0, 0, 0, 0, 0 };
+
+static void __count(unsigned long cache_stats::*counter) {
+  std::lock_guard<std::mutex> lock(cache_stats_mutex);
+  (stats.*counter)++;
+}
+
+static void __fnv1a(uint64_t& hash, const std::string& text) {
+  // the length goes first so that the parts of the key cannot run into each other
+  uint64_t length = text.size();
+  const unsigned char* bytes = (const unsigned char*) &length;
+  for (size_t i = 0; i < sizeof(length); i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  for (size_t i = 0; i < text.size(); i++) {
+    hash = (hash ^ (unsigned char) text[i]) * 1099511628211ULL;
+  }
+}
+
+std::string cache_file_path(const cache_options& options, const cache_key& key) {
+  // two FNV-1a hashes with different offset bases give a 128-bit name
+  uint64_t hashes[] = { 14695981039346656037ULL, 9650029242287828579ULL };
+  char name[33];
+
+  for (size_t i = 0; i < 2; i++) {
+    __fnv1a(hashes[i], key.conn_string);
+    __fnv1a(hashes[i], key.sql);
+    __fnv1a(hashes[i], key.params);
+  }
+  std::snprintf(name, sizeof(name), "%016llx%016llx", (unsigned long long) hashes[0], (unsigned long long) hashes[1]);
+
+  return options.dir + "/" + name + CACHE_SUFFIX;
+}
+
+struct cache_entry {
+  std::string path;
+  uint64_t size;
+  time_t mtime;
+};
+
+static std::vector<cache_entry> __list_cache(const std::string& dir) {
+  std::vector<cache_entry> entries;
+  DIR* d = opendir(dir.c_str());
+  if (d == NULL) {
+    return entries;
+  }
+
+  struct dirent* ent;
+  size_t suffix_length = std::strlen(CACHE_SUFFIX);
+  while ((ent = readdir(d)) != NULL) {
+    std::string name = ent->d_name;
+    if (name.size() <= suffix_length || name.compare(name.size() - suffix_length, suffix_length, CACHE_SUFFIX) != 0) {
+      continue;
+    }
+    struct stat st;
+    cache_entry entry;
+    entry.path = dir + "/" + name;
+    if (stat(entry.path.c_str(), &st) == 0) {
+      entry.size = st.st_size;
+      entry.mtime = st.st_mtime;
+      entries.push_back(entry);
+    }
+  }
+  closedir(d);
+
+  return entries;
+}
+
+cached_result::cached_result(const std::string& path) :
+    created(0), nrows(0) {
+  file.reset(new mapped_file(path, false));
+
+  const char* pos = file->begin();
+  const char* end = file->end();
+
+  auto take = [&](size_t size) {
+    if (pos == NULL || (size_t) (end - pos) < size) {
+      throw std::runtime_error("Cache file " + path + " is truncated");
+    }
+    const char* start = pos;
+    pos += size;
+    return start;
+  };
+  auto take_u64 = [&]() {
+    uint64_t value;
+    std::memcpy(&value, take(sizeof(value)), sizeof(value));
+    return value;
+  };
+
+  uint32_t byte_order;
+  if (std::memcmp(take(8), CACHE_MAGIC, 8) != 0) {
+    throw std::runtime_error(path + " is not a cache file of this version");
+  }
+  std::memcpy(&byte_order, take(sizeof(byte_order)), sizeof(byte_order));
+  if (byte_order != CACHE_BYTE_ORDER) {
+    throw std::runtime_error(path + " was written on a machine with a different byte order");
+  }
+
+  std::memcpy(&created, take(sizeof(created)), sizeof(created));
+  nrows = take_u64();
+  uint64_t ncols = take_u64();
+  uint64_t sql_length = take_u64();
+  sql.assign(take(sql_length), sql_length);
+
+  for (uint64_t i = 0; i < ncols; i++) {
+    column_desc desc;
+    std::memcpy(&desc, take(sizeof(desc)), sizeof(desc));
+    col_desc.push_back(desc);
+
+    column_sections column;
+    std::memcpy(&column.coltype, take(sizeof(column.coltype)), sizeof(column.coltype));
+    column.dictionary = (*take(1) != 0);
+    uint64_t nsections = take_u64();
+    for (uint64_t s = 0; s < nsections; s++) {
+      section sec;
+      sec.raw_size = take_u64();
+      sec.stored_size = take_u64();
+      sec.data = take(sec.stored_size);
+      column.sections.push_back(sec);
+    }
+    columns.push_back(column);
+  }
+}
+
+cached_result::~cached_result() {
+}
+
+void cached_result::__read_section(const section& s, void* dest, uint64_t size) const {
+  if (s.raw_size != size) {
+    throw std::runtime_error("Cache file of " + sql + " is corrupt");
+  }
+  if (size == 0) {
+    return;
+  }
+
+  if (s.stored_size == s.raw_size) {
+    std::memcpy(dest, s.data, size);
+    return;
+  }
+
+  uLongf dest_length = size;
+  if (uncompress((Bytef*) dest, &dest_length, (const Bytef*) s.data, s.stored_size) != Z_OK || dest_length != size) {
+    throw std::runtime_error("Cache file of " + sql + " is corrupt");
+  }
+}
+
+void cached_result::read_values(size_t col, void* dest) const {
+  size_t width = (columns[col].coltype == COLTYPE_INTEGER) ? sizeof(int32_t) : sizeof(double);
+  __read_section(columns[col].sections.at(1), dest, nrows * width);
+}
+
+void cached_result::read_strings(size_t col, compact_strings& strings) const {
+  const std::vector<section>& sections = columns[col].sections;
+
+  strings.valid.resize((nrows + 7) / 8);
+  __read_section(sections.at(0), strings.valid.data(), strings.valid.size());
+  strings.offsets.resize(nrows + 1);
+  __read_section(sections.at(1), strings.offsets.data(), strings.offsets.size() * sizeof(uint64_t));
+  strings.data.resize(sections.at(2).raw_size);
+  __read_section(sections.at(2), &strings.data[0], strings.data.size());
+}
+
+void cached_result::read_dictionary(size_t col, compact_strings& dictionary, std::vector<int32_t>& codes) const {
+  const std::vector<section>& sections = columns[col].sections;
+
+  codes.resize(nrows);
+  __read_section(sections.at(1), codes.data(), nrows * sizeof(int32_t));
+
+  size_t count = sections.at(2).raw_size / sizeof(uint64_t) - 1;
+  dictionary.offsets.resize(count + 1);
+  __read_section(sections.at(2), dictionary.offsets.data(), dictionary.offsets.size() * sizeof(uint64_t));
+  dictionary.data.resize(sections.at(3).raw_size);
+  __read_section(sections.at(3), &dictionary.data[0], dictionary.data.size());
+  dictionary.valid.assign((count + 7) / 8, 0xFF);
+}
+
+std::shared_ptr<cached_result> load_cached_result(const cache_options& options, const cache_key& key) {
+  std::string path = cache_file_path(options, key);
+  std::shared_ptr<cached_result> cached;
+
+  if (access(path.c_str(), R_OK) == 0) {
+    try {
+      cached = std::make_shared<cached_result>(path);
+    } catch (const std::exception&) {
+      // written by another version or damaged. It is replaced by the next store
+      unlink(path.c_str());
+    }
+  }
+
+  if (cached && options.ttl > 0 && std::difftime(std::time(NULL), (time_t) cached->get_created()) > options.ttl) {
+    cached.reset();
+    unlink(path.c_str());
+  }
+
+  if (!cached) {
+    __count(&cache_stats::misses);
+    return cached;
+  }
+
+  // the modification time orders the files for eviction, so a hit keeps a file longer
+  utimes(path.c_str(), NULL);
+  __count(&cache_stats::hits);
+  return cached;
+}
+
+class cache_writer {
+  // writes a cache file under a temporary name that is renamed into place when it is complete, so that
+  // other sessions sharing the directory never read a partial file
+public:
+  cache_writer(const std::string& path_, int compression_) :
+      path(path_), compression(compression_) {
+    temp_path = path + ".tmp" + std::to_string((long) getpid());
+    file = std::fopen(temp_path.c_str(), "wb");
+    if (file == NULL) {
+      throw std::runtime_error("Unable to create " + temp_path + ": " + std::strerror(errno));
+    }
+  }
+
+  ~cache_writer() {
+    if (file != NULL) {
+      std::fclose(file);
+      unlink(temp_path.c_str());
+    }
+  }
+
+  void put(const void* data, size_t size) {
+    if (size > 0 && std::fwrite(data, 1, size, file) != size) {
+      throw std::runtime_error("Error while writing " + temp_path + ": " + std::strerror(errno));
+    }
+  }
+
+  void put_u64(uint64_t value) {
+    put(&value, sizeof(value));
+  }
+
+  void put_section(const void* data, size_t size) {
+    put_u64(size);
+    if (compression > 0 && size >= CACHE_MIN_COMPRESS_SIZE) {
+      uLongf compressed_size = compressBound(size);
+      scratch.resize(compressed_size);
+      if (compress2((Bytef*) scratch.data(), &compressed_size, (const Bytef*) data, size, compression) == Z_OK
+          && compressed_size < size) {
+        put_u64(compressed_size);
+        put(scratch.data(), compressed_size);
+        return;
+      }
+    }
+    put_u64(size);
+    put(data, size);
+  }
+
+  void commit() {
+    int ret = std::fclose(file);
+    file = NULL;
+    if (ret != 0 || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+      unlink(temp_path.c_str());
+      throw std::runtime_error("Error while writing " + path + ": " + std::strerror(errno));
+    }
+  }
+
+private:
+  std::string path;
+  std::string temp_path;
+  int compression;
+  FILE* file;
+  std::vector<char> scratch;
+};
+
+static void __put_strings(cache_writer& writer, const read_results& results, size_t col, unsigned long nrows,
+    bool dictionary) {
+  // writes the offsets and data of a string column, or its codes and dictionary
+  const stl_vector_var_data& vec = results.stl_vecs[col];
+  const std::vector<bool>& nulls = results.null_indics[col];
+  auto value = [&](size_t j) {
+    if (vec.compact_data) {
+      const compact_strings& strings = *vec.compact_data;
+      return std::string(strings.data, strings.offsets[j], strings.offsets[j + 1] - strings.offsets[j]);
+    }
+    return vec.string_data[j];
+  };
+
+  compact_strings strings;
+  if (dictionary) {
+    std::unordered_map<std::string, int32_t> codes_of;
+    std::vector<int32_t> codes(nrows, -1);
+    for (size_t j = 0; j < nrows; j++) {
+      if (j < nulls.size() && nulls[j]) {
+        continue;
+      }
+      std::string s = value(j);
+      std::pair<std::unordered_map<std::string, int32_t>::iterator, bool> inserted =
+          codes_of.insert(std::make_pair(s, (int32_t) codes_of.size()));
+      if (inserted.second) {
+        strings.data += s;
+        strings.push_back(true);
+      }
+      codes[j] = inserted.first->second;
+    }
+    writer.put_section(codes.data(), codes.size() * sizeof(int32_t));
+  } else {
+    for (size_t j = 0; j < nrows; j++) {
+      bool valid = !(j < nulls.size() && nulls[j]);
+      if (valid) {
+        strings.data += value(j);
+      }
+      strings.push_back(valid);
+    }
+  }
+  writer.put_section(strings.offsets.data(), strings.offsets.size() * sizeof(uint64_t));
+  writer.put_section(strings.data.data(), strings.data.size());
+}
+
+static bool __use_dictionary(const read_results& results, size_t col, unsigned long nrows) {
+  // worth it when at most half of the values are distinct
+  const stl_vector_var_data& vec = results.stl_vecs[col];
+  const std::vector<bool>& nulls = results.null_indics[col];
+  std::unordered_map<std::string, bool> seen;
+  unsigned long limit = nrows / 2;
+
+  if (nrows < 2) {
+    return false;
+  }
+  for (size_t j = 0; j < nrows; j++) {
+    if (j < nulls.size() && nulls[j]) {
+      continue;
+    }
+    if (vec.compact_data) {
+      const compact_strings& strings = *vec.compact_data;
+      seen[std::string(strings.data, strings.offsets[j], strings.offsets[j + 1] - strings.offsets[j])] = true;
+    } else {
+      seen[vec.string_data[j]] = true;
+    }
+    if (seen.size() > limit) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void __evict(const cache_options& options) {
+  // removes the least recently used files until the cache fits in max_bytes
+  if (options.max_bytes == 0) {
+    return;
+  }
+
+  std::vector<cache_entry> entries = __list_cache(options.dir);
+  uint64_t total = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    total += entries[i].size;
+  }
+
+  std::sort(entries.begin(), entries.end(),
+      [](const cache_entry& a, const cache_entry& b) { return a.mtime < b.mtime; });
+  for (size_t i = 0; i < entries.size() && total > options.max_bytes; i++) {
+    if (unlink(entries[i].path.c_str()) == 0) {
+      total -= entries[i].size;
+      __count(&cache_stats::evictions);
+    }
+  }
+}
+
+void store_cached_result(const cache_options& options, const cache_key& key, const read_results& results,
+    const read_options& nulls) {
+  if (results.spilled) {
+    throw std::runtime_error("Results that were spilled to disk cannot be cached");
+  }
+
+  if (mkdir(options.dir.c_str(), 0700) != 0 && errno != EEXIST) {
+    throw std::runtime_error("Unable to create the cache directory " + options.dir + ": " + std::strerror(errno));
+  }
+
+  size_t ncols = results.col_desc.size();
+  unsigned long nrows = (ncols > 0) ? results.null_indics[0].size() : 0;
+  int64_t created = (int64_t) std::time(NULL);
+  uint32_t byte_order = CACHE_BYTE_ORDER;
+
+  cache_writer writer(cache_file_path(options, key), options.compression);
+  writer.put(CACHE_MAGIC, 8);
+  writer.put(&byte_order, sizeof(byte_order));
+  writer.put(&created, sizeof(created));
+  writer.put_u64(nrows);
+  writer.put_u64(ncols);
+  writer.put_u64(key.sql.size());
+  writer.put(key.sql.data(), key.sql.size());
+
+  for (size_t i = 0; i < ncols; i++) {
+    const std::vector<bool>& null_indics = results.null_indics[i];
+    short coltype = result_coltype(results.col_desc[i]);
+    // binary LOBs are read back as raw vectors, which are never shared, so they are always stored plain
+    bool dictionary = (coltype == COLTYPE_STRING) && options.dictionary && !is_binary_lob(results.col_desc[i])
+        && __use_dictionary(results, i, nrows);
+    uint8_t dictionary_flag = dictionary ? 1 : 0;
+
+    writer.put(&results.col_desc[i], sizeof(column_desc));
+    writer.put(&coltype, sizeof(coltype));
+    writer.put(&dictionary_flag, 1);
+    writer.put_u64(coltype != COLTYPE_STRING ? 2 : (dictionary ? 4 : 3));
+
+    std::vector<uint8_t> valid((nrows + 7) / 8, 0);
+    for (size_t j = 0; j < nrows; j++) {
+      if (!(j < null_indics.size() && null_indics[j])) {
+        valid[j / 8] |= (uint8_t) (1 << (j % 8));
+      }
+    }
+    writer.put_section(valid.data(), valid.size());
+
+    if (coltype == COLTYPE_INTEGER) {
+      std::vector<int32_t> values(nrows);
+      for (size_t j = 0; j < nrows; j++) {
+        values[j] = null_indics[j] ? nulls.null_integer : results.stl_vecs[i].integer_data[j];
+      }
+      writer.put_section(values.data(), values.size() * sizeof(int32_t));
+    } else if (coltype == COLTYPE_NUMERIC) {
+      std::vector<double> values(nrows);
+      for (size_t j = 0; j < nrows; j++) {
+        values[j] = null_indics[j] ? nulls.null_double : results.stl_vecs[i].numeric_data[j];
+      }
+      writer.put_section(values.data(), values.size() * sizeof(double));
+    } else {
+      __put_strings(writer, results, i, nrows, dictionary);
+    }
+  }
+
+  writer.commit();
+  __count(&cache_stats::stores);
+
+  __evict(options);
+}
+
+unsigned long invalidate_cached_results(const cache_options& options, const std::string& pattern) {
+  std::vector<cache_entry> entries = __list_cache(options.dir);
+  std::regex re;
+  unsigned long removed = 0;
+
+  if (!pattern.empty()) {
+    re.assign(pattern, std::regex::ECMAScript);
+  }
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    bool matches = pattern.empty();
+    if (!matches) {
+      try {
+        matches = std::regex_search(cached_result(entries[i].path).get_sql(), re);
+      } catch (const std::runtime_error&) {
+        matches = true;   // unreadable files are of no use to anyone
+      }
+    }
+    if (matches && unlink(entries[i].path.c_str()) == 0) {
+      removed++;
+    }
+  }
+
+  return removed;
+}
+
+cache_stats get_cache_stats(const cache_options& options) {
+  cache_stats current;
+  {
+    std::lock_guard<std::mutex> lock(cache_stats_mutex);
+    current = stats;
+  }
+
+  std::vector<cache_entry> entries = __list_cache(options.dir);
+  current.files = entries.size();
+  current.bytes = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    current.bytes += entries[i].size;
+  }
+
+  return current;
+}
+
+} // namespace
@@ -0,0 +1,153 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_cache.h
+ *
+ *  Query results cached in files on the client
+ */
+
+#ifndef SRC_RWEDB2_CACHE_H_
+#define SRC_RWEDB2_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rwedb2_DML.h"
+
+namespace rdb2 {
+
+struct cache_options {
+  std::string dir;          // directory of the cache files
+  double ttl;               // seconds a result stays valid, <= 0 for no limit
+  uint64_t max_bytes;       // the oldest files are evicted once the cache grows beyond this, 0 for no limit
+  bool dictionary;          // dictionary encode string columns with many repeated values
+  int compression;          // zlib level of the column data, 0 to store it uncompressed
+
+  cache_options() {
+    ttl = 3600;
+    max_bytes = (uint64_t) 1 << 30;
+    dictionary = true;
+    compression = 1;
+  }
+};
+
+struct cache_key {
+  // a result is cached for the connection string, the SQL text and the parameter values. Only a digest of
+  // the key is kept in the file so that no credentials end up on disk
+  std::string conn_string;
+  std::string sql;
+  std::string params;
+};
+
+struct cache_stats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long stores;
+  unsigned long evictions;
+  unsigned long files;      // files in the cache directory
+  uint64_t bytes;           // and their total size
+};
+
+class cached_result {
+  /* A cache file mapped into memory. The file holds a header (the SQL text, the creation time and the
+   * column descriptions) followed by the sections of each column:
+   *   integer and double columns:  validity bitmap, values (with the null values of the stored result)
+   *   string columns:              validity bitmap, uint64 offsets, UTF-8 data
+   *   dictionary encoded strings:  validity bitmap, int32 codes (-1 for NA), dictionary offsets and data
+   * Each section is compressed with zlib unless that does not make it smaller.
+   */
+public:
+  explicit cached_result(const std::string& path);
+  ~cached_result();
+
+  const std::string& get_sql() const {
+    return sql;
+  }
+
+  double get_created() const {
+    return (double) created;
+  }
+
+  unsigned long rows() const {
+    return nrows;
+  }
+
+  const std::vector<column_desc>& get_col_desc() const {
+    return col_desc;
+  }
+
+  short coltype(size_t col) const {
+    return columns[col].coltype;
+  }
+
+  bool is_dictionary(size_t col) const {
+    return columns[col].dictionary;
+  }
+
+  // copies the values of an integer (int32) or double column into dest, which must hold rows() values
+  void read_values(size_t col, void* dest) const;
+
+  // reads a plain string column
+  void read_strings(size_t col, compact_strings& strings) const;
+
+  // reads a dictionary encoded string column. codes has one entry per row, -1 for NA
+  void read_dictionary(size_t col, compact_strings& dictionary, std::vector<int32_t>& codes) const;
+
+private:
+  struct section {
+    const char* data;
+    uint64_t raw_size;
+    uint64_t stored_size;
+  };
+
+  struct column_sections {
+    short coltype;
+    bool dictionary;
+    std::vector<section> sections;
+  };
+
+  std::unique_ptr<mapped_file> file;
+  std::string sql;
+  int64_t created;
+  unsigned long nrows;
+  std::vector<column_desc> col_desc;
+  std::vector<column_sections> columns;
+
+  void __read_section(const section& s, void* dest, uint64_t size) const;
+
+  cached_result(const cached_result&);
+  cached_result& operator=(const cached_result&);
+};
+
+// the file of key in the cache directory
+std::string cache_file_path(const cache_options& options, const cache_key& key);
+
+// returns the cached result of key, or an empty pointer if there is none or it has expired
+std::shared_ptr<cached_result> load_cached_result(const cache_options& options, const cache_key& key);
+
+// caches results, which must not have been spilled, and evicts the oldest files if the cache is full.
+// The null rows of integer and double columns get the null values of nulls
+void store_cached_result(const cache_options& options, const cache_key& key, const read_results& results,
+    const read_options& nulls);
+
+// removes the cached results whose SQL text matches the regular expression pattern, or all of them if
+// pattern is empty. Returns the number of files removed
+unsigned long invalidate_cached_results(const cache_options& options, const std::string& pattern);
+
+cache_stats get_cache_stats(const cache_options& options);
+
+}
+
+#endif /* SRC_RWEDB2_CACHE_H_ */
@@ -0,0 +1,143 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_copy.cpp
+ *
+ *  Copies query results from one connection into a table on another
+ */
+
+#include "rwedb2.h"
+
+namespace rdb2 {
+
+static void __bind_copy_cols(SQLHSTMT stmt, const std::vector<short>& coltypes, const std::vector<int>& widths,
+    data_arrays& data, indic_arrays& null_indicator) {
+  // binds the result columns to a set of parameter buffers, so that the rows are fetched in the layout
+  // the insert reads them in. Text columns come back with their length in bytes in the indicator, which
+  // is also what the insert expects
+  SQLRETURN ret;
+
+  for (size_t i = 0; i < coltypes.size(); i++) {
+    if (coltypes[i] == COLTYPE_STRING) {
+      ret = SQLBindCol(stmt, i + 1, SQL_C_WCHAR, data[i].get(), sizeof(SQLWCHAR) * (widths[i] + 1),
+          (SQLLEN*) null_indicator[i].get());
+    } else if (coltypes[i] == COLTYPE_INTEGER) {
+      ret = SQLBindCol(stmt, i + 1, SQL_C_SBIGINT, data[i].get(), sizeof(SQLBIGINT),
+          (SQLLEN*) null_indicator[i].get());
+    } else {
+      ret = SQLBindCol(stmt, i + 1, SQL_C_DOUBLE, data[i].get(), sizeof(SQLDOUBLE),
+          (SQLLEN*) null_indicator[i].get());
+    }
+
+    if (!SQL_SUCCEEDED(ret)) {
+      throw std::runtime_error(extract_error("Error in SQLBindCol in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+    }
+  }
+}
+
+write_stats copy_query(const SQLHDBC& src_dbc, const std::string& query, const SQLHDBC& dst_dbc,
+    const std::string& dst_table, const write_options& options) {
+
+  struct odbc_stmt_handle src_stmt;
+  size_t i;
+
+  unsigned long chunksize = std::max(options.chunksize, 1UL);
+  std::vector<column_desc> col_desc = open_query(src_dbc, src_stmt, query, chunksize);
+  size_t ncols = col_desc.size();
+
+  std::vector<short> coltypes(ncols);
+  std::vector<int> widths(ncols);
+  for (i = 0; i < ncols; i++) {
+    coltypes[i] = get_param_coltype(col_desc[i], widths[i]);
+  }
+
+  // the rowsets are fetched into buffers sized for the declared width of every column (and there are two
+  // sets when pipelined), so the rowset is also limited by a byte budget. It can change until the first fetch
+  unsigned long budget_rows = rows_within_budget(coltypes, widths, chunksize);
+  if (budget_rows < chunksize) {
+    chunksize = budget_rows;
+    if (!SQL_SUCCEEDED(SQLSetStmtAttr(src_stmt.stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER) (long) chunksize,
+        SQL_IS_INTEGER))) {
+      throw std::runtime_error(extract_error("Error in SQLSetStmtAttr in " + std::string(__func__), src_stmt.stmt,
+          SQL_HANDLE_STMT));
+    }
+  }
+
+  // DB2 only writes 32 bits here
+  SQLULEN rows_fetched = 0;
+  std::unique_ptr<SQLUSMALLINT[]> row_status(new SQLUSMALLINT[chunksize]);
+
+  if (!SQL_SUCCEEDED(SQLSetStmtAttr(src_stmt.stmt, SQL_ATTR_ROWS_FETCHED_PTR, &rows_fetched, 0))
+      || !SQL_SUCCEEDED(SQLSetStmtAttr(src_stmt.stmt, SQL_ATTR_ROW_STATUS_PTR, row_status.get(), 0))) {
+    throw std::runtime_error(
+        extract_error("Error setting fetch attributes in " + std::string(__func__), src_stmt.stmt, SQL_HANDLE_STMT));
+  }
+
+  // each chunk is fetched straight into the buffer set the writer hands us. When the writer is pipelined
+  // this runs on its worker thread, which only uses the source connection
+  chunk_source fetch = [&](data_arrays& data, indic_arrays& null_indicator, unsigned long max_rows) {
+    if (max_rows < chunksize) {
+      throw std::runtime_error("Buffers for " + std::to_string(max_rows) + " rows cannot hold a rowset of "
+          + std::to_string(chunksize));
+    }
+
+    __bind_copy_cols(src_stmt.stmt, coltypes, widths, data, null_indicator);
+
+    SQLRETURN ret = SQLFetchScroll(src_stmt.stmt, SQL_FETCH_NEXT, 0);
+    if (ret == SQL_NO_DATA) {
+      return 0UL;
+    }
+    if (!SQL_SUCCEEDED(ret)) {
+      throw std::runtime_error(extract_error("Error while fetching from the source of the copy", src_stmt.stmt,
+          SQL_HANDLE_STMT));
+    }
+
+    unsigned long count = (SQLUINTEGER) rows_fetched;
+    for (unsigned long j = 0; j < count; j++) {
+      if (row_status[j] != SQL_SUCCESS && row_status[j] != SQL_SUCCESS_WITH_INFO) {
+        throw std::runtime_error(extract_error("Error " + std::to_string(row_status[j]) + " when reading row "
+            + std::to_string(j) + " in " + std::string(__func__), src_stmt.stmt, SQL_HANDLE_STMT));
+      }
+    }
+    for (size_t k = 0; k < ncols; k++) {
+      if (coltypes[k] != COLTYPE_STRING) {
+        continue;
+      }
+      INDIC_TYPE* indic = null_indicator[k].get();
+      for (unsigned long j = 0; j < count; j++) {
+        if (indic[j] != SQL_NULL_DATA && (indic[j] < 0 || indic[j] > (INDIC_TYPE) (widths[k] * sizeof(SQLWCHAR)))) {
+          throw std::runtime_error("Value of column " + std::string(reinterpret_cast<const char*>(col_desc[k].colname))
+              + " is longer than " + std::to_string(widths[k]) + " characters and cannot be copied");
+        }
+      }
+    }
+    return count;
+  };
+
+  write_options copy_options = options;
+  copy_options.chunksize = chunksize;
+  if (src_dbc == dst_dbc) {
+    // one connection cannot fetch and insert at the same time
+    copy_options.pipelined = false;
+  }
+
+  std::string insert_SQL = "INSERT INTO " + dst_table + " VALUES (?";
+  for (i = 1; i < ncols; i++) {
+    insert_SQL += ", ?";
+  }
+  insert_SQL += ")";
+
+  return write_table_streamed(dst_dbc, dst_table, insert_SQL, coltypes, widths, fetch, copy_options, chunksize);
+}
+
+} // namespace
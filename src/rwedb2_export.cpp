@@ -0,0 +1,299 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_export.cpp
+ *
+ *  Streams query results to delimited text files
+ */
+
+#include "rwedb2.h"
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <zlib.h>
+
+#include "utf8.h"
+
+// size of the output buffer. Rows are formatted into it and it is written out whenever it fills up
+#define EXPORT_BUFFER_SIZE (4 * 1024 * 1024)
+
+namespace rdb2 {
+
+class export_file {
+  // plain or gzip compressed output file. Closed (without reporting errors) if it goes out of scope
+  // while still open
+public:
+  export_file(const std::string& file_path, int compress) :
+      path(file_path), file(NULL), gz(NULL) {
+    if (compress == EXPORT_COMPRESS_GZIP) {
+      gz = gzopen(path.c_str(), "wb");
+      if (gz != NULL) {
+        gzbuffer(gz, 256 * 1024);
+      }
+    } else {
+      file = std::fopen(path.c_str(), "wb");
+    }
+
+    if (file == NULL && gz == NULL) {
+      throw std::runtime_error("Unable to open " + path + " for writing: " + std::strerror(errno));
+    }
+  }
+
+  ~export_file() {
+    if (file != NULL) {
+      std::fclose(file);
+    }
+    if (gz != NULL) {
+      gzclose(gz);
+    }
+  }
+
+  void write(const std::string& buffer) {
+    if (buffer.empty()) {
+      return;
+    }
+
+    bool written;
+    if (gz != NULL) {
+      written = gzwrite(gz, buffer.data(), (unsigned) buffer.size()) == (int) buffer.size();
+    } else {
+      written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    }
+
+    if (!written) {
+      throw std::runtime_error("Error while writing to " + path);
+    }
+  }
+
+  void close() {
+    int ret = 0;
+    if (file != NULL) {
+      ret = std::fclose(file);
+      file = NULL;
+    }
+    if (gz != NULL) {
+      ret = (gzclose(gz) == Z_OK) ? 0 : EOF;
+      gz = NULL;
+    }
+
+    if (ret != 0) {
+      throw std::runtime_error("Error while closing " + path);
+    }
+  }
+
+private:
+  std::string path;
+  FILE* file;
+  gzFile gz;
+
+  export_file(const export_file&);
+  export_file& operator=(const export_file&);
+};
+
+static inline void __append_integer(std::string& out, long long value) {
+  char digits[24];
+  int n = 0;
+  unsigned long long magnitude = (value < 0) ? 0ULL - (unsigned long long) value : (unsigned long long) value;
+
+  do {
+    digits[n++] = '0' + (char) (magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+
+  if (value < 0) {
+    out += '-';
+  }
+  while (n > 0) {
+    out += digits[--n];
+  }
+}
+
+static inline void __append_double(std::string& out, double value) {
+  // 15 significant digits, as R's write.csv
+  char formatted[32];
+  int n = std::snprintf(formatted, sizeof(formatted), "%.15g", value);
+  out.append(formatted, n);
+}
+
+static void __append_quoted(std::string& out, const std::string& value) {
+  out += '"';
+  for (size_t k = 0; k < value.size(); k++) {
+    if (value[k] == '"') {
+      out += '"';
+    }
+    out += value[k];
+  }
+  out += '"';
+}
+
+static void __append_hex(std::string& out, const std::string& bytes) {
+  // binary LOBs are written as hexadecimal digits, the form BLOB(X'...') literals take
+  static const char digits[] = "0123456789ABCDEF";
+  for (size_t k = 0; k < bytes.size(); k++) {
+    unsigned char byte = (unsigned char) bytes[k];
+    out += digits[byte >> 4];
+    out += digits[byte & 0x0F];
+  }
+}
+
+static void __append_string(std::string& out, const SQLWCHAR* value, SQLLEN bytes, int field_width, bool quote) {
+  // converts a fetched UTF-16 value straight into the output buffer, doubling any quotes
+  SQLLEN units = bytes / sizeof(SQLWCHAR);
+  if (units > field_width - 1) {
+    units = field_width - 1;   // truncated by the driver
+  }
+
+  size_t start = out.size();
+  if (quote) {
+    out += '"';
+  }
+  utf8::utf16to8(value, value + units, std::back_inserter(out));
+
+  if (quote) {
+    if (std::memchr(out.data() + start + 1, '"', out.size() - start - 1) != NULL) {
+      std::string unquoted = out.substr(start + 1);
+      out.resize(start);
+      __append_quoted(out, unquoted);
+      return;
+    }
+    out += '"';
+  }
+}
+
+static void __format_rowset(std::string& out, const std::vector<column_desc>& col_desc, const fetch_buffers& buffers,
+    unsigned long row_count, const std::vector<int>& field_widths, const export_options& options) {
+  // appends row_count rows from the fetch buffers to out
+  size_t ncols = col_desc.size();
+  size_t i;
+  unsigned long j;
+
+  for (j = 0; j < row_count; j++) {
+    for (i = 0; i < ncols; i++) {
+      if (i > 0) {
+        out += options.sep;
+      }
+
+      // DB2 only writes 32-bit indicators, see __fetch_bound
+      INDIC_TYPE indic = ((INDIC_TYPE*) buffers.indicator[i].get())[j];
+      if (indic == SQL_NULL_DATA) {
+        out += options.na;
+        continue;
+      }
+
+      const void* data = buffers.data[i].get();
+      switch (col_desc[i].type) {
+      case SQL_CHAR:
+      case SQL_VARCHAR:
+        __append_string(out, (const SQLWCHAR*) data + j * field_widths[i], indic, field_widths[i], options.quote);
+        break;
+      case SQL_DECIMAL:
+      case SQL_NUMERIC:
+      case SQL_DECFLOAT:
+      case SQL_TYPE_DATE:
+      case SQL_TYPE_TIME:
+      case SQL_TYPE_TIMESTAMP:
+        __append_string(out, (const SQLWCHAR*) data + j * field_widths[i], indic, field_widths[i], false);
+        break;
+      case SQL_INTEGER:
+        __append_integer(out, ((const SQLINTEGER*) data)[j]);
+        break;
+      case SQL_SMALLINT:
+        __append_integer(out, ((const SQLSMALLINT*) data)[j]);
+        break;
+      case SQL_BIGINT:
+        __append_integer(out, ((const SQLBIGINT*) data)[j]);
+        break;
+      case SQL_REAL:
+      case SQL_DOUBLE:
+      case SQL_FLOAT:
+        __append_double(out, ((const SQLDOUBLE*) data)[j]);
+        break;
+      default:
+        if (is_binary_lob(col_desc[i])) {
+          __append_hex(out, buffers.lob_values[i][j]);
+        } else if (is_lob(col_desc[i]) && options.quote) {
+          __append_quoted(out, buffers.lob_values[i][j]);
+        } else if (is_lob(col_desc[i])) {
+          out += buffers.lob_values[i][j];
+        }
+        break;
+      }
+    }
+    out += '\n';
+  }
+}
+
+export_stats export_query(const SQLHDBC& dbc, const std::string& query, const std::string& path,
+    const export_options& options) {
+
+  export_stats stats;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<int> field_widths;
+  bool started = false;
+  std::string out;
+  out.reserve(EXPORT_BUFFER_SIZE + 64 * 1024);
+
+  try {
+    export_file file(path, options.compress);
+
+    rowset_function write_rows = [&](const std::vector<column_desc>& col_desc, const fetch_buffers& buffers,
+        unsigned long row_count) {
+      if (!started) {
+        // first call, before any rows are fetched
+        started = true;
+        for (size_t i = 0; i < col_desc.size(); i++) {
+          field_widths.push_back(bound_field_width(col_desc[i]));
+          if (options.header) {
+            if (i > 0) {
+              out += options.sep;
+            }
+            std::string name(reinterpret_cast<const char*>(col_desc[i].colname));
+            if (options.quote) {
+              __append_quoted(out, name);
+            } else {
+              out += name;
+            }
+          }
+        }
+        if (options.header) {
+          out += '\n';
+        }
+      }
+
+      __format_rowset(out, col_desc, buffers, row_count, field_widths, options);
+
+      if (out.size() >= EXPORT_BUFFER_SIZE) {
+        file.write(out);
+        stats.bytes += out.size();
+        out.clear();
+      }
+    };
+
+    stats.rows = stream_query(dbc, query, options.chunksize, write_rows);
+
+    file.write(out);
+    stats.bytes += out.size();
+    file.close();
+  } catch (...) {
+    // do not leave a partial file behind for a downstream job to pick up
+    std::remove(path.c_str());
+    throw;
+  }
+
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  return stats;
+}
+
+} // namespace
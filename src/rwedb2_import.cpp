@@ -0,0 +1,483 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_import.cpp
+ *
+ *  Loads delimited text files into tables
+ */
+
+#include "rwedb2.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <thread>
+#include <algorithm>
+
+#include "utf8.h"
+
+// longest number we try to parse
+#define IMPORT_MAX_NUMBER_LENGTH 63
+
+namespace rdb2 {
+
+struct import_record {
+  const char* start;
+  const char* end;     // excluding the line terminator
+  unsigned long line;  // 1-based line number where the record starts
+};
+
+struct import_column {
+  std::string name;
+  short coltype;
+  int width;   // longest string in UTF-16 code units for COLTYPE_STRING columns
+  bool character;  // CHAR, VARCHAR, GRAPHIC or CLOB column. Other types (eg. DATE) are also bound as strings
+};
+
+struct import_scratch {
+  // per thread buffers for fields that have to be copied before they are converted
+  std::string unquoted;
+  std::vector<SQLWCHAR> utf16;
+  char number[IMPORT_MAX_NUMBER_LENGTH + 1];
+};
+
+static const char* __next_record(const char* pos, const char* end, char quote, unsigned long& newlines) {
+  // returns the start of the record after the one at pos. Line breaks inside quoted fields are part of the field
+  bool in_quotes = false;
+
+  newlines = 0;
+  while (pos < end) {
+    const char* eol = (const char*) std::memchr(pos, '\n', end - pos);
+    if (eol == NULL) {
+      eol = end;
+    }
+
+    if (quote != 0) {
+      for (const char* q = pos; (q = (const char*) std::memchr(q, quote, eol - q)) != NULL; q++) {
+        in_quotes = !in_quotes;
+      }
+    }
+
+    if (eol == end) {
+      return end;
+    }
+
+    newlines++;
+    pos = eol + 1;
+    if (!in_quotes) {
+      return pos;
+    }
+  }
+
+  return end;
+}
+
+static const char* __next_field(const char* pos, const char* end, char sep, char quote, std::string& unquoted,
+    const char*& field, size_t& length, bool& quoted) {
+  // finds the field starting at pos and returns the position after it (at the separator or end). Quoted
+  // fields with doubled quotes are unescaped into unquoted, which field then points to
+  quoted = (quote != 0 && pos < end && *pos == quote);
+
+  if (!quoted) {
+    const char* stop = (const char*) std::memchr(pos, sep, end - pos);
+    if (stop == NULL) {
+      stop = end;
+    }
+    field = pos;
+    length = stop - pos;
+    return stop;
+  }
+
+  const char* start = ++pos;
+  bool escaped = false;
+  while (true) {
+    const char* q = (const char*) std::memchr(pos, quote, end - pos);
+    if (q == NULL) {
+      throw std::runtime_error("unterminated quoted field");
+    }
+    if (q + 1 < end && q[1] == quote) {
+      // doubled quote inside the field
+      if (!escaped) {
+        unquoted.assign(start, q + 1);
+        escaped = true;
+      } else {
+        unquoted.append(pos, q + 1);
+      }
+      pos = q + 2;
+      continue;
+    }
+
+    if (escaped) {
+      unquoted.append(pos, q);
+      field = unquoted.data();
+      length = unquoted.size();
+    } else {
+      field = start;
+      length = q - start;
+    }
+    pos = q + 1;
+    if (pos < end && *pos != sep) {
+      throw std::runtime_error("unexpected character after closing quote");
+    }
+    return pos;
+  }
+}
+
+static void __store_field(const import_column& column, colData& data, INDIC_TYPE* indic, unsigned long row,
+    const char* field, size_t length, import_scratch& scratch) {
+  // converts one field into row of the column's parameter buffer. Throws with a short reason if it cannot
+  if (column.coltype == COLTYPE_STRING) {
+    size_t field_width = column.width + 1;
+    SQLWCHAR* dest = (SQLWCHAR*) data.get() + row * field_width;
+    size_t units;
+
+    try {
+      if (length <= (size_t) column.width) {
+        // UTF-16 never needs more code units than UTF-8 needs bytes so this fits in the field
+        units = encodeUTF8StringAsUTF16(dest, field, length);
+      } else {
+        scratch.utf16.resize(length + 1);
+        units = encodeUTF8StringAsUTF16(scratch.utf16.data(), field, length);
+        if (units > (size_t) column.width) {
+          throw std::runtime_error("value too long for column " + column.name);
+        }
+        std::memcpy(dest, scratch.utf16.data(), (units + 1) * sizeof(SQLWCHAR));
+      }
+    } catch (const utf8::exception&) {
+      throw std::runtime_error("invalid UTF-8 in column " + column.name);
+    }
+    indic[row] = SQL_NTS;
+    return;
+  }
+
+  if (length > IMPORT_MAX_NUMBER_LENGTH) {
+    throw std::runtime_error("value too long for column " + column.name);
+  }
+  std::memcpy(scratch.number, field, length);
+  scratch.number[length] = 0;
+
+  // surrounding blanks are allowed
+  char* parsed_end;
+  errno = 0;
+  if (column.coltype == COLTYPE_INTEGER) {
+    *((SQLBIGINT*) data.get() + row) = std::strtoll(scratch.number, &parsed_end, 10);
+  } else {
+    *((SQLDOUBLE*) data.get() + row) = std::strtod(scratch.number, &parsed_end);
+  }
+  while (*parsed_end == ' ' || *parsed_end == '\t') {
+    parsed_end++;
+  }
+  if (parsed_end == scratch.number || *parsed_end != 0 || errno == ERANGE) {
+    throw std::runtime_error("invalid number in column " + column.name);
+  }
+  indic[row] = 0;
+}
+
+static std::string __parse_record(const import_record& record, const std::vector<import_column>& columns,
+    const std::vector<size_t>& field_columns, const import_options& options, data_arrays& data,
+    indic_arrays& null_indicator, unsigned long row, import_scratch& scratch) {
+  // parses record into row of the parameter buffers. Returns why the record was rejected, or an empty string
+  const char* pos = record.start;
+  const char* field;
+  size_t length;
+  bool quoted;
+  size_t f = 0;
+
+  try {
+    for (f = 0; f < field_columns.size(); f++) {
+      if (f > 0) {
+        if (pos >= record.end) {
+          break;
+        }
+        pos++;  // separator
+      }
+
+      pos = __next_field(pos, record.end, options.sep, options.quote, scratch.unquoted, field, length, quoted);
+
+      size_t i = field_columns[f];
+      bool is_null = !quoted && ((length == options.na.size() && std::memcmp(field, options.na.data(), length) == 0)
+          || (length == 0 && !columns[i].character));
+      if (is_null) {
+        null_indicator[i][row] = SQL_NULL_DATA;
+      } else {
+        __store_field(columns[i], data[i], null_indicator[i].get(), row, field, length, scratch);
+      }
+    }
+  } catch (const std::runtime_error& e) {
+    return e.what();
+  }
+
+  if (f < field_columns.size()) {
+    return "expected " + std::to_string(field_columns.size()) + " fields but found " + std::to_string(f);
+  }
+  if (pos < record.end) {
+    return "expected " + std::to_string(field_columns.size()) + " fields but found more";
+  }
+
+  return "";
+}
+
+static std::vector<std::string> __split_header(const import_record& record, const import_options& options) {
+  std::vector<std::string> names;
+  std::string unquoted;
+  const char* pos = record.start;
+  const char* field;
+  size_t length;
+  bool quoted;
+
+  while (true) {
+    pos = __next_field(pos, record.end, options.sep, options.quote, unquoted, field, length, quoted);
+    names.push_back(std::string(field, length));
+    if (pos >= record.end) {
+      break;
+    }
+    pos++;
+  }
+
+  return names;
+}
+
+static void __move_row(const std::vector<import_column>& columns, data_arrays& data, indic_arrays& null_indicator,
+    unsigned long from, unsigned long to) {
+  for (size_t i = 0; i < columns.size(); i++) {
+    null_indicator[i][to] = null_indicator[i][from];
+    if (columns[i].coltype == COLTYPE_STRING) {
+      size_t field_width = columns[i].width + 1;
+      std::memcpy((SQLWCHAR*) data[i].get() + to * field_width, (SQLWCHAR*) data[i].get() + from * field_width,
+          field_width * sizeof(SQLWCHAR));
+    } else if (columns[i].coltype == COLTYPE_INTEGER) {
+      *((SQLBIGINT*) data[i].get() + to) = *((SQLBIGINT*) data[i].get() + from);
+    } else {
+      *((SQLDOUBLE*) data[i].get() + to) = *((SQLDOUBLE*) data[i].get() + from);
+    }
+  }
+}
+
+static std::string __to_upper(std::string name) {
+  for (size_t k = 0; k < name.size(); k++) {
+    name[k] = std::toupper((unsigned char) name[k]);
+  }
+  return name;
+}
+
+static import_column __get_import_column(const column_desc& desc) {
+  import_column column;
+  column.name = reinterpret_cast<const char*>(desc.colname);
+  column.coltype = get_param_coltype(desc, column.width);
+
+  switch (desc.type) {
+  case SQL_CHAR:
+  case SQL_VARCHAR:
+  case SQL_LONGVARCHAR:
+  case SQL_WCHAR:
+  case SQL_WVARCHAR:
+  case SQL_WLONGVARCHAR:
+  case SQL_GRAPHIC:
+  case SQL_VARGRAPHIC:
+  case SQL_LONGVARGRAPHIC:
+  case SQL_CLOB:
+  case SQL_DBCLOB:
+    column.character = true;
+    break;
+  default:
+    column.character = false;
+  }
+  return column;
+}
+
+class delimited_reader {
+  // hands out the records of a mapped file chunk by chunk, parsed straight into the parameter buffers
+public:
+  delimited_reader(const char* begin, const char* end, const std::vector<import_column>& cols,
+      const std::vector<size_t>& field_cols, const import_options& opts, import_stats& import_stats) :
+      pos(begin), stop(end), line(1), columns(cols), field_columns(field_cols), options(opts),
+      stats(import_stats) {
+  }
+
+  bool next(import_record& record) {
+    // the next non-empty record, if any
+    while (pos < stop) {
+      unsigned long newlines;
+      record.start = pos;
+      record.line = line;
+      pos = __next_record(pos, stop, options.quote, newlines);
+      line += newlines;
+
+      record.end = pos;
+      while (record.end > record.start && (record.end[-1] == '\n' || record.end[-1] == '\r')) {
+        record.end--;
+      }
+      if (record.end > record.start) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  unsigned long fill(data_arrays& data, indic_arrays& null_indicator, unsigned long max_rows) {
+    import_record record;
+
+    while (true) {
+      records.clear();
+      while (records.size() < max_rows && next(record)) {
+        records.push_back(record);
+      }
+      if (records.empty()) {
+        return 0;
+      }
+
+      // each thread parses a contiguous block of records into the same rows of the buffers
+      std::vector<std::string> errors(records.size());
+      size_t nthreads = std::min<size_t>(std::max(options.threads, 1u), (records.size() + 999) / 1000);
+      size_t block = (records.size() + nthreads - 1) / nthreads;
+
+      auto parse = [&](size_t first, size_t last) {
+        import_scratch scratch;
+        for (size_t k = first; k < last; k++) {
+          errors[k] = __parse_record(records[k], columns, field_columns, options, data, null_indicator, k, scratch);
+        }
+      };
+
+      std::vector<std::thread> workers;
+      for (size_t t = 1; t < nthreads; t++) {
+        workers.push_back(std::thread(parse, t * block, std::min(records.size(), (t + 1) * block)));
+      }
+      parse(0, std::min(records.size(), block));
+      for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+      }
+
+      // close the gaps left by rejected records
+      unsigned long good = 0;
+      for (size_t k = 0; k < records.size(); k++) {
+        if (errors[k].empty()) {
+          if (good != k) {
+            __move_row(columns, data, null_indicator, k, good);
+          }
+          good++;
+        } else {
+          import_error rejected;
+          rejected.line = records[k].line;
+          rejected.message = errors[k];
+          stats.rejected.push_back(rejected);
+          if (stats.rejected.size() > options.max_rejected) {
+            throw std::runtime_error("More than " + std::to_string(options.max_rejected)
+                + " lines were rejected. The last was line " + std::to_string(rejected.line) + ": " + rejected.message);
+          }
+        }
+      }
+      stats.records += records.size();
+
+      if (good > 0) {
+        return good;
+      }
+    }
+  }
+
+private:
+  const char* pos;
+  const char* stop;
+  unsigned long line;
+  const std::vector<import_column>& columns;
+  const std::vector<size_t>& field_columns;
+  const import_options& options;
+  import_stats& stats;
+  std::vector<import_record> records;
+};
+
+import_stats import_file(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& path,
+    const std::vector<std::string>& col_names, const import_options& options) {
+
+  import_stats stats;
+  size_t i;
+  size_t f;
+
+  mapped_file file(path);
+
+  // the parameters are bound like a dbWriteTable of every column of the table, in table order
+  std::vector<column_desc> descs = describe_query(dbc, "SELECT * FROM " + tbl_name + " WHERE 1 = 0");
+  size_t ncols = descs.size();
+
+  std::vector<import_column> columns;
+  std::vector<short> coltypes;
+  std::vector<int> widths;
+  for (i = 0; i < ncols; i++) {
+    columns.push_back(__get_import_column(descs[i]));
+    coltypes.push_back(columns[i].coltype);
+    widths.push_back(columns[i].width);
+  }
+
+  std::vector<size_t> field_columns;
+  delimited_reader reader(file.begin(), file.end(), columns, field_columns, options, stats);
+
+  // the fields of the file are matched to the table by name if we know their names, otherwise by position
+  std::vector<std::string> names = col_names;
+  import_record header;
+  if (options.header && reader.next(header) && names.empty()) {
+    names = __split_header(header, options);
+  }
+
+  if (names.empty()) {
+    for (i = 0; i < ncols; i++) {
+      field_columns.push_back(i);
+    }
+  } else {
+    std::vector<bool> covered(ncols, false);
+    for (f = 0; f < names.size(); f++) {
+      for (i = 0; i < ncols; i++) {
+        if (!covered[i] && (names[f] == columns[i].name || __to_upper(names[f]) == columns[i].name)) {
+          break;
+        }
+      }
+      if (i == ncols) {
+        throw std::runtime_error("Column " + names[f] + " of " + path + " is not in " + tbl_name);
+      }
+      covered[i] = true;
+      field_columns.push_back(i);
+    }
+    for (i = 0; i < ncols; i++) {
+      if (!covered[i]) {
+        throw std::runtime_error("Column " + columns[i].name + " of " + tbl_name + " is not in " + path);
+      }
+    }
+  }
+
+  std::string insert_SQL = "INSERT INTO " + tbl_name + " VALUES (?";
+  for (i = 1; i < ncols; i++) {
+    insert_SQL += ", ?";
+  }
+  insert_SQL += ")";
+
+  chunk_source next_chunk = [&](data_arrays& data, indic_arrays& null_indicator, unsigned long max_rows) {
+    return reader.fill(data, null_indicator, max_rows);
+  };
+
+  // the buffers are sized for the declared width of every column, so a chunk is limited by a byte budget as
+  // well as by the number of records in the file (every record ends a line, some lines may be in quotes)
+  unsigned long max_records = 1;
+  const char* nl = file.begin();
+  while (nl < file.end() && (nl = (const char*) std::memchr(nl, '\n', file.end() - nl)) != NULL) {
+    nl++;
+    max_records++;
+  }
+
+  write_options write = options.write;
+  write.chunksize = rows_within_budget(coltypes, widths, std::max(write.chunksize, 1UL));
+
+  stats.written = write_table_streamed(dbc, tbl_name, insert_SQL, coltypes, widths, next_chunk, write, max_records);
+
+  return stats;
+}
+
+} // namespace
@@ -0,0 +1,221 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_lob.cpp
+ *
+ *  Inserts whose text and binary values are streamed to the server with SQLPutData
+ */
+
+#include "rwedb2.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "utf8.h"
+
+// bytes of a value that are converted and sent with each SQLPutData call
+#define LOB_PUT_PIECE_SIZE (256 * 1024)
+
+// length given for markers that the driver cannot describe, the longest CLOB or BLOB
+#define LOB_MAX_LENGTH 2147483647
+
+namespace rdb2 {
+
+static void __bind_lob_params(SQLHSTMT stmt, const std::vector<short>& coltypes, std::vector<SQLBIGINT>& integers,
+    std::vector<SQLDOUBLE>& numbers, std::vector<INDIC_TYPE>& indicators) {
+  // numbers are bound to their own variables. Text and binary values are sent at execution time so their
+  // value pointer is only a token: SQLParamData returns it to say which parameter it needs next
+  SQLRETURN ret;
+
+  for (size_t i = 0; i < coltypes.size(); i++) {
+    SQLLEN* indicator = (SQLLEN*) &indicators[i];
+
+    switch (coltypes[i]) {
+    case COLTYPE_INTEGER:
+      ret = SQLBindParameter(stmt, i + 1, SQL_PARAM_INPUT, SQL_C_SBIGINT, SQL_BIGINT, 0, 0, &integers[i], 0, indicator);
+      break;
+    case COLTYPE_NUMERIC:
+      ret = SQLBindParameter(stmt, i + 1, SQL_PARAM_INPUT, SQL_C_DOUBLE, SQL_DOUBLE, 0, 0, &numbers[i], 0, indicator);
+      break;
+    default: {
+      bool binary = (coltypes[i] == COLTYPE_BINARY);
+      SQLSMALLINT type = 0;
+      SQLULEN size = 0;  // the DB2 driver only writes 32 bits here
+      SQLSMALLINT digits = 0;
+      SQLSMALLINT nullable = 0;
+
+      if (SQL_SUCCEEDED(SQLDescribeParam(stmt, i + 1, &type, &size, &digits, &nullable))) {
+        size = (SQLUINTEGER) size;
+      } else {
+        type = binary ? SQL_BLOB : SQL_CLOB;
+        size = LOB_MAX_LENGTH;
+        digits = 0;
+      }
+
+      ret = SQLBindParameter(stmt, i + 1, SQL_PARAM_INPUT, binary ? SQL_C_BINARY : SQL_C_WCHAR, type, size, digits,
+          (SQLPOINTER) (uintptr_t) (i + 1), 0, indicator);
+      break;
+    }
+    }
+
+    if (!SQL_SUCCEEDED(ret)) {
+      throw std::runtime_error(
+          extract_error("Error in SQLBindParameter in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+    }
+  }
+}
+
+static void __put_value(SQLHSTMT stmt, bool binary, const lob_param& value, std::vector<SQLWCHAR>& piece) {
+  // sends value in pieces of at most LOB_PUT_PIECE_SIZE bytes, so only one piece is ever converted at a time.
+  // Text pieces end on a character boundary. At least one piece is sent, even for an empty value
+  const char* pos = value.data;
+  const char* end = value.data + value.length;
+  SQLRETURN ret;
+
+  do {
+    const char* piece_end = pos + std::min<size_t>(end - pos, LOB_PUT_PIECE_SIZE);
+
+    if (binary) {
+      ret = SQLPutData(stmt, (SQLPOINTER) pos, piece_end - pos);
+    } else {
+      while (piece_end < end && piece_end > pos && (*piece_end & 0xC0) == 0x80) {
+        piece_end--;   // continuation byte, the character starts earlier
+      }
+      piece.clear();
+      utf8::utf8to16(pos, piece_end, std::back_inserter(piece));
+      ret = SQLPutData(stmt, (SQLPOINTER) piece.data(), piece.size() * sizeof(SQLWCHAR));
+    }
+
+    if (!SQL_SUCCEEDED(ret)) {
+      throw std::runtime_error(extract_error("Error in SQLPutData in " + std::string(__func__), stmt, SQL_HANDLE_STMT));
+    }
+    pos = piece_end;
+  } while (pos < end);
+}
+
+static void __end_transaction(const SQLHDBC& dbc, SQLSMALLINT completion, write_stats& stats) {
+  if (!SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, completion))) {
+    throw std::runtime_error(extract_error("Error while ending transaction", dbc, SQL_HANDLE_DBC));
+  }
+  if (completion == SQL_COMMIT) {
+    stats.commits++;
+  }
+}
+
+write_stats write_lob_rows(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& insert_SQL,
+    const std::vector<short>& coltypes, unsigned long nrows, const lob_row_function& get_row,
+    const write_options& options) {
+
+  write_stats stats;
+  struct odbc_stmt_handle stmt_holder;
+  size_t ncols = coltypes.size();
+
+  if (options.method != WRITE_METHOD_INSERT || options.on_error != WRITE_ON_ERROR_ABORT) {
+    throw std::runtime_error("Rows with LOB values can only be written with INSERT and on_error = abort");
+  }
+
+  // rows per transaction. 0 leaves the transaction open for the caller
+  unsigned long chunksize = std::max(options.chunksize, 1UL);
+  unsigned long commit_rows = chunksize * options.commit_every;
+
+  std::vector<lob_param> values(ncols);
+  std::vector<SQLBIGINT> integers(ncols);
+  std::vector<SQLDOUBLE> numbers(ncols);
+  std::vector<INDIC_TYPE> indicators(ncols);
+  std::vector<SQLWCHAR> piece;
+
+  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt_holder.stmt))) {
+    throw std::runtime_error(extract_error("Error while allocating statement handle", dbc, SQL_HANDLE_DBC));
+  }
+
+  if (!SQL_SUCCEEDED(SQLPrepareW(stmt_holder.stmt, get_UTF16_string(insert_SQL).get(), SQL_NTS))) {
+    throw std::runtime_error(extract_error("Error while preparing " + insert_SQL, stmt_holder.stmt, SQL_HANDLE_STMT));
+  }
+
+  __bind_lob_params(stmt_holder.stmt, coltypes, integers, numbers, indicators);
+
+  autocommit_guard autocommit(dbc, SQL_AUTOCOMMIT_OFF);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool open = false;
+
+  try {
+    for (unsigned long row = 0; row < nrows; row++) {
+      get_row(row, values);
+
+      for (size_t i = 0; i < ncols; i++) {
+        if (values[i].is_null) {
+          indicators[i] = SQL_NULL_DATA;
+        } else if (coltypes[i] == COLTYPE_INTEGER) {
+          integers[i] = values[i].integer;
+          indicators[i] = 0;
+        } else if (coltypes[i] == COLTYPE_NUMERIC) {
+          numbers[i] = values[i].number;
+          indicators[i] = 0;
+        } else {
+          indicators[i] = SQL_DATA_AT_EXEC;
+        }
+      }
+
+      if (!open) {
+        open = true;
+        stats.transactions++;
+        stats.chunks++;
+      } else if (row % chunksize == 0) {
+        stats.chunks++;
+      }
+
+      SQLRETURN ret = SQLExecute(stmt_holder.stmt);
+      if (ret == SQL_NEED_DATA) {
+        SQLPOINTER token = NULL;
+        while ((ret = SQLParamData(stmt_holder.stmt, &token)) == SQL_NEED_DATA) {
+          size_t i = (size_t) (uintptr_t) token - 1;
+          if (i >= ncols) {
+            throw std::runtime_error("The driver asked for the value of an unknown parameter");
+          }
+          __put_value(stmt_holder.stmt, coltypes[i] == COLTYPE_BINARY, values[i], piece);
+        }
+      }
+
+      if (!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+        throw std::runtime_error(extract_error("Error while inserting row " + std::to_string(row + 1) + " into "
+            + tbl_name, stmt_holder.stmt, SQL_HANDLE_STMT));
+      }
+      stats.rows++;
+
+      if (commit_rows > 0 && stats.rows % commit_rows == 0) {
+        __end_transaction(dbc, SQL_COMMIT, stats);
+        open = false;
+      }
+
+      checkInterrupt();
+    }
+
+    if (open && commit_rows > 0) {
+      __end_transaction(dbc, SQL_COMMIT, stats);
+    }
+  } catch (...) {
+    // the rows of the open transaction are discarded. With commit_every = 0 the caller owns the transaction
+    if (commit_rows > 0) {
+      SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK);
+    }
+    throw;
+  }
+
+  stats.execute_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  autocommit.restore();
+
+  return stats;
+}
+
+} // namespace
@@ -0,0 +1,276 @@
+/*
+ Licensed Materials - Property of IBM
+ 
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_merge.cpp
+ *
+ *  Declared temporary staging tables: bulk upsert through MERGE and reads filtered by a set of keys
+ */
+
+#include "rwedb2.h"
+#include <sstream>
+#include <algorithm>
+
+namespace rdb2 {
+
+static void __exec_direct(const SQLHDBC& dbc, const std::string& query, SQLLEN* row_count = NULL) {
+  // executes query without touching autocommit, optionally returning the number of rows affected
+  struct odbc_stmt_handle stmt_holder;
+
+  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt_holder.stmt))) {
+    throw std::runtime_error(extract_error("Error while allocating statement handle", dbc, SQL_HANDLE_DBC));
+  }
+
+  SQLRETURN ret = SQLExecDirectW(stmt_holder.stmt, get_UTF16_string(query).get(), SQL_NTS);
+  if (!SQL_SUCCEEDED(ret) && ret != SQL_NO_DATA) {
+    throw std::runtime_error(extract_error("Error while executing " + query, stmt_holder.stmt, SQL_HANDLE_STMT));
+  }
+
+  if (row_count != NULL) {
+    *row_count = 0;  // the DB2 driver only writes 32 bits here
+    if (ret != SQL_NO_DATA && !SQL_SUCCEEDED(SQLRowCount(stmt_holder.stmt, row_count))) {
+      throw std::runtime_error(extract_error("Error while getting row count", stmt_holder.stmt, SQL_HANDLE_STMT));
+    }
+  }
+}
+
+static SQLBIGINT __select_count(const SQLHDBC& dbc, const std::string& query) {
+  struct odbc_stmt_handle stmt_holder;
+  SQLBIGINT count = 0;
+  SQLLEN indicator = 0;
+
+  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt_holder.stmt))) {
+    throw std::runtime_error(extract_error("Error while allocating statement handle", dbc, SQL_HANDLE_DBC));
+  }
+
+  if (!SQL_SUCCEEDED(SQLExecDirectW(stmt_holder.stmt, get_UTF16_string(query).get(), SQL_NTS))
+      || !SQL_SUCCEEDED(SQLBindCol(stmt_holder.stmt, 1, SQL_C_SBIGINT, &count, sizeof(count), &indicator))
+      || !SQL_SUCCEEDED(SQLFetch(stmt_holder.stmt))) {
+    throw std::runtime_error(extract_error("Error while executing " + query, stmt_holder.stmt, SQL_HANDLE_STMT));
+  }
+
+  return count;
+}
+
+static std::string __join(const std::vector<std::string>& cols, const std::string& prefix,
+    const std::string& separator) {
+  std::ostringstream oss;
+  for (size_t i = 0; i < cols.size(); i++) {
+    oss << (i > 0 ? separator : "") << prefix << cols[i];
+  }
+  return oss.str();
+}
+
+static std::string __match_condition(const std::vector<std::string>& key_cols) {
+  std::ostringstream oss;
+  for (size_t i = 0; i < key_cols.size(); i++) {
+    oss << (i > 0 ? " AND " : "") << "T." << key_cols[i] << " = S." << key_cols[i];
+  }
+  return oss.str();
+}
+
+static std::string __get_merge_SQL(const std::string& tbl_name, const std::string& stage,
+    const std::vector<std::string>& col_names, const std::vector<std::string>& update_cols,
+    const std::vector<std::string>& key_cols) {
+  std::ostringstream oss;
+
+  oss << "MERGE INTO " << tbl_name << " AS T USING " << stage << " AS S ON " << __match_condition(key_cols);
+  if (!update_cols.empty()) {
+    oss << " WHEN MATCHED THEN UPDATE SET ";
+    for (size_t i = 0; i < update_cols.size(); i++) {
+      oss << (i > 0 ? ", " : "") << update_cols[i] << " = S." << update_cols[i];
+    }
+  }
+  oss << " WHEN NOT MATCHED THEN INSERT (" << __join(col_names, "", ", ") << ") VALUES ("
+      << __join(col_names, "S.", ", ") << ")";
+
+  return oss.str();
+}
+
+upsert_stats upsert_table(const SQLHDBC& dbc, const std::string& tbl_name, const std::vector<std::string>& col_names,
+    const std::vector<std::string>& key_cols, const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths, unsigned long nrows, const fill_function& fill,
+    const write_options& options) {
+
+  upsert_stats stats;
+  std::vector<std::string> update_cols;
+  size_t i;
+
+  if (key_cols.empty()) {
+    throw std::runtime_error("At least one key column is needed to upsert into " + tbl_name);
+  }
+
+  for (i = 0; i < key_cols.size(); i++) {
+    if (std::find(col_names.begin(), col_names.end(), key_cols[i]) == col_names.end()) {
+      throw std::runtime_error("Key column " + key_cols[i] + " is not one of the columns being written");
+    }
+  }
+
+  for (i = 0; i < col_names.size(); i++) {
+    if (std::find(key_cols.begin(), key_cols.end(), col_names[i]) == key_cols.end()) {
+      update_cols.push_back(col_names[i]);
+    }
+  }
+
+  // the staging table is declared once per connection for each target table and column list.
+  // It deletes its rows on commit and rollback so it is always empty when we start
+  std::shared_ptr<connection_state> state = get_connection_state(dbc);
+  std::lock_guard<std::mutex> lock(state->mutex);
+
+  std::string stage_key = tbl_name + "(" + __join(col_names, "", ",") + ")";
+  std::string stage;
+  bool declare = false;
+
+  std::map<std::string, std::string>::iterator found = state->staging_tables.find(stage_key);
+  if (found != state->staging_tables.end()) {
+    stage = found->second;
+  } else {
+    stage = "SESSION.RDB2_STAGE_" + std::to_string(state->next_staging_id++);
+    declare = true;
+  }
+
+  std::string insert_SQL = "INSERT INTO " + stage + " (" + __join(col_names, "", ", ") + ") VALUES ("
+      + __join(std::vector<std::string>(col_names.size(), "?"), "", ", ") + ")";
+
+  // the staging rows must stay in the open transaction until the MERGE has run
+  write_options stage_options = options;
+  stage_options.commit_every = 0;
+  stage_options.on_error = WRITE_ON_ERROR_ABORT;
+  stage_options.method = WRITE_METHOD_INSERT;
+  stage_options.not_logged = false;
+
+  autocommit_guard autocommit(dbc, SQL_AUTOCOMMIT_OFF);
+
+  try {
+    if (declare) {
+      // the column types are copied from the target table
+      __exec_direct(dbc, "DECLARE GLOBAL TEMPORARY TABLE " + stage + " AS (SELECT " + __join(col_names, "", ", ")
+          + " FROM " + tbl_name + ") DEFINITION ONLY ON COMMIT DELETE ROWS NOT LOGGED ON ROLLBACK DELETE ROWS "
+          "WITH REPLACE");
+    }
+
+    stats.staged = write_table_chunked(dbc, stage, insert_SQL, coltypes, varchar_col_lengths, nrows, fill,
+        stage_options);
+
+    // every staged row with a matching key updates exactly one row, the rest are inserted
+    SQLBIGINT matched = __select_count(dbc, "SELECT COUNT(*) FROM " + stage + " AS S WHERE EXISTS (SELECT 1 FROM "
+        + tbl_name + " AS T WHERE " + __match_condition(key_cols) + ")");
+
+    SQLLEN affected = 0;
+    __exec_direct(dbc, __get_merge_SQL(tbl_name, stage, col_names, update_cols, key_cols), &affected);
+
+    // with no columns to update the matched rows are left alone and do not count towards affected
+    stats.updated = update_cols.empty() ? 0 : matched;
+    stats.inserted = affected - stats.updated;
+
+    if (!SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_COMMIT))) {
+      throw std::runtime_error(extract_error("Error while committing upsert into " + tbl_name, dbc, SQL_HANDLE_DBC));
+    }
+  } catch (...) {
+    // a rollback also undoes a declaration made in this transaction, so forget the staging table
+    // and declare it again (WITH REPLACE) next time
+    SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK);
+    state->staging_tables.erase(stage_key);
+    throw;
+  }
+
+  state->staging_tables[stage_key] = stage;
+
+  autocommit.restore();
+
+  return stats;
+}
+
+read_results read_by_keys(const SQLHDBC& dbc, const std::string& tbl_name, const std::string& select_list,
+    const std::string& key_col, const std::string& where_clause, const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths, unsigned long nkeys, const fill_function& fill,
+    unsigned int chunksize, const read_options& options) {
+
+  if (coltypes.size() != 1) {
+    throw std::runtime_error("Exactly one column of keys is needed to read " + tbl_name + " by " + key_col);
+  }
+
+  // the key table is declared once per connection for each table and key column, with an index on the key.
+  // Like the upsert staging tables it deletes its rows on commit and rollback
+  // The lock only guards the map, it must not be held while the statements below use the connection state
+  std::shared_ptr<connection_state> state = get_connection_state(dbc);
+
+  std::string stage_key = "KEYS " + tbl_name + "(" + key_col + ")";
+  std::string stage;
+  bool declare = false;
+
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    std::map<std::string, std::string>::iterator found = state->staging_tables.find(stage_key);
+    if (found != state->staging_tables.end()) {
+      stage = found->second;
+    } else {
+      stage = "SESSION.RDB2_KEYS_" + std::to_string(state->next_staging_id++);
+      declare = true;
+    }
+  }
+
+  std::string insert_SQL = "INSERT INTO " + stage + " (" + key_col + ") VALUES (?)";
+
+  // a semi-join, so keys that appear more than once do not duplicate rows
+  std::string query = "SELECT " + select_list + " FROM " + tbl_name + " WHERE " + key_col + " IN (SELECT "
+      + key_col + " FROM " + stage + ")";
+  if (!where_clause.empty()) {
+    query += " AND (" + where_clause + ")";
+  }
+
+  // the keys must stay in the open transaction until the query has been read
+  write_options stage_options;
+  stage_options.chunksize = chunksize;
+  stage_options.commit_every = 0;
+  stage_options.on_error = WRITE_ON_ERROR_ABORT;
+  stage_options.method = WRITE_METHOD_INSERT;
+  stage_options.not_logged = false;
+
+  read_results results;
+
+  autocommit_guard autocommit(dbc, SQL_AUTOCOMMIT_OFF);
+
+  try {
+    if (declare) {
+      // the key column has the type of the column of the table so the comparison needs no casts
+      __exec_direct(dbc, "DECLARE GLOBAL TEMPORARY TABLE " + stage + " AS (SELECT " + key_col + " FROM " + tbl_name
+          + ") DEFINITION ONLY ON COMMIT DELETE ROWS NOT LOGGED ON ROLLBACK DELETE ROWS WITH REPLACE");
+      __exec_direct(dbc, "CREATE INDEX " + stage + "_IX ON " + stage + " (" + key_col + ")");
+    }
+
+    write_table_chunked(dbc, stage, insert_SQL, coltypes, varchar_col_lengths, nkeys, fill, stage_options);
+
+    results = execute_query(dbc, query, chunksize, options);
+
+    // the commit empties the key table for the next call
+    if (!SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_COMMIT))) {
+      throw std::runtime_error(extract_error("Error while committing read of " + tbl_name, dbc, SQL_HANDLE_DBC));
+    }
+  } catch (...) {
+    SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK);
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->staging_tables.erase(stage_key);
+    throw;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->staging_tables[stage_key] = stage;
+  }
+
+  autocommit.restore();
+
+  return results;
+}
+
+} // namespace
@@ -0,0 +1,300 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_spill.cpp
+ *
+ *  Query results written to column files instead of memory
+ */
+
+#include "rwedb2.h"
+#include "rwedb2_spill.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "utf8.h"
+
+// stdio buffer of each column file
+#define SPILL_FILE_BUFFER_SIZE (256 * 1024)
+
+namespace rdb2 {
+
+static FILE* __open_column_file(const std::string& path) {
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    throw std::runtime_error("Unable to create " + path + ": " + std::strerror(errno));
+  }
+  std::setvbuf(file, NULL, _IOFBF, SPILL_FILE_BUFFER_SIZE);
+  return file;
+}
+
+spilled_result::spilled_result(const std::string& parent_dir, const std::vector<column_desc>& col_desc,
+    const read_options& read_opts) :
+    options(read_opts), finished(false) {
+
+  std::string dir_template = parent_dir + "/rdb2_spill_XXXXXX";
+  std::vector<char> name(dir_template.begin(), dir_template.end());
+  name.push_back(0);
+  if (mkdtemp(name.data()) == NULL) {
+    throw std::runtime_error("Unable to create a spill directory in " + parent_dir + ": " + std::strerror(errno));
+  }
+  dir = name.data();
+
+  try {
+    for (size_t i = 0; i < col_desc.size(); i++) {
+      column_files column;
+      column.coltype = result_coltype(col_desc[i]);
+      column.prefix = dir + "/col" + std::to_string(i);
+      column.values = NULL;
+      column.offsets = NULL;
+      column.data = NULL;
+      column.validity = NULL;
+      column.data_size = 0;
+      column.pending = 0;
+      column.count = 0;
+      columns.push_back(column);
+
+      column_files& files = columns.back();
+      files.validity = __open_column_file(files.prefix + ".nul");
+      if (files.coltype == COLTYPE_STRING) {
+        files.offsets = __open_column_file(files.prefix + ".off");
+        files.data = __open_column_file(files.prefix + ".dat");
+        __write(files.offsets, &files.data_size, sizeof(uint64_t), files);
+      } else {
+        files.values = __open_column_file(files.prefix + ".val");
+      }
+    }
+  } catch (...) {
+    __remove();
+    throw;
+  }
+}
+
+spilled_result::~spilled_result() {
+  __remove();
+}
+
+void spilled_result::__remove() {
+  // closes and deletes the files and the directory
+  for (size_t i = 0; i < columns.size(); i++) {
+    FILE* files[] = { columns[i].values, columns[i].offsets, columns[i].data, columns[i].validity };
+    for (size_t f = 0; f < 4; f++) {
+      if (files[f] != NULL) {
+        std::fclose(files[f]);
+      }
+    }
+    columns[i].values = columns[i].offsets = columns[i].data = columns[i].validity = NULL;
+
+    const char* suffixes[] = { ".val", ".off", ".dat", ".nul" };
+    for (size_t f = 0; f < 4; f++) {
+      unlink((columns[i].prefix + suffixes[f]).c_str());
+    }
+  }
+  columns.clear();
+
+  if (!dir.empty()) {
+    rmdir(dir.c_str());
+    dir.clear();
+  }
+}
+
+void spilled_result::__write(FILE* file, const void* data, size_t size, const column_files& column) {
+  if (size > 0 && std::fwrite(data, 1, size, file) != size) {
+    throw std::runtime_error("Error while writing " + column.prefix + ": " + std::strerror(errno)
+        + ". The spill directory may be full");
+  }
+}
+
+void spilled_result::__set_valid(column_files& column, bool valid) {
+  unsigned bit = column.count % 8;
+  if (valid) {
+    column.pending |= (uint8_t) (1 << bit);
+  }
+  column.count++;
+  if (bit == 7) {
+    __write(column.validity, &column.pending, 1, column);
+    column.pending = 0;
+  }
+}
+
+void spilled_result::append_integer(size_t col, int32_t value, bool valid) {
+  column_files& column = columns[col];
+  if (!valid) {
+    value = options.null_integer;
+  }
+  __write(column.values, &value, sizeof(value), column);
+  __set_valid(column, valid);
+}
+
+void spilled_result::append_double(size_t col, double value, bool valid) {
+  column_files& column = columns[col];
+  if (!valid) {
+    value = options.null_double;
+  }
+  __write(column.values, &value, sizeof(value), column);
+  __set_valid(column, valid);
+}
+
+void spilled_result::append_string(size_t col, const char* value, size_t length, bool valid) {
+  column_files& column = columns[col];
+  if (valid) {
+    __write(column.data, value, length, column);
+    column.data_size += length;
+  }
+  __write(column.offsets, &column.data_size, sizeof(uint64_t), column);
+  __set_valid(column, valid);
+}
+
+void spilled_result::append_results(const read_results& results) {
+  for (size_t i = 0; i < columns.size(); i++) {
+    const stl_vector_var_data& vec = results.stl_vecs[i];
+    const std::vector<bool>& nulls = results.null_indics[i];
+
+    for (size_t j = 0; j < nulls.size(); j++) {
+      bool valid = !nulls[j];
+      if (columns[i].coltype == COLTYPE_INTEGER) {
+        append_integer(i, vec.integer_data[j], valid);
+      } else if (columns[i].coltype == COLTYPE_NUMERIC) {
+        append_double(i, vec.numeric_data[j], valid);
+      } else if (vec.compact_data) {
+        const compact_strings& strings = *vec.compact_data;
+        append_string(i, strings.data.data() + strings.offsets[j], strings.offsets[j + 1] - strings.offsets[j], valid);
+      } else {
+        append_string(i, vec.string_data[j].data(), vec.string_data[j].size(), valid);
+      }
+    }
+  }
+}
+
+void spilled_result::append_rowset(const std::vector<column_desc>& col_desc, const fetch_buffers& buffers,
+    unsigned long row_count) {
+  for (size_t i = 0; i < columns.size(); i++) {
+    // DB2 only writes 32-bit indicators, see __fetch_bound
+    const INDIC_TYPE* indic = (const INDIC_TYPE*) buffers.indicator[i].get();
+    const void* data = buffers.data[i].get();
+    int field_width = bound_field_width(col_desc[i]);
+
+    for (unsigned long j = 0; j < row_count; j++) {
+      bool valid = (indic[j] != SQL_NULL_DATA);
+      switch (col_desc[i].type) {
+      case SQL_INTEGER:
+        append_integer(i, ((const SQLINTEGER*) data)[j], valid);
+        break;
+      case SQL_SMALLINT:
+        append_integer(i, ((const SQLSMALLINT*) data)[j], valid);
+        break;
+      case SQL_BIGINT:
+        append_double(i, (double) ((const SQLBIGINT*) data)[j], valid);
+        break;
+      case SQL_REAL:
+      case SQL_DOUBLE:
+      case SQL_FLOAT:
+        append_double(i, ((const SQLDOUBLE*) data)[j], valid);
+        break;
+      default:
+        if (is_lob(col_desc[i])) {
+          const std::string& value = buffers.lob_values[i][j];
+          append_string(i, value.data(), value.size(), valid);
+          break;
+        }
+        scratch.clear();
+        if (field_width == 0) {
+          scratch = "Unknown column type: ";
+        } else if (valid) {
+          const SQLWCHAR* value = (const SQLWCHAR*) data + j * field_width;
+          utf8::utf16to8(value, value + indic[j] / sizeof(SQLWCHAR), std::back_inserter(scratch));
+        }
+        append_string(i, scratch.data(), scratch.size(), valid);
+        break;
+      }
+    }
+  }
+}
+
+void spilled_result::finish() {
+  if (finished) {
+    return;
+  }
+
+  for (size_t i = 0; i < columns.size(); i++) {
+    column_files& column = columns[i];
+    if (column.count % 8 != 0) {
+      __write(column.validity, &column.pending, 1, column);
+    }
+
+    FILE** files[] = { &column.values, &column.offsets, &column.data, &column.validity };
+    for (size_t f = 0; f < 4; f++) {
+      if (*files[f] != NULL) {
+        int ret = std::fclose(*files[f]);
+        *files[f] = NULL;
+        if (ret != 0) {
+          throw std::runtime_error("Error while closing the files of " + column.prefix + ". The spill directory may be full");
+        }
+      }
+    }
+  }
+  finished = true;
+}
+
+struct mapped_column_files {
+  // the mappings of a column, which keep the spilled result (and so its directory) alive
+  std::shared_ptr<spilled_result> result;
+  std::unique_ptr<mapped_file> values;
+  std::unique_ptr<mapped_file> offsets;
+  std::unique_ptr<mapped_file> data;
+  std::unique_ptr<mapped_file> validity;
+};
+
+spilled_column spilled_result::map_column(size_t col) {
+  if (!finished) {
+    throw std::runtime_error("Spilled result must be finished before it is mapped");
+  }
+
+  const column_files& column = columns[col];
+  std::shared_ptr<mapped_column_files> mapped = std::make_shared<mapped_column_files>();
+  mapped->result = shared_from_this();
+
+  // the values are mapped copy on write so that R can modify the vectors without touching the files
+  mapped->validity.reset(new mapped_file(column.prefix + ".nul", false));
+  if (column.coltype == COLTYPE_STRING) {
+    mapped->offsets.reset(new mapped_file(column.prefix + ".off", false));
+    mapped->data.reset(new mapped_file(column.prefix + ".dat", false));
+  } else {
+    mapped->values.reset(new mapped_file(column.prefix + ".val", false, true));
+  }
+
+  spilled_column spilled;
+  spilled.coltype = column.coltype;
+  spilled.rows = column.count;
+  spilled.values = mapped->values ? mapped->values->begin() : NULL;
+  spilled.offsets = mapped->offsets ? (const uint64_t*) mapped->offsets->begin() : NULL;
+  spilled.data = mapped->data ? mapped->data->begin() : NULL;
+  spilled.valid = (const uint8_t*) mapped->validity->begin();
+  spilled.owner = mapped;
+
+  return spilled;
+}
+
+size_t default_spill_threshold() {
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGE_SIZE);
+  if (pages <= 0 || page_size <= 0) {
+    return (size_t) -1;
+  }
+  // the collected rowsets are copied again into R vectors when the dataframe is built, so a result below the
+  // threshold still needs several times its size
+  return (size_t) pages / 8 * (size_t) page_size;
+}
+
+} // namespace
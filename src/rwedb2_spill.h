@@ -0,0 +1,115 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_spill.h
+ *
+ *  Query results written to column files instead of memory
+ */
+
+#ifndef SRC_RWEDB2_SPILL_H_
+#define SRC_RWEDB2_SPILL_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rwedb2_DML.h"
+
+namespace rdb2 {
+
+struct spilled_column {
+  // the mapped files of one column. owner keeps the mappings (and the files) alive
+  short coltype;            // COLTYPE_INTEGER (int32 values), COLTYPE_NUMERIC (double values) or COLTYPE_STRING
+  unsigned long rows;
+  const void* values;       // rows fixed width values, with the null values of spill_options in the null rows
+  const uint64_t* offsets;  // rows + 1 offsets into data, for strings
+  const char* data;         // UTF-8 bytes, for strings
+  const uint8_t* valid;     // bit j is set if row j is not null
+  std::shared_ptr<const void> owner;
+};
+
+class spilled_result : public std::enable_shared_from_this<spilled_result> {
+  /* A result set stored in a private directory with one set of files per column:
+   *   col<i>.val   fixed width values (int32 or double)
+   *   col<i>.off   uint64 offsets of each string in col<i>.dat, plus the end of the last
+   *   col<i>.dat   UTF-8 data of the strings
+   *   col<i>.nul   validity bitmap, least significant bit first
+   * The directory is removed when the last reference to the result or to one of its mapped columns goes.
+   */
+public:
+  spilled_result(const std::string& parent_dir, const std::vector<column_desc>& col_desc, const read_options& options);
+  ~spilled_result();
+
+  void append_integer(size_t col, int32_t value, bool valid);
+  void append_double(size_t col, double value, bool valid);
+  void append_string(size_t col, const char* value, size_t length, bool valid);
+
+  // appends the rows collected so far in memory
+  void append_results(const read_results& results);
+
+  // appends row_count rows straight from the fetch buffers
+  void append_rowset(const std::vector<column_desc>& col_desc, const fetch_buffers& buffers, unsigned long row_count);
+
+  // flushes and closes the files. No more rows can be appended
+  void finish();
+
+  size_t ncols() const {
+    return columns.size();
+  }
+
+  unsigned long rows() const {
+    return columns.empty() ? 0 : columns[0].count;
+  }
+
+  const std::string& directory() const {
+    return dir;
+  }
+
+  // maps the files of column col. Only after finish
+  spilled_column map_column(size_t col);
+
+private:
+  struct column_files {
+    short coltype;
+    std::string prefix;
+    FILE* values;
+    FILE* offsets;
+    FILE* data;
+    FILE* validity;
+    uint64_t data_size;
+    uint8_t pending;      // validity bits not written yet
+    unsigned long count;
+  };
+
+  std::string dir;
+  std::vector<column_files> columns;
+  read_options options;
+  std::string scratch;
+  bool finished;
+
+  void __write(FILE* file, const void* data, size_t size, const column_files& column);
+  void __set_valid(column_files& column, bool valid);
+  void __remove();
+
+  spilled_result(const spilled_result&);
+  spilled_result& operator=(const spilled_result&);
+};
+
+// an eighth of the physical memory, the threshold at which reads spill to disk unless told otherwise
+size_t default_spill_threshold();
+
+}
+
+#endif /* SRC_RWEDB2_SPILL_H_ */
@@ -0,0 +1,581 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_sync.cpp
+ *
+ *  Row hashes to find the rows of a table that differ from new data
+ */
+
+#include "rwedb2_sync.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "utf8.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+namespace rdb2 {
+
+// how the value of a column is put into canonical form
+enum sync_kind {
+  SYNC_KIND_STRING,     // VARCHAR
+  SYNC_KIND_CHAR,       // CHAR, compared without the trailing blanks
+  SYNC_KIND_INTEGER,    // SMALLINT, INTEGER, BIGINT
+  SYNC_KIND_DECIMAL,    // DECIMAL that fits in a BIGINT once scaled to an integer
+  SYNC_KIND_DOUBLE,     // DOUBLE, FLOAT
+  SYNC_KIND_REAL,       // REAL, compared at single precision
+  SYNC_KIND_NUMBER,     // DECFLOAT and wide DECIMAL, fetched as text and compared as doubles
+  SYNC_KIND_TEXT        // DATE, TIME, TIMESTAMP, compared as the text the driver returns
+};
+
+static sync_kind __sync_kind(const column_desc& desc) {
+  switch (desc.type) {
+  case SQL_VARCHAR:
+    return SYNC_KIND_STRING;
+  case SQL_CHAR:
+    return SYNC_KIND_CHAR;
+  case SQL_SMALLINT:
+  case SQL_INTEGER:
+  case SQL_BIGINT:
+    return SYNC_KIND_INTEGER;
+  case SQL_DECIMAL:
+  case SQL_NUMERIC:
+    // the scaled value must fit in a BIGINT and in the 31 digits of the multiplication
+    return (desc.precision <= 18 && desc.precision + desc.scale <= 31) ? SYNC_KIND_DECIMAL : SYNC_KIND_NUMBER;
+  case SQL_DOUBLE:
+  case SQL_FLOAT:
+    return SYNC_KIND_DOUBLE;
+  case SQL_REAL:
+    return SYNC_KIND_REAL;
+  case SQL_DECFLOAT:
+    return SYNC_KIND_NUMBER;
+  case SQL_TYPE_DATE:
+  case SQL_TYPE_TIME:
+  case SQL_TYPE_TIMESTAMP:
+    return SYNC_KIND_TEXT;
+  default:
+    throw std::runtime_error(std::string("Columns of type ") + (const char*) desc.coltype + " cannot be compared");
+  }
+}
+
+static std::string __format_integer(int64_t value) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%lld", (long long) value);
+  return buf;
+}
+
+static std::string __format_double(double value, int digits) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "%.*g", digits, value);
+  return buf;
+}
+
+static std::string __rtrim(const char* value, size_t length) {
+  while (length > 0 && value[length - 1] == ' ') {
+    length--;
+  }
+  return std::string(value, length);
+}
+
+static int64_t __scaled(const column_desc& desc, double value) {
+  return (int64_t) std::llround(value * std::pow(10.0, (double) desc.scale));
+}
+
+/* MD5 (RFC 1321), only used for the first 8 bytes of the digest that HASH_MD5 returns */
+
+static const uint32_t md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint32_t md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void __md5_block(uint32_t h[4], const unsigned char* block) {
+  uint32_t w[16];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t) block[i * 4] | ((uint32_t) block[i * 4 + 1] << 8) | ((uint32_t) block[i * 4 + 2] << 16)
+        | ((uint32_t) block[i * 4 + 3] << 24);
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+  for (int i = 0; i < 64; i++) {
+    uint32_t f;
+    int g;
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+    uint32_t rotated = a + f + md5_k[i] + w[g];
+    a = d;
+    d = c;
+    c = b;
+    b = b + ((rotated << md5_r[i]) | (rotated >> (32 - md5_r[i])));
+  }
+
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+}
+
+static uint64_t __md5_prefix(const std::string& message) {
+  // the first 8 bytes of the digest, most significant first like the HEX() of them
+  uint32_t h[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  size_t length = message.size();
+  size_t i;
+
+  for (i = 0; i + 64 <= length; i += 64) {
+    __md5_block(h, (const unsigned char*) message.data() + i);
+  }
+
+  unsigned char tail[128];
+  size_t rest = length - i;
+  std::memset(tail, 0, sizeof(tail));
+  std::memcpy(tail, message.data() + i, rest);
+  tail[rest] = 0x80;
+  size_t tail_length = (rest < 56) ? 64 : 128;
+  uint64_t bits = (uint64_t) length * 8;
+  for (int b = 0; b < 8; b++) {
+    tail[tail_length - 8 + b] = (unsigned char) (bits >> (8 * b));
+  }
+  __md5_block(h, tail);
+  if (tail_length == 128) {
+    __md5_block(h, tail + 64);
+  }
+
+  uint64_t prefix = 0;
+  for (int word = 0; word < 2; word++) {
+    for (int b = 0; b < 4; b++) {
+      prefix = (prefix << 8) | ((h[word] >> (8 * b)) & 0xFF);
+    }
+  }
+  return prefix;
+}
+
+std::vector<sync_column> describe_sync_columns(const SQLHDBC& dbc, const std::string& tbl_name,
+    const std::vector<std::string>& names) {
+  std::string query = "SELECT ";
+  for (size_t i = 0; i < names.size(); i++) {
+    query += (i > 0 ? ", " : "") + names[i];
+  }
+  query += " FROM " + tbl_name + " WHERE 1 = 0";
+
+  std::vector<column_desc> col_desc = describe_query(dbc, query);
+  std::vector<sync_column> columns(col_desc.size());
+  for (size_t i = 0; i < col_desc.size(); i++) {
+    columns[i].name = names[i];
+    columns[i].desc = col_desc[i];
+    try {
+      sync_kind kind = __sync_kind(col_desc[i]);
+      bool server = (kind == SYNC_KIND_STRING || kind == SYNC_KIND_CHAR || kind == SYNC_KIND_INTEGER
+          || kind == SYNC_KIND_DECIMAL);
+      columns[i].mode = server ? SYNC_HASH_SERVER : SYNC_HASH_CLIENT;
+    } catch (const std::runtime_error& e) {
+      throw std::runtime_error("Column " + names[i] + " of " + tbl_name + ": " + e.what());
+    }
+  }
+
+  return columns;
+}
+
+row_hasher::row_hasher(const std::vector<sync_column>& columns_) :
+    columns(columns_), client_hash(FNV_OFFSET_BASIS), has_server_hash(false), server_hash(0) {
+}
+
+void row_hasher::begin() {
+  server_text.clear();
+  client_hash = FNV_OFFSET_BASIS;
+  has_server_hash = false;
+  server_hash = 0;
+}
+
+void row_hasher::__add_server_text(size_t col, const std::string& text) {
+  // the separator goes before every server column but the first
+  for (size_t i = 0; i < col; i++) {
+    if (columns[i].mode == SYNC_HASH_SERVER) {
+      server_text += '\x1F';
+      break;
+    }
+  }
+  server_text += 'V';
+  server_text += text;
+}
+
+void row_hasher::__add_client_bytes(const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*) data;
+  for (size_t i = 0; i < size; i++) {
+    client_hash = (client_hash ^ bytes[i]) * FNV_PRIME;
+  }
+}
+
+void row_hasher::add_text(size_t col, const char* value, size_t length) {
+  const column_desc& desc = columns[col].desc;
+  switch (__sync_kind(desc)) {
+  case SYNC_KIND_STRING:
+    __add_server_text(col, std::string(value, length));
+    break;
+  case SYNC_KIND_CHAR:
+    __add_server_text(col, __rtrim(value, length));
+    break;
+  case SYNC_KIND_INTEGER:
+    add_integer(col, std::strtoll(std::string(value, length).c_str(), NULL, 10));
+    break;
+  case SYNC_KIND_DECIMAL:
+  case SYNC_KIND_DOUBLE:
+  case SYNC_KIND_REAL:
+  case SYNC_KIND_NUMBER:
+    add_double(col, std::strtod(std::string(value, length).c_str(), NULL));
+    break;
+  case SYNC_KIND_TEXT: {
+    uint64_t size = length;
+    __add_client_bytes("V", 1);
+    __add_client_bytes(&size, sizeof(size));
+    __add_client_bytes(value, length);
+    break;
+  }
+  }
+}
+
+void row_hasher::add_integer(size_t col, int64_t value) {
+  const column_desc& desc = columns[col].desc;
+  switch (__sync_kind(desc)) {
+  case SYNC_KIND_STRING:
+  case SYNC_KIND_CHAR:
+  case SYNC_KIND_INTEGER:
+  case SYNC_KIND_TEXT: {
+    std::string text = __format_integer(value);
+    if (columns[col].mode == SYNC_HASH_SERVER) {
+      __add_server_text(col, text);
+    } else {
+      add_text(col, text.data(), text.size());
+    }
+    break;
+  }
+  default:
+    add_double(col, (double) value);
+    break;
+  }
+}
+
+void row_hasher::add_double(size_t col, double value) {
+  const column_desc& desc = columns[col].desc;
+  switch (__sync_kind(desc)) {
+  case SYNC_KIND_STRING:
+  case SYNC_KIND_CHAR:
+    __add_server_text(col, __format_double(value, 15));
+    break;
+  case SYNC_KIND_INTEGER:
+    __add_server_text(col, __format_integer((int64_t) std::llround(value)));
+    break;
+  case SYNC_KIND_DECIMAL:
+    __add_server_text(col, __format_integer(__scaled(desc, value)));
+    break;
+  case SYNC_KIND_TEXT: {
+    std::string text = __format_double(value, 15);
+    add_text(col, text.data(), text.size());
+    break;
+  }
+  default:
+    if (__sync_kind(desc) == SYNC_KIND_REAL) {
+      value = (double) (float) value;
+    }
+    if (value == 0) {
+      value = 0;    // -0 and 0 are the same value
+    }
+    __add_client_bytes("V", 1);
+    __add_client_bytes(&value, sizeof(value));
+    break;
+  }
+}
+
+void row_hasher::add_null(size_t col) {
+  if (columns[col].mode == SYNC_HASH_SERVER) {
+    __add_server_text(col, "");
+    server_text[server_text.size() - 1] = 'N';
+  } else {
+    __add_client_bytes("N", 1);
+  }
+}
+
+void row_hasher::set_server_hash(uint64_t hash) {
+  has_server_hash = true;
+  server_hash = hash;
+}
+
+uint64_t row_hasher::finish() {
+  uint64_t server = has_server_hash ? server_hash : (server_text.empty() ? 0 : __md5_prefix(server_text));
+  return server ^ (client_hash * 0x9E3779B97F4A7C15ULL);
+}
+
+std::string sync_key_text(const sync_column& column, const char* value, size_t length) {
+  switch (__sync_kind(column.desc)) {
+  case SYNC_KIND_CHAR:
+    return __rtrim(value, length);
+  case SYNC_KIND_INTEGER:
+    return sync_key_text(column, (int64_t) std::strtoll(std::string(value, length).c_str(), NULL, 10));
+  case SYNC_KIND_DECIMAL:
+  case SYNC_KIND_DOUBLE:
+  case SYNC_KIND_REAL:
+  case SYNC_KIND_NUMBER:
+    return sync_key_text(column, std::strtod(std::string(value, length).c_str(), NULL));
+  default:
+    return std::string(value, length);
+  }
+}
+
+std::string sync_key_text(const sync_column& column, int64_t value) {
+  switch (__sync_kind(column.desc)) {
+  case SYNC_KIND_DECIMAL:
+  case SYNC_KIND_DOUBLE:
+  case SYNC_KIND_REAL:
+  case SYNC_KIND_NUMBER:
+    return sync_key_text(column, (double) value);
+  default:
+    return __format_integer(value);
+  }
+}
+
+std::string sync_key_text(const sync_column& column, double value) {
+  char buf[64];
+  switch (__sync_kind(column.desc)) {
+  case SYNC_KIND_INTEGER:
+    return __format_integer((int64_t) std::llround(value));
+  case SYNC_KIND_DECIMAL:
+    std::snprintf(buf, sizeof(buf), "%.*f", (int) column.desc.scale, value);
+    return buf;
+  case SYNC_KIND_REAL:
+    return __format_double((double) (float) value, 17);
+  case SYNC_KIND_DOUBLE:
+  case SYNC_KIND_NUMBER:
+    return __format_double(value, 17);
+  default:
+    return __format_double(value, 15);
+  }
+}
+
+std::string server_hash_expression(const std::vector<sync_column>& columns) {
+  std::string text;
+
+  for (size_t i = 0; i < columns.size(); i++) {
+    if (columns[i].mode != SYNC_HASH_SERVER) {
+      continue;
+    }
+
+    const std::string& name = columns[i].name;
+    std::string value;
+    switch (__sync_kind(columns[i].desc)) {
+    case SYNC_KIND_CHAR:
+      value = "RTRIM(" + name + ")";
+      break;
+    case SYNC_KIND_INTEGER:
+      value = "VARCHAR(" + name + ")";
+      break;
+    case SYNC_KIND_DECIMAL:
+      value = "VARCHAR(BIGINT(" + name;
+      if (columns[i].desc.scale > 0) {
+        value += " * 1" + std::string(columns[i].desc.scale, '0');
+      }
+      value += "))";
+      break;
+    default:
+      value = name;
+      break;
+    }
+
+    text += (text.empty() ? "" : " || X'1F' || ") + std::string("COALESCE('V' || ") + value + ", 'N')";
+  }
+
+  if (text.empty()) {
+    return text;
+  }
+  return "HEX(SUBSTR(HASH_MD5(" + text + "), 1, 8))";
+}
+
+struct fetched_value {
+  bool null;
+  int kind;   // 0 integer, 1 double, 2 text
+  int64_t integer;
+  double number;
+  std::string text;
+};
+
+static void __get_fetched_value(const column_desc& desc, const fetch_buffers& buffers, size_t col, unsigned long row,
+    fetched_value& value) {
+  // DB2 only writes 32-bit indicators, see __fetch_bound
+  const INDIC_TYPE* indic = (const INDIC_TYPE*) buffers.indicator[col].get();
+  const void* data = buffers.data[col].get();
+
+  value.null = (indic[row] == SQL_NULL_DATA);
+  if (value.null) {
+    return;
+  }
+
+  switch (desc.type) {
+  case SQL_INTEGER:
+    value.kind = 0;
+    value.integer = ((const SQLINTEGER*) data)[row];
+    break;
+  case SQL_SMALLINT:
+    value.kind = 0;
+    value.integer = ((const SQLSMALLINT*) data)[row];
+    break;
+  case SQL_BIGINT:
+    value.kind = 0;
+    value.integer = ((const SQLBIGINT*) data)[row];
+    break;
+  case SQL_REAL:
+  case SQL_DOUBLE:
+  case SQL_FLOAT:
+    value.kind = 1;
+    value.number = ((const SQLDOUBLE*) data)[row];
+    break;
+  default: {
+    const SQLWCHAR* text = (const SQLWCHAR*) data + row * bound_field_width(desc);
+    value.kind = 2;
+    value.text.clear();
+    utf8::utf16to8(text, text + indic[row] / sizeof(SQLWCHAR), std::back_inserter(value.text));
+    break;
+  }
+  }
+}
+
+std::unordered_map<std::string, uint64_t> read_row_hashes(const SQLHDBC& dbc, const std::string& tbl_name,
+    const std::vector<sync_column>& key_columns, const std::vector<sync_column>& value_columns,
+    unsigned int chunksize) {
+  std::unordered_map<std::string, uint64_t> hashes;
+  std::vector<size_t> client_columns;
+  std::string query = "SELECT ";
+  size_t i;
+
+  for (i = 0; i < key_columns.size(); i++) {
+    query += (i > 0 ? ", " : "") + key_columns[i].name;
+  }
+  for (i = 0; i < value_columns.size(); i++) {
+    if (value_columns[i].mode == SYNC_HASH_CLIENT) {
+      query += ", " + value_columns[i].name;
+      client_columns.push_back(i);
+    }
+  }
+  std::string hash_expression = server_hash_expression(value_columns);
+  if (!hash_expression.empty()) {
+    query += ", " + hash_expression;
+  }
+  query += " FROM " + tbl_name;
+
+  row_hasher hasher(value_columns);
+  fetched_value value;
+  size_t nkeys = key_columns.size();
+
+  stream_query(dbc, query, chunksize,
+      [&](const std::vector<column_desc>& col_desc, const fetch_buffers& buffers, unsigned long row_count) {
+    for (unsigned long row = 0; row < row_count; row++) {
+      std::string key;
+      for (size_t k = 0; k < nkeys; k++) {
+        __get_fetched_value(col_desc[k], buffers, k, row, value);
+        if (k > 0) {
+          key += SYNC_KEY_SEPARATOR;
+        }
+        if (value.null) {
+          continue;
+        } else if (value.kind == 0) {
+          key += sync_key_text(key_columns[k], value.integer);
+        } else if (value.kind == 1) {
+          key += sync_key_text(key_columns[k], value.number);
+        } else {
+          key += sync_key_text(key_columns[k], value.text.data(), value.text.size());
+        }
+      }
+
+      hasher.begin();
+      for (size_t c = 0; c < client_columns.size(); c++) {
+        __get_fetched_value(col_desc[nkeys + c], buffers, nkeys + c, row, value);
+        if (value.null) {
+          hasher.add_null(client_columns[c]);
+        } else if (value.kind == 0) {
+          hasher.add_integer(client_columns[c], value.integer);
+        } else if (value.kind == 1) {
+          hasher.add_double(client_columns[c], value.number);
+        } else {
+          hasher.add_text(client_columns[c], value.text.data(), value.text.size());
+        }
+      }
+      if (!hash_expression.empty()) {
+        size_t col = nkeys + client_columns.size();
+        __get_fetched_value(col_desc[col], buffers, col, row, value);
+        hasher.set_server_hash(value.null ? 0 : std::strtoull(value.text.c_str(), NULL, 16));
+      }
+
+      hashes[key] = hasher.finish();
+    }
+  });
+
+  return hashes;
+}
+
+sync_plan plan_sync(std::unordered_map<std::string, uint64_t>& table_hashes, const std::vector<std::string>& keys,
+    const std::vector<uint64_t>& hashes) {
+  sync_plan plan;
+  std::unordered_map<std::string, size_t> seen;
+
+  plan.unchanged = 0;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (!seen.insert(std::make_pair(keys[i], i)).second) {
+      throw std::runtime_error("Key of row " + std::to_string(i + 1) + " appears more than once in the data");
+    }
+
+    std::unordered_map<std::string, uint64_t>::iterator found = table_hashes.find(keys[i]);
+    if (found == table_hashes.end()) {
+      plan.inserts.push_back(i);
+      continue;
+    }
+    if (found->second != hashes[i]) {
+      plan.updates.push_back(i);
+    } else {
+      plan.unchanged++;
+    }
+    table_hashes.erase(found);
+  }
+
+  for (std::unordered_map<std::string, uint64_t>::const_iterator it = table_hashes.begin(); it != table_hashes.end(); ++it) {
+    plan.deletes.push_back(it->first);
+  }
+  table_hashes.clear();
+
+  return plan;
+}
+
+} // namespace
@@ -0,0 +1,109 @@
+/*
+ Licensed Materials - Property of IBM
+
+ License: BSD 3-Clause
+
+ 5747-C31, 5747-C32
+
+ © Copyright IBM Corp. 2017    All Rights Reserved
+
+ US Government Users Restricted Rights - Use, duplication or disclosure restricted by GSA ADP Schedule Contract with IBM Corp.
+
+*/
+/*
+ * rwedb2_sync.h
+ *
+ *  Row hashes to find the rows of a table that differ from new data
+ */
+
+#ifndef SRC_RWEDB2_SYNC_H_
+#define SRC_RWEDB2_SYNC_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rwedb2_DML.h"
+
+// how the values of a column go into the row hash
+#define SYNC_HASH_SERVER 0    // DB2 hashes a text form of the value that the client can reproduce exactly
+#define SYNC_HASH_CLIENT 1    // the value is fetched and hashed by the client (floating point, DECFLOAT, temporal)
+
+namespace rdb2 {
+
+struct sync_column {
+  std::string name;
+  column_desc desc;
+  int mode;   // SYNC_HASH_*
+};
+
+// describes the columns names of tbl_name. Throws if a column has a type that cannot be compared
+std::vector<sync_column> describe_sync_columns(const SQLHDBC& dbc, const std::string& tbl_name,
+    const std::vector<std::string>& names);
+
+class row_hasher {
+  /* 64-bit hash of the value columns of a row, computed the same way for rows of new data and for rows of
+   * the table. The values of SYNC_HASH_SERVER columns are written as
+   *   'V' || text (or 'N' for NULL), separated by X'1F'
+   * where text is the string itself (right trimmed for CHAR), the integer, or the DECIMAL value times
+   * 10^scale as an integer. The first 8 bytes of the MD5 digest of that, which DB2 computes with HASH_MD5,
+   * are combined with an FNV-1a hash of the SYNC_HASH_CLIENT values.
+   */
+public:
+  explicit row_hasher(const std::vector<sync_column>& columns);
+
+  void begin();
+
+  // the value of column col, converted to the type of the column
+  void add_text(size_t col, const char* value, size_t length);
+  void add_integer(size_t col, int64_t value);
+  void add_double(size_t col, double value);
+  void add_null(size_t col);
+
+  // for a row read from the table: the hash of its SYNC_HASH_SERVER values as computed by DB2
+  void set_server_hash(uint64_t hash);
+
+  uint64_t finish();
+
+private:
+  const std::vector<sync_column>& columns;
+  std::string server_text;
+  uint64_t client_hash;
+  bool has_server_hash;
+  uint64_t server_hash;
+
+  void __add_server_text(size_t col, const std::string& text);
+  void __add_client_bytes(const void* data, size_t size);
+};
+
+// text of a key value in the form used to match keys of the new data with keys of the table. The values
+// of a key are joined with SYNC_KEY_SEPARATOR
+#define SYNC_KEY_SEPARATOR '\x1F'
+std::string sync_key_text(const sync_column& column, const char* value, size_t length);
+std::string sync_key_text(const sync_column& column, int64_t value);
+std::string sync_key_text(const sync_column& column, double value);
+
+// SQL expression for the hash of the SYNC_HASH_SERVER columns, 16 hex digits. Empty if there are none
+std::string server_hash_expression(const std::vector<sync_column>& columns);
+
+// reads the key and the row hash of every row of tbl_name with the streaming reader
+std::unordered_map<std::string, uint64_t> read_row_hashes(const SQLHDBC& dbc, const std::string& tbl_name,
+    const std::vector<sync_column>& key_columns, const std::vector<sync_column>& value_columns,
+    unsigned int chunksize);
+
+struct sync_plan {
+  std::vector<size_t> inserts;      // rows of the new data whose key is not in the table
+  std::vector<size_t> updates;      // rows of the new data whose hash differs from that of the table row
+  std::vector<std::string> deletes; // keys of the table rows that are not in the new data
+  unsigned long unchanged;
+};
+
+// compares the keys and hashes of the new data with those of the table, which are consumed.
+// Throws if a key appears more than once in the new data
+sync_plan plan_sync(std::unordered_map<std::string, uint64_t>& table_hashes, const std::vector<std::string>& keys,
+    const std::vector<uint64_t>& hashes);
+
+}
+
+#endif /* SRC_RWEDB2_SYNC_H_ */
@@ -20,6 +20,13 @@
 
 #include "rwedb2_utils.h"
 #include "utf8.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #ifdef RDB2_DEBUG
 #include <iostream>
@@ -71,6 +78,31 @@ void encodeUTF8StringAsUTF16(SQLWCHAR* const dest, const std::string& source) {
   return;
 }
 
+size_t encodeUTF8StringAsUTF16(SQLWCHAR* const dest, const char* const source, const size_t len) {
+/*
+ * same as above but works directly off a char buffer of len bytes so that callers
+ * do not need to construct a std::string. Returns the number of UTF-16 code units written,
+ * not counting the closing null character.
+ * dest must contain at least (len + 1) SQLWCHAR elements
+ */
+  SQLWCHAR* last_char = utf8::utf8to16(source, source + len, dest);
+  *last_char = 0;  // closing null character
+
+  return (size_t) (last_char - dest);
+}
+
+const std::vector<SQLWCHAR>* utf16_string_cache::insert(const void* key, const char* const source, const size_t len) {
+  if (full()) {
+    return NULL;
+  }
+
+  std::vector<SQLWCHAR>& encoded = entries[key];
+  encoded.resize(len + 1);
+  encoded.resize(encodeUTF8StringAsUTF16(encoded.data(), source, len));
+
+  return &encoded;
+}
+
 std::string encodeUTF16StringAsUTF8(const SQLWCHAR* const source, const SQLLEN& len) {
   std::string utf8line;
   utf8::utf16to8(source, source + (len / sizeof(SQLWCHAR)), std::back_inserter(utf8line));
@@ -95,6 +127,45 @@ std::shared_ptr<SQLWCHAR> get_UTF16_string(const std::string& source) {
   encodeUTF8StringAsUTF16(utf16line.get(), source);
   return utf16line;
 }
+
+mapped_file::mapped_file(const std::string& path, bool sequential, bool copy_on_write) :
+    fd(-1), data(NULL), size(0) {
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open " + path + ": " + std::strerror(errno));
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("Unable to read the size of " + path + ": " + std::strerror(errno));
+  }
+  size = st.st_size;
+
+  if (size > 0) {
+    int protection = copy_on_write ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void* mapped = mmap(NULL, size, protection, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Unable to map " + path + ": " + std::strerror(errno));
+    }
+    data = (const char*) mapped;
+    if (sequential) {
+      // the file is read once from start to end
+      madvise(mapped, size, MADV_SEQUENTIAL);
+    }
+  }
+}
+
+mapped_file::~mapped_file() {
+  if (data != NULL) {
+    munmap((void*) data, size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
 #ifdef RDB2_DEBUG
 
 void hexdump(void *mem, unsigned int len, unsigned int HEXDUMP_COLS) {
@@ -24,19 +24,120 @@
 #include <sql.h>
 #include <sqlext.h>
 #include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
 
 
 #define SQL_DECFLOAT -360  // this does not seem to be defined in the unixODBC headers
 
+// DB2 CLI statement attribute that controls whether an array insert stops at the first failing row
+// (from sqlcli1.h, not defined in the unixODBC headers)
+#ifndef SQL_ATTR_PARAMOPT_ATOMIC
+#define SQL_ATTR_PARAMOPT_ATOMIC 1260
+#define SQL_ATOMIC_NO 0
+#define SQL_ATOMIC_YES 1
+#endif
+
+// DB2 CLI statement attributes that send array inserts through the LOAD utility (from sqlcli1.h)
+#ifndef SQL_ATTR_USE_LOAD_API
+#define SQL_ATTR_USE_LOAD_API 2310
+#define SQL_ATTR_LOAD_INFO 2311
+#define SQL_ATTR_LOAD_ROWS_READ_PTR 2312
+#define SQL_ATTR_LOAD_ROWS_SKIPPED_PTR 2313
+#define SQL_ATTR_LOAD_ROWS_COMMITTED_PTR 2314
+#define SQL_ATTR_LOAD_ROWS_LOADED_PTR 2315
+#define SQL_ATTR_LOAD_ROWS_REJECTED_PTR 2316
+#define SQL_ATTR_LOAD_ROWS_DELETED_PTR 2317
+#define SQL_USE_LOAD_OFF 0
+#define SQL_USE_LOAD_INSERT 1
+#define SQL_USE_LOAD_REPLACE 2
+#endif
+
+// DB2 CLI large object and XML types (from sqlcli1.h, not defined in the unixODBC headers)
+#ifndef SQL_BLOB
+#define SQL_BLOB -98
+#define SQL_CLOB -99
+#define SQL_DBCLOB -350
+#endif
+#ifndef SQL_XML
+#define SQL_XML -370
+#endif
+#ifndef SQL_GRAPHIC
+#define SQL_GRAPHIC -95
+#define SQL_VARGRAPHIC -96
+#define SQL_LONGVARGRAPHIC -97
+#endif
+
+// maximum number of distinct strings remembered by a utf16_string_cache
+#define UTF16_CACHE_MAX_ENTRIES 1024
+
 namespace rdb2 {
 std::string extract_error(const std::string& fn, SQLHANDLE handle, SQLSMALLINT type);
 
 void encodeUTF8StringAsUTF16(SQLWCHAR* const dest, const std::string& source);
 
+size_t encodeUTF8StringAsUTF16(SQLWCHAR* const dest, const char* const source, const size_t len);
+
 std::string encodeUTF16StringAsUTF8(const SQLWCHAR* const source, const SQLLEN& len);
 
 std::shared_ptr<SQLWCHAR> get_UTF16_string(const std::string& source);
 
+class utf16_string_cache {
+  // remembers the UTF-16 encoding of strings keyed by the address of the source string.
+  // This is only useful when the caller guarantees that equal addresses mean equal strings
+  // (eg. R CHARSXPs, which are interned in R's global string cache).
+  // Once max_entries strings are cached, new strings are no longer added so that
+  // high cardinality columns do not grow the cache without bound
+public:
+  utf16_string_cache(size_t max_entries = UTF16_CACHE_MAX_ENTRIES) :
+      max_entries(max_entries) {
+  }
+
+  const std::vector<SQLWCHAR>* find(const void* key) const {
+    std::unordered_map<const void*, std::vector<SQLWCHAR>>::const_iterator it = entries.find(key);
+    return (it == entries.end()) ? NULL : &(it->second);
+  }
+
+  const std::vector<SQLWCHAR>* insert(const void* key, const char* const source, const size_t len);
+
+  bool full() const {
+    return entries.size() >= max_entries;
+  }
+
+  void clear() {
+    entries.clear();
+  }
+
+private:
+  size_t max_entries;
+  std::unordered_map<const void*, std::vector<SQLWCHAR>> entries;
+};
+
+class mapped_file {
+  // memory map of a whole file. With copy_on_write the pages can be written, but the changes are private
+  // to the process and never reach the file
+public:
+  mapped_file(const std::string& path, bool sequential = true, bool copy_on_write = false);
+  ~mapped_file();
+
+  const char* begin() const {
+    return data;
+  }
+
+  const char* end() const {
+    return data + size;
+  }
+
+private:
+  int fd;
+  const char* data;
+  size_t size;
+
+  mapped_file(const mapped_file&);
+  mapped_file& operator=(const mapped_file&);
+};
+
 #ifdef RDB2_DEBUG
 void hexdump(void *mem, unsigned int len, unsigned int HEXDUMP_COLS);
 #endif
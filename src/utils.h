@@ -15,10 +15,59 @@
 
 #include <Rcpp.h>
 
+#include "rwedb2_DML.h"
+#include "rwedb2_spill.h"
+#include "rwedb2_cache.h"
+
 namespace rdb2 {
 
 void R_msg(const std::string& txt);
 
+// R column types of a dataframe as COLTYPE_* (defined in WriteTable.cpp)
+std::vector<short> init_col_vectors(const Rcpp::DataFrame& df, const Rcpp::List& R_coltypes);
+
+// fill function that encodes rows of df into parameter buffers (defined in WriteTable.cpp)
+fill_function get_dataframe_fill(const Rcpp::DataFrame& df, const std::vector<short>& coltypes,
+    const std::vector<int>& varchar_col_lengths);
+
+struct string_column_view {
+  // strings laid out as in compact_strings, kept alive by owner
+  const char* data;
+  const uint64_t* offsets;
+  const uint8_t* valid;
+  size_t size;
+  std::shared_ptr<const void> owner;
+};
+
+// character vector whose elements are only converted to R strings when they are accessed (defined in
+// LazyStrings.cpp). A plain character vector if R does not support ALTREP
+SEXP make_lazy_strings(const string_column_view& strings);
+SEXP make_lazy_strings(const std::shared_ptr<compact_strings>& strings);
+
+// list of raw vectors with the bytes of each element, NULL for NA, for binary LOB columns (defined in
+// LazyStrings.cpp)
+SEXP make_raw_list(const string_column_view& values);
+SEXP make_raw_list(const std::shared_ptr<compact_strings>& values);
+
+// vector over the mapped files of a spilled column (defined in MappedVectors.cpp). Read into a plain
+// vector if R does not support ALTREP. The strings of a binary LOB column are copied into raw vectors
+SEXP make_mapped_vector(const spilled_column& column, bool binary = false);
+
+// converts read results to a dataframe (defined in ReadTable.cpp)
+Rcpp::DataFrame __get_DataFrame(const read_results& results, bool strings_as_factors);
+
+// converts a cached result to a dataframe (defined in ReadTable.cpp)
+Rcpp::DataFrame __get_cached_DataFrame(const cached_result& cached, bool strings_as_factors, bool lazy_strings);
+
+// settings of the result cache, with the directory defaulting to a subdirectory of tempdir() (defined in
+// ResultCache.cpp)
+cache_options get_result_cache_options();
+
+cache_key get_cache_key(const SQLHDBC& dbc, const std::string& sql, const std::string& params);
+
+// stores results in the cache, warning instead of failing if that is not possible
+void cache_results(const cache_key& key, const read_results& results);
+
 }
 #endif
 